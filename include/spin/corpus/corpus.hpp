@@ -19,12 +19,23 @@ namespace spin {
   typedef boost::shared_ptr<corpus_iterator> corpus_iterator_ptr;
   typedef boost::shared_ptr<corpus_writer> corpus_writer_ptr;
   
+  /// With prefetch > 0, up to prefetch entries are read ahead on a
+  /// background thread (see prefetching_corpus_iterator)
   corpus_iterator_ptr
   make_corpus_iterator(const std::string& path, 
-                       boost::logic::tribool is_binary = boost::logic::indeterminate);
+                       boost::logic::tribool is_binary = boost::logic::indeterminate,
+                       size_t prefetch = 0);
   corpus_iterator_ptr
   make_corpus_iterator(const std::string& path, corpus_pos_t pos,
-                       boost::logic::tribool is_binary = boost::logic::indeterminate);
+                       boost::logic::tribool is_binary = boost::logic::indeterminate,
+                       size_t prefetch = 0);
+
+  /// Entries of the keys in the given order, looked up from the index
+  /// written along with the corpus (see corpus_index).  Throws if the index
+  /// is not available or a key is not found.
+  corpus_iterator_ptr
+  make_corpus_iterator(const std::string& path,
+                       const std::vector<std::string>& keys);
 
   corpus_writer_ptr
   make_corpus_writer(const std::string& path, bool is_binary);
@@ -52,6 +63,11 @@ namespace spin {
     }
 
     virtual corpus_pos_t pos() const = 0;
+
+    /// Move to the entry at pos
+    virtual void seek(corpus_pos_t pos) {
+      throw std::runtime_error("Seek is not supported in this corpus");
+    }
   };
 
 
@@ -59,6 +75,10 @@ namespace spin {
   public:
     virtual ~corpus_writer() { }
     virtual void write(const corpus_entry& entry)=0;
+
+    /// Finish the corpus and write its index, called by the destructor
+    /// if not called explicitly
+    virtual void close() { }
   };
 
   class zipped_corpus_iterator : public corpus_iterator {
@@ -73,7 +93,9 @@ namespace spin {
     typedef
     std::vector<std::pair<std::string,corpus_iterator_ptr> > corpus_iterators;
 
-    zipped_corpus_iterator(corpus_iterators& ites);
+    /// Each input is read ahead by prefetch entries on its own thread,
+    /// unless prefetch is 0
+    zipped_corpus_iterator(corpus_iterators& ites, size_t prefetch = 4);
     virtual ~zipped_corpus_iterator();
 
     virtual bool done();
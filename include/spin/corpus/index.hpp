@@ -0,0 +1,85 @@
+#ifndef spin_corpus_index_hpp_
+#define spin_corpus_index_hpp_
+
+#include <spin/corpus/corpus.hpp>
+#include <spin/io/statfile.hpp>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+namespace spin {
+  /**
+   * Sidecar index of a corpus, stored as "<corpus>.idx" by corpus writers.
+   * It holds the position and the length of every entry sorted by key, so
+   * that entries can be looked up by binary search on the mapped file.
+   * The size of the corpus is recorded as well, and an index that doesn't
+   * match the corpus is ignored.
+   */
+  class corpus_index {
+  public:
+    enum { SEC_KEY_OFFSETS = 0, SEC_KEYS, SEC_RECORDS };
+    enum { PARAM_NENTRIES = 0, PARAM_CORPUS_SIZE, PARAM_BINARY };
+  private:
+    stat_file _file;
+    const uint64_t* _key_offsets; // (# entries + 1)
+    const char* _keys;
+    const uint64_t* _records; // position and length
+    size_t _nentries;
+  public:
+    explicit corpus_index(const std::string& corpus_path);
+
+    static std::string index_path(const std::string& corpus_path);
+
+    /// Check if the corpus has an index consistent with it
+    static bool is_available(const std::string& corpus_path);
+
+    size_t size() const { return _nentries; }
+    bool is_binary() const { return _file.param(PARAM_BINARY) != 0; }
+
+    std::string key(size_t i) const {
+      return std::string(_keys + _key_offsets[i],
+                         _key_offsets[i + 1] - _key_offsets[i]);
+    }
+    corpus_pos_t position(size_t i) const { return _records[2 * i]; }
+    size_t length(size_t i) const { return _records[2 * i + 1]; }
+
+    /// Index of the first entry of the key, -1 if not found
+    int find(const std::string& key) const;
+  };
+
+  /// Collects the entries written by a corpus writer for corpus_index
+  class corpus_index_writer {
+    struct record {
+      std::string key;
+      uint64_t position, length;
+      bool operator < (const record& oth) const { return key < oth.key; }
+    };
+    std::vector<record> _records;
+  public:
+    /// Entries without +key are not indexed
+    void add(const corpus_entry& entry, corpus_pos_t pos, size_t length);
+
+    /// Failures are only warned since the corpus is complete without index
+    void write(const std::string& corpus_path, size_t corpus_size,
+               bool is_binary);
+  };
+
+  /// Entries of a corpus at the positions, in the given order
+  class positioned_corpus_iterator : public corpus_iterator {
+    corpus_iterator_ptr _base;
+    std::vector<corpus_pos_t> _positions;
+    size_t _cur;
+  public:
+    positioned_corpus_iterator(const std::string& path,
+                               const std::vector<corpus_pos_t>& positions,
+                               boost::logic::tribool is_binary
+                               = boost::logic::indeterminate);
+
+    virtual bool done() { return _cur >= _positions.size(); }
+    virtual void next();
+    virtual const corpus_entry& value() { return _base->value(); }
+    virtual corpus_pos_t pos() const { return _positions[_cur]; }
+  };
+}
+
+#endif
@@ -3,11 +3,15 @@
 
 #include <spin/types.hpp>
 #include <spin/corpus/corpus.hpp>
+#include <spin/corpus/index.hpp>
 #include <spin/io/msgpack.hpp>
+#include <spin/io/mmap.hpp>
+#include <deque>
 
 namespace spin {
 
   class msgpack_corpus_iterator : public corpus_iterator {
+    std::string _path;
     std::istream* _input_stream;
     corpus_entry _cursor;
     size_t _curpos;
@@ -19,14 +23,52 @@ namespace spin {
     const corpus_entry& value();
 
     virtual corpus_pos_t pos() const { return _curpos; }
+    virtual void seek(corpus_pos_t pos);
+  };
+
+  /**
+   * Reader of msgpack corpora on a memory mapping.  Records are parsed in
+   * place, so that strings and ext payloads refer to the mapping.  value()
+   * converts the current record to a corpus_entry on demand, copying each
+   * matrix once, whereas fmatrix_field() gives a view of a matrix without
+   * copying unless its elements are misaligned in the file.
+   */
+  class mapped_msgpack_corpus_iterator : public corpus_iterator {
+    mapped_file_ptr _mapping;
+    size_t _curpos, _nextpos;
+    bool _done;
+    msgpack::unpacked _record;
+    bool _converted;
+    corpus_entry _cursor;
+    std::deque<fmatrix> _copies; // of misaligned matrices
+
+    const msgpack::object* find_field(const std::string& key) const;
+  public:
+    typedef Eigen::Map<const fmatrix> fmatrix_view;
+
+    mapped_msgpack_corpus_iterator(const std::string& filepath,
+                                   corpus_pos_t pos = 0);
+    bool done() { return _done; }
+    void next();
+    const corpus_entry& value();
+    std::string get_key();
+
+    virtual corpus_pos_t pos() const { return _curpos; }
+    virtual void seek(corpus_pos_t pos);
+
+    /// View of a float matrix in the current entry, valid until next()
+    fmatrix_view fmatrix_field(const std::string& key);
   };
 
   class msgpack_corpus_writer : public corpus_writer {
+    std::string _path;
     std::ostream* _output_stream;
+    corpus_index_writer _index;
   public:
     msgpack_corpus_writer(const std::string& filepath);
     virtual ~msgpack_corpus_writer();
     virtual void write(const corpus_entry& object);
+    virtual void close();
   };
 
 }
@@ -0,0 +1,48 @@
+#ifndef spin_corpus_prefetch_hpp_
+#define spin_corpus_prefetch_hpp_
+
+#include <spin/corpus/corpus.hpp>
+#include <spin/parallel.hpp>
+#include <exception>
+#include <memory>
+#include <thread>
+
+namespace spin {
+  /**
+   * Decorator reading the entries of another iterator on a background
+   * thread.  At most depth entries are read ahead of the current one, and
+   * the reader waits while the queue is full.  The base iterator must not
+   * be used by others while it is decorated.  An exception thrown by the
+   * base iterator is rethrown from next() at the entry it happened.
+   */
+  class prefetching_corpus_iterator : public corpus_iterator {
+    struct item {
+      corpus_entry entry;
+      corpus_pos_t pos;
+      std::exception_ptr error;
+      item() : pos(0) { }
+    };
+
+    corpus_iterator_ptr _base;
+    size_t _depth;
+    std::unique_ptr<bounded_queue<item> > _queue;
+    std::thread _reader;
+    item _current;
+    bool _done;
+
+    void start();
+    void stop();
+    void fetch();
+  public:
+    prefetching_corpus_iterator(corpus_iterator_ptr base, size_t depth);
+    virtual ~prefetching_corpus_iterator();
+
+    virtual bool done() { return _done; }
+    virtual void next();
+    virtual const corpus_entry& value() { return _current.entry; }
+    virtual corpus_pos_t pos() const { return _current.pos; }
+    virtual void seek(corpus_pos_t pos);
+  };
+}
+
+#endif
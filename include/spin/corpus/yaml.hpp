@@ -5,10 +5,12 @@
 #include <yaml-cpp/yaml.h>
 #include <spin/types.hpp>
 #include <spin/corpus/corpus.hpp>
+#include <spin/corpus/index.hpp>
 
 namespace spin {
 
   class yaml_corpus_iterator : public corpus_iterator {
+    std::string _path; // empty if constructed from a stream
     std::istream* _input_stream;
     variant_t _cursor;
 
@@ -29,14 +31,18 @@ namespace spin {
 
     const corpus_entry& value();
     virtual corpus_pos_t pos() const { return _curpos; }
+    virtual void seek(corpus_pos_t pos);
   };
 
   class yaml_corpus_writer : public corpus_writer {
+    std::string _path;
     std::ostream* _output_stream;
+    corpus_index_writer _index;
   public:
     yaml_corpus_writer(const std::string& filepath);
     virtual ~yaml_corpus_writer();
     virtual void write(const corpus_entry& entry);
+    virtual void close();
   };
 
 }
@@ -0,0 +1,109 @@
+#ifndef spin_decode_arena_hpp_
+#define spin_decode_arena_hpp_
+
+#include <vector>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+namespace spin {
+  /**
+   * Chunked pool for trivially destructible records.
+   *
+   * Records are carved from fixed-size chunks, so a pointer returned by
+   * allocate() stays valid until clear() is called.  clear() only rewinds
+   * the cursor; chunks obtained for a previous utterance are reused, which
+   * keeps malloc traffic independent of the number of records.
+   */
+  template <typename T>
+  class chunked_arena {
+    static_assert(std::is_trivially_destructible<T>::value,
+                  "chunked_arena only holds trivially destructible records");
+
+    size_t _chunk_size;
+    std::vector<T*> _chunks;
+    size_t _chunk;  // index of the chunk currently used
+    size_t _offset; // # of records used in the current chunk
+    size_t _size;   // # of records handed out since the last clear()
+
+    chunked_arena(const chunked_arena&);
+    chunked_arena& operator=(const chunked_arena&);
+  public:
+    explicit chunked_arena(size_t chunk_size = 4096)
+      : _chunk_size(chunk_size), _chunk(0), _offset(0), _size(0) {
+    }
+
+    ~chunked_arena() {
+      for (auto p : _chunks) ::operator delete(p);
+    }
+
+    /// Returns uninitialized storage for n contiguous records
+    T* allocate(size_t n = 1) {
+      if (n > _chunk_size) {
+        throw std::length_error("Request exceeds the arena chunk size");
+      }
+      if (_offset + n > _chunk_size) {
+        ++ _chunk;
+        _offset = 0;
+      }
+      if (_chunk == _chunks.size()) {
+        _chunks.push_back(static_cast<T*>(::operator new(sizeof(T) *
+                                                         _chunk_size)));
+      }
+      T* p = _chunks[_chunk] + _offset;
+      _offset += n;
+      _size += n;
+      return p;
+    }
+
+    template <typename... Args>
+    T* create(Args&&... args) {
+      return new (allocate()) T(std::forward<Args>(args)...);
+    }
+
+    /// Forget all records; O(1), memory is kept for reuse
+    void clear() {
+      _chunk = 0;
+      _offset = 0;
+      _size = 0;
+    }
+
+    size_t size() const { return _size; }
+    size_t capacity() const { return _chunks.size() * _chunk_size; }
+  };
+
+  /**
+   * chunked_arena with a free list, for records that are released one by
+   * one.  Released records are handed out again before the arena grows.
+   */
+  template <typename T>
+  class recycling_pool {
+    chunked_arena<T> _arena;
+    std::vector<T*> _free;
+  public:
+    explicit recycling_pool(size_t chunk_size = 4096)
+      : _arena(chunk_size) {
+    }
+
+    T* allocate() {
+      if (_free.empty()) return _arena.allocate();
+      T* p = _free.back();
+      _free.pop_back();
+      return p;
+    }
+
+    void release(T* p) { _free.push_back(p); }
+
+    void clear() {
+      _arena.clear();
+      _free.clear();
+    }
+
+    /// # of records in use
+    size_t size() const { return _arena.size() - _free.size(); }
+    size_t capacity() const { return _arena.capacity(); }
+  };
+}
+
+#endif
@@ -4,10 +4,16 @@
 #include <queue>
 #include <map>
 #include <unordered_map>
+#include <iterator>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <fst/fst.h>
 #include <boost/tuple/tuple.hpp>
-#include <boost/container/small_vector.hpp>
 #include <fst/topsort.h>
+#include <spin/decode/arena.hpp>
+#include <spin/decode/slot_map.hpp>
+#include <spin/decode/transition_table.hpp>
 
 namespace spin {
   class no_hypothesis : public std::runtime_error {
@@ -20,156 +26,328 @@ namespace spin {
     typedef fst::Fst<fst::StdArc> network;
     typedef fst::Fst<fst::StdArc>::StateId fst_state;
     typedef fst::Fst<fst::StdArc>::Arc fst_arc;
-    network& _decodingnet;
     frame_scorer* _scorer;
 
-    std::vector<int> _ilabel_to_hmm_state;
-    
-    struct transition {
+    /// Word-level backpointer used in the best-path mode
+    struct word_trace {
+      const word_trace* prev;
+      int olabel;
+      int start_t; // frame where the word arc is taken
+      mutable bool marked; // used by collect_traces()
+    };
+
+    /// Hypothesis record owned by the per-utterance arena
+    struct hypo {
+      const hypo* prev_hypo;
+      const fst_arc* arcs; // arcs traversed by the transition, owned by _table
+      int narcs;
       fst_state prev_fst_state;
-      boost::container::small_vector<fst_arc, 2> arcs;
-      typedef boost::container::small_vector<fst_arc, 2>::const_reverse_iterator
-      const_reverse_arc_iterator;      
-      
-      float weight; // sum of arc transition weight, i.e. LM weight
       int next_hmm_state;
       bool self_loop;
+      float trans_weight; // sum of arc transition weight, i.e. LM weight
+      float weight;
+      uint64_t signature; // hash of the output label sequence
+      const word_trace* trace; // only in the best-path mode
 
-      transition()
-        : prev_fst_state(-1), arcs(), weight(0.0), next_hmm_state(-1),
-          self_loop(false) {
-      }
-      
-      transition(fst_state st, float w)
-        : prev_fst_state(st), arcs(), weight(w), next_hmm_state(-1),
-          self_loop(false) {
-      }
+      const hypo* next_branch; // merged branches are chained from the best
+      int nbranches;
+
+      typedef std::reverse_iterator<const fst_arc*> const_reverse_arc_iterator;
 
       const fst_arc& get_last_arc() const {
-        assert(arcs.size() != 0);
-        return arcs[arcs.size() - 1];
+        assert(narcs != 0);
+        return arcs[narcs - 1];
       }
-
       fst_state get_next_fst_state() const {
-        return (arcs.size() == 0) ? prev_fst_state : get_last_arc().nextstate;
+        return (narcs == 0) ? prev_fst_state : get_last_arc().nextstate;
       }
+      bool has_epsilon() const { return narcs > 1; }
+      bool is_self_loop() const { return self_loop; }
 
-      uint32_t update_signature(uint32_t sign) const {
-        for (auto arc : arcs) {
-          if (arc.olabel == 0) continue;
-          sign = sign << 11;
-          sign ^= static_cast<uint32_t>(arc.olabel);
-        }
-        return sign;
+      const_reverse_arc_iterator arcs_rbegin() const {
+        return const_reverse_arc_iterator(arcs + narcs);
+      }
+      const_reverse_arc_iterator arcs_rend() const {
+        return const_reverse_arc_iterator(arcs);
       }
-
-      bool has_epsilon() const { return arcs.size() > 1; }
-
-      bool is_self_loop() const { return self_loop; }
     };
 
-    struct hypo {
-      hypo* prev_hypo;
-      transition trans;
+    /// Expansion result that is alive only while a frame is processed
+    struct candidate {
+      const hypo* prev_hypo;
+      const fst_arc* arcs;
+      int narcs;
+      fst_state prev_fst_state;
+      int next_hmm_state;
+      bool self_loop;
+      bool word_end; // an output label is crossed
+      float trans_weight;
       float weight; // used as a sort key
+      uint64_t signature; // hash of the output label sequence
 
-      std::vector<hypo> merged_branch;
-      uint32_t signature;
-      
-      hypo() : prev_hypo(0), weight(HUGE_VALF), signature(0) { }
-      hypo(hypo* p, transition tr, float w, uint32_t sign)
-        : prev_hypo(p), trans(tr), weight(w), signature(sign) { }
-
-      const fst_arc& get_last_arc() const {
-        return trans.get_last_arc();
-      }
       fst_state get_next_fst_state() const {
-        return trans.get_next_fst_state();
+        return (narcs == 0) ? prev_fst_state : arcs[narcs - 1].nextstate;
       }
     };
     
-    struct hypo_weight_comp {
-      bool operator()(const hypo& h1, const hypo& h2) const {
-        return h1.weight < h2.weight;
-      }
-    };
-
-    
-    typedef std::vector<hypo> hypos;
-    std::list<hypos> _frame_hypos;
+    typedef std::vector<candidate> candidates;
+    typedef std::vector<const hypo*> hypos;
+
+    transition_table_ptr _table;
+    fst_arc _init_arc;
+    // In the best-path mode, the two arenas hold the records of the current
+    // and the previous frames alternately.  Otherwise only the first is used.
+    chunked_arena<hypo> _hypo_arena;
+    chunked_arena<hypo> _spare_hypo_arena;
+    bool _use_spare_arena;
+    const hypo* _root;
+    hypos _active;
+    int _nframes; // # of frames pushed including initial and final
+
+    // work area reused over frames
+    candidates _next_candidates;
+    std::vector<int> _heads; // indices of the best candidate for each state
+    std::vector<int> _branch_links; // next branch of each candidate
+    std::vector<int> _branch_tails;
+    dense_slot_map _fstst_to_slot; // FST state + 1 -> slot
+    std::vector<int> _cand_slots; // slot of each candidate
+    std::vector<float> _slot_best; // best weight of each slot
+    std::vector<int> _slot_head; // index in _heads of each slot
+    std::vector<float> _cutoff_work;
+    std::vector<int> _order; // surviving candidates sorted by weight
+    std::vector<int> _frame_states; // HMM states scored in the frame
+    std::vector<float> _frame_scores;
+    std::vector<int> _state_slot; // HMM state -> index in _frame_states
+
+    bool _best_path_only;
+    recycling_pool<word_trace> _trace_pool;
+    std::vector<word_trace*> _traces; // all the records taken from the pool
+    size_t _trace_gc_threshold;
     
+    bool _lookahead;
+    float _word_end_beam;
+    std::vector<float> _cand_keys; // pruning weight of each candidate
+
     int _maxactive;
     float _beamwidth;
     float _acscale;
     int _maxbranch;
+
+    // adaptive beam control, see set_adaptive_beam()
+    int _base_maxactive;
+    float _base_beamwidth;
+    int _target_active; // 0 when disabled
+    float _min_beam;
+    float _max_beam;
+    float _target_rtf; // 0 when disabled
+    float _frame_rate;
+    int _rtf_target_active; // _target_active lowered to meet _target_rtf
+    std::chrono::steady_clock::time_point _start_time;
+    std::vector<float> _beam_trajectory;
+    std::vector<int> _active_trajectory;
     
   public:
     /// Initialize decoder object
-    decoder(network& decodingnet, frame_scorer* scorer)
-      : _decodingnet(decodingnet), _scorer(scorer), 
-        _maxactive(10000), _beamwidth(250.0), _acscale(0.2), _maxbranch(10) {
-      initialize_ilabel_map();
-    }
-
-    /// Load mapping between FST ilabel and HMM state
-    void initialize_ilabel_map() {
-      if (_decodingnet.InputSymbols() == 0) {
-        ERROR("Decoding net doesn't have an input symbol table");
-        throw std::runtime_error("Decoding net doesn't have an input symbol table");
-      }
-      for (fst::StateIterator<network> stit(_decodingnet);
-           ! stit.Done(); stit.Next()) {
-        for (fst::ArcIterator<network> ait(_decodingnet, stit.Value());
-             ! ait.Done(); ait.Next()) {
-          int ilab = ait.Value().ilabel;
-          const std::string& isym = _decodingnet.InputSymbols()->Find(ilab);
-          int hmmst = -1;
-          if (ilab == 0) {
-            hmmst = -1;
-          } else if (isym[0] == 'S') {
-            size_t sep = isym.find(';');
-            size_t len = (sep == std::string::npos)
-              ? std::string::npos : sep - 1;
-            try {
-              hmmst = boost::lexical_cast<int>(isym.substr(1, len));
-            } catch (boost::bad_lexical_cast) {
-              ERROR("Failed to parse input symbol: %s", isym.c_str());
-              throw;
-            }
-          } else {
-            hmmst = -1;
-          }
+    decoder(const network& decodingnet, frame_scorer* scorer)
+      : _scorer(scorer), _table(new transition_table(decodingnet)),
+        _hypo_arena(16384), _spare_hypo_arena(16384), _use_spare_arena(false),
+        _root(0), _nframes(0),
+        _maxactive(10000), _beamwidth(250.0), _acscale(0.2), _maxbranch(10),
+        _best_path_only(false), _trace_gc_threshold(0),
+        _lookahead(false), _word_end_beam(HUGE_VALF),
+        _base_maxactive(10000), _base_beamwidth(250.0), _target_active(0),
+        _min_beam(0.0), _max_beam(HUGE_VALF), _target_rtf(0.0),
+        _frame_rate(100.0), _rtf_target_active(0) {
+    }
 
-          while (_ilabel_to_hmm_state.size() < ilab + 1) {
-            _ilabel_to_hmm_state.push_back(-1);
-          }
-          _ilabel_to_hmm_state[ilab] = hmmst;
-        }
+    /// Initialize decoder object with a table shared with other decoders,
+    /// or loaded from a graph file
+    decoder(transition_table_ptr table, frame_scorer* scorer)
+      : _scorer(scorer), _table(table),
+        _hypo_arena(16384), _spare_hypo_arena(16384), _use_spare_arena(false),
+        _root(0), _nframes(0),
+        _maxactive(10000), _beamwidth(250.0), _acscale(0.2), _maxbranch(10),
+        _best_path_only(false), _trace_gc_threshold(0),
+        _lookahead(false), _word_end_beam(HUGE_VALF),
+        _base_maxactive(10000), _base_beamwidth(250.0), _target_active(0),
+        _min_beam(0.0), _max_beam(HUGE_VALF), _target_rtf(0.0),
+        _frame_rate(100.0), _rtf_target_active(0) {
+    }
+
+    /// Extend the hash of an output label sequence with the labels on the
+    /// arcs.  Each step is a full 64-bit mix, so that the whole history
+    /// affects the result.
+    static uint64_t update_signature(uint64_t sign,
+                                     const fst_arc* arcs, int narcs) {
+      for (int n = 0; n < narcs; ++ n) {
+        if (arcs[n].olabel == 0) continue;
+        uint64_t z = sign + 0x9e3779b97f4a7c15ULL +
+          static_cast<uint64_t>(arcs[n].olabel);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        sign = z ^ (z >> 31);
       }
+      return sign;
     }
 
-    void set_max_active(int m) { _maxactive = m; }
-    void set_beam_width(float w) { _beamwidth = w; }
+    void set_max_active(int m) { _maxactive = _base_maxactive = m; }
+    void set_beam_width(float w) { _beamwidth = _base_beamwidth = w; }
     void set_acoustic_scale(float s) { _acscale = s; }
     void set_max_branch(int m) { _maxbranch = m; }
+
+    /// Prune with the LM weight to the next word added (see
+    /// transition_table::lookahead())
+    void set_lm_lookahead(bool b) { _lookahead = b; }
+
+    /// Beam for the candidates that have just crossed an output label
+    void set_word_end_beam(float w) { _word_end_beam = w; }
+
+    /// Adjust the beam frame by frame so that about target_active
+    /// hypotheses survive.  The beam starts from set_beam_width() and is
+    /// kept in [min_beam, max_beam]; max-active follows at twice the
+    /// target, up to set_max_active().  0 disables the control.
+    void set_adaptive_beam(int target_active, float min_beam,
+                           float max_beam) {
+      _target_active = target_active;
+      _min_beam = min_beam;
+      _max_beam = max_beam;
+    }
+
+    /// Lower the target of the adaptive beam while decoding is slower than
+    /// the given real-time factor.  Time is measured from push_init(), so
+    /// this is meant for batch decoding.  0 disables the control.
+    void set_target_rtf(float rtf, float frame_rate = 100.0) {
+      _target_rtf = rtf;
+      _frame_rate = frame_rate;
+    }
+
+    /// Beam and # of active hypotheses of each frame since push_init()
+    const std::vector<float>& beam_trajectory() const {
+      return _beam_trajectory;
+    }
+    const std::vector<int>& active_trajectory() const {
+      return _active_trajectory;
+    }
+
+    /// Keep only word-level traceback instead of the full history.  Memory
+    /// is bounded by the active hypotheses, but extract_lattice() cannot be
+    /// used and branches are not kept.  Must be set before push_init().
+    void set_best_path_mode(bool b) { _best_path_only = b; }
     
-    hypos* last_hypos() { return &(*_frame_hypos.rbegin()); }
+    const hypos& active_hypos() const { return _active; }
 
-    hypo* root_hypo() {
-      return &(_frame_hypos.begin()->at(0));
+    const hypo* root_hypo() const { return _root; }
+
+    chunked_arena<hypo>& current_arena() {
+      return _use_spare_arena ? _spare_hypo_arena : _hypo_arena;
+    }
+
+    /// Allocate a hypothesis record for a surviving candidate
+    hypo* commit(const candidate& c) {
+      hypo* h = current_arena().allocate();
+      h->prev_hypo = c.prev_hypo;
+      h->arcs = c.arcs;
+      h->narcs = c.narcs;
+      h->prev_fst_state = c.prev_fst_state;
+      h->next_hmm_state = c.next_hmm_state;
+      h->self_loop = c.self_loop;
+      h->trans_weight = c.trans_weight;
+      h->weight = c.weight;
+      h->signature = c.signature;
+      h->trace = c.prev_hypo ? c.prev_hypo->trace : 0;
+      if (_best_path_only && ! c.self_loop) {
+        for (int n = 0; n < c.narcs; ++ n) {
+          if (c.arcs[n].olabel != 0) {
+            h->trace = new_trace(h->trace, c.arcs[n].olabel);
+          }
+        }
+      }
+      h->next_branch = 0;
+      h->nbranches = 0;
+      return h;
+    }
+
+    /// Candidate reaching the end of the given transition from h
+    candidate make_candidate(const hypo* h, const transition_table::entry& e,
+                             float w, uint64_t sign) const {
+      candidate c;
+      c.prev_hypo = h;
+      c.arcs = _table->arcs(e);
+      c.narcs = e.narcs;
+      c.prev_fst_state = h->get_next_fst_state();
+      c.next_hmm_state = e.next_hmm_state;
+      c.self_loop = false;
+      c.word_end = sign != h->signature;
+      c.trans_weight = e.weight;
+      c.weight = w;
+      c.signature = sign;
+      return c;
     }
     
-    void push_init() {
-      hypos h;
-      _frame_hypos.clear();
-      fst_arc dummyarc(0, 0, 0.0, _decodingnet.Start());
-      hypo inithypo;
-      inithypo.trans.prev_fst_state = -1;
-      inithypo.trans.arcs.push_back(dummyarc);
-      inithypo.weight = 0;
-      h.push_back(inithypo);
+    word_trace* new_trace(const word_trace* prev, int olabel) {
+      word_trace* tr = _trace_pool.allocate();
+      tr->prev = prev;
+      tr->olabel = olabel;
+      tr->start_t = _nframes - 1;
+      tr->marked = false;
+      _traces.push_back(tr);
+      return tr;
+    }
+
+    /// Release the traces not reachable from the active hypotheses
+    void collect_traces() {
+      for (const hypo* h : _active) {
+        for (const word_trace* tr = h->trace; tr != 0 && ! tr->marked;
+             tr = tr->prev) {
+          tr->marked = true;
+        }
+      }
+      size_t nlive = 0;
+      for (word_trace* tr : _traces) {
+        if (tr->marked) {
+          tr->marked = false;
+          _traces[nlive ++] = tr;
+        } else {
+          _trace_pool.release(tr);
+        }
+      }
+      TRACE("Trace GC: %d of %d records alive", nlive, _traces.size());
+      _traces.resize(nlive);
+      _trace_gc_threshold = std::max<size_t>(4096, nlive * 2);
+    }
 
-      _frame_hypos.insert(_frame_hypos.end(), h);
+    void push_init() {
+      _hypo_arena.clear();
+      _spare_hypo_arena.clear();
+      _use_spare_arena = false;
+      _trace_pool.clear();
+      _traces.clear();
+      _trace_gc_threshold = 4096;
+      _fstst_to_slot.reserve(_table->num_states() + 1); // +1 for final
+      _active.clear();
+
+      _init_arc = fst_arc(0, 0, 0.0, _table->start());
+      candidate init;
+      init.prev_hypo = 0;
+      init.arcs = &_init_arc;
+      init.narcs = 1;
+      init.prev_fst_state = -1;
+      init.next_hmm_state = -1;
+      init.self_loop = false;
+      init.word_end = false;
+      init.trans_weight = 0.0;
+      init.weight = 0.0;
+      init.signature = 0;
+      _root = commit(init);
+      _active.push_back(_root);
+      _nframes = 1;
+
+      _beamwidth = _base_beamwidth;
+      _maxactive = _base_maxactive;
+      _rtf_target_active = _target_active;
+      _beam_trajectory.clear();
+      _active_trajectory.clear();
+      _start_time = std::chrono::steady_clock::now();
     }
     
     void push_input(const fmatrix& inp) {
@@ -181,232 +359,387 @@ namespace spin {
       }
     }
 
-    void prune_by_beam(hypos* phypos) {
-      std::sort(phypos->begin(), phypos->end(), hypo_weight_comp());
-
-      TRACE("    score range = [%f:%f]",
-            (phypos->size() > 0) ? (*phypos)[0].weight : -1,
-            (phypos->size() > 0) ? (*phypos)[phypos->size()-1].weight : -1);
-      if (phypos->size() == 0) {
-        return;
+    /// Push a chunk of frames that follows the ones pushed so far since
+    /// push_init().  Partial results can be read between chunks.
+    void push_chunk(const fmatrix& inp) {
+      int toff = _nframes - 1;
+      if (toff == 0) {
+        _scorer->set_frames(inp);
+      } else {
+        _scorer->append_frames(inp);
+      }
+      for (int t = 0; t < inp.cols(); ++ t) {
+        if (! this->expand_frame(toff + t)) {
+          throw no_hypothesis();
+        }
       }
+    }
 
-      float beamthres = (*phypos)[0].weight + _beamwidth;
-      TRACE("    beamthres = %f", beamthres);
+    /// Words traced back from tr
+    void trace_words(const word_trace* tr,
+                     std::vector<std::string>* pwords) const {
+      std::vector<std::string> rwords;
+      for ( ; tr != 0; tr = tr->prev) {
+        rwords.push_back(_table->output_symbol(tr->olabel));
+      }
+      pwords->assign(rwords.rbegin(), rwords.rend());
+    }
 
-      int cutoff_idx = phypos->size() / 2;
-      int left = 0;
-      int right = phypos->size();
-      while (1) {
-        if (cutoff_idx == phypos->size() - 1) { // If the pivot is on the tail
-          if ((*phypos)[cutoff_idx].weight < beamthres) {
-            cutoff_idx += 1;
+    /// Output symbols on the path ending at h, except epsilons
+    void trace_words(const hypo* h, std::vector<std::string>* pwords) const {
+      if (_best_path_only) {
+        trace_words(h->trace, pwords);
+        return;
+      }
+      std::vector<std::string> rwords;
+      for ( ; h != 0; h = h->prev_hypo) {
+        if (h->is_self_loop()) continue; // arc is shared with the previous
+        for (auto ait = h->arcs_rbegin(); ait != h->arcs_rend(); ++ ait) {
+          if (ait->olabel != 0) {
+            rwords.push_back(_table->output_symbol(ait->olabel));
           }
-          break;
         }
-        
-        if ((*phypos)[cutoff_idx].weight > beamthres) {
-          if ((*phypos)[cutoff_idx - 1].weight <= beamthres) {
-            // Search finished
-            break;
+      }
+      pwords->assign(rwords.rbegin(), rwords.rend());
+    }
+
+    /// Words of the current best hypothesis, returns its weight.  The
+    /// hypothesis may not end at a final state.
+    float best_partial(std::vector<std::string>* pwords) const {
+      if (_active.empty()) throw no_hypothesis();
+      trace_words(_active[0], pwords);
+      return _active[0]->weight;
+    }
+
+    /// Words of the best path after push_final(), returns its weight.
+    /// Unlike extract_lattice(), this also works in the best-path mode.
+    float best_path(std::vector<std::string>* pwords) const {
+      if (_active.size() == 0)
+        throw std::runtime_error("Could not reach to a final state");
+      return best_partial(pwords);
+    }
+
+    /// Words shared by all the active hypotheses.  These do not change
+    /// whatever frames follow, so they can be emitted before the end of the
+    /// utterance.
+    void stable_prefix(std::vector<std::string>* pwords) const {
+      if (_active.empty()) throw no_hypothesis();
+      if (_best_path_only) {
+        // step back the latest traces until all the paths meet
+        std::vector<const word_trace*> traces;
+        for (const hypo* h : _active) traces.push_back(h->trace);
+        auto start_t = [](const word_trace* tr) {
+          return tr ? tr->start_t : -1;
+        };
+        while (true) {
+          std::sort(traces.begin(), traces.end());
+          traces.erase(std::unique(traces.begin(), traces.end()),
+                       traces.end());
+          if (traces.size() == 1) break;
+          int last_t = -1;
+          for (auto tr : traces) last_t = std::max(last_t, start_t(tr));
+          for (auto& tr : traces) {
+            if (start_t(tr) == last_t) tr = tr->prev;
           }
-          // Search left side
-          right = cutoff_idx;
-          cutoff_idx = left + (right - left) / 2;
-        }
-        else {
-          left = cutoff_idx;
-          cutoff_idx = right - (right - left) / 2;
         }
+        trace_words(traces[0], pwords);
+        return;
       }
-      hypos::iterator cutoff = phypos->begin() + cutoff_idx;
+      // every record in the frontier has the same number of frames
+      std::vector<const hypo*> frontier(_active.begin(), _active.end());
+      while (frontier.size() > 1) {
+        for (auto& h : frontier) h = h->prev_hypo;
+        std::sort(frontier.begin(), frontier.end());
+        frontier.erase(std::unique(frontier.begin(), frontier.end()),
+                       frontier.end());
+      }
+      trace_words(frontier[0], pwords);
+    }
 
-      phypos->assign(phypos->begin(), cutoff);
+    /// Record the pruning result of the frame and update the beam and the
+    /// max-active for the next one
+    void adapt_beam() {
+      _beam_trajectory.push_back(_beamwidth);
+      _active_trajectory.push_back(_active.size());
+      if (_target_active <= 0) return;
+
+      int nframes = _active_trajectory.size();
+      if (_target_rtf > 0 && nframes % 25 == 0) {
+        double elapsed = std::chrono::duration<double>(
+          std::chrono::steady_clock::now() - _start_time).count();
+        double rtf = elapsed * _frame_rate / nframes;
+        double ratio = std::sqrt(_target_rtf / std::max(rtf, 1e-6));
+        int floor = std::min(16, _target_active);
+        _rtf_target_active =
+          std::max(floor, std::min(_target_active,
+                                   static_cast<int>(_rtf_target_active *
+                                                    ratio)));
+      }
+      int target = (_target_rtf > 0) ? _rtf_target_active : _target_active;
+      float ratio = static_cast<float>(target) /
+        std::max<size_t>(_active.size(), 1);
+      _beamwidth = std::min(_max_beam,
+                            std::max(_min_beam,
+                                     _beamwidth * std::pow(ratio, 0.25f)));
+      _maxactive = std::min(_base_maxactive, 2 * target);
     }
 
-    void prune_by_maxactive(hypos* phypos) {
-      phypos->assign(phypos->begin(),
-                     phypos->begin() + std::min((int)phypos->size(),
-                                                (int)_maxactive));
+    /// Weight used for pruning a hypothesis reaching FST state s
+    float pruning_weight(float w, fst_state s) const {
+      return (_lookahead && s >= 0) ? w + _table->lookahead(s) : w;
     }
 
-    void find_possible_transition(std::vector<transition>* ptrs,
-                                  int state, bool search_final) {
-      // TO DO: do not generate redundant transition
-      std::queue<transition> queue;
-      queue.push(transition(state, 0.0));
+    /// Select the candidates surviving the beam and the max-active limit.
+    /// Indices of the survivors are left in _order sorted by weight, the
+    /// candidates themselves are not moved.
+    void prune(const candidates& cands) {
+      // best weight of each FST state
+      _fstst_to_slot.clear();
+      _slot_best.clear();
+      _cand_slots.resize(cands.size());
+      _cand_keys.resize(cands.size());
+      float best = HUGE_VALF;
+      for (int i = 0; i < cands.size(); ++ i) {
+        int fstst = cands[i].get_next_fst_state();
+        float key = pruning_weight(cands[i].weight, fstst);
+        auto ins = _fstst_to_slot.insert(fstst + 1);
+        int slot = ins.first;
+        if (ins.second) _slot_best.push_back(key);
+        _slot_best[slot] = std::min(_slot_best[slot], key);
+        _cand_slots[i] = slot;
+        _cand_keys[i] = key;
+        best = std::min(best, key);
+      }
 
-      while (! queue.empty()) {
-        transition tr = queue.front();
-        queue.pop();
-        
-        for (fst::ArcIterator<network> ait(_decodingnet, tr.get_next_fst_state());
-             ! ait.Done(); ait.Next()) {
-          transition ntr = tr;
-          fst::StdArc arc = ait.Value();
-          int hmmst = _ilabel_to_hmm_state[arc.ilabel];
-          
-          ntr.weight = tr.weight + arc.weight.Value();
-          ntr.arcs.push_back(arc);
-          if (search_final) {
-            if (_decodingnet.Final(arc.nextstate) !=
-                fst::TropicalWeight::Zero()) {
-              fst::StdArc final(0, 0, _decodingnet.Final(arc.nextstate), -1);
-              ntr.weight += final.weight.Value();
-              ntr.arcs.push_back(final);
-              ptrs->push_back(ntr);
-            } else if (hmmst < 0) { // only transit epsilon arcs
-              queue.push(ntr);
-            }
-          } else {
-            if (hmmst < 0) {
-              queue.push(ntr);
-            } else {
-              ntr.next_hmm_state = hmmst;
-              ptrs->push_back(ntr);
-            }
-          }
+      float beamthres = best + _beamwidth;
+      float word_end_thres = best + _word_end_beam;
+      float cutoff = beamthres;
+      if (_slot_best.size() > _maxactive) {
+        // weight of the _maxactive-th best state
+        _cutoff_work = _slot_best;
+        std::nth_element(_cutoff_work.begin(),
+                         _cutoff_work.begin() + (_maxactive - 1),
+                         _cutoff_work.end());
+        cutoff = std::min(cutoff, _cutoff_work[_maxactive - 1]);
+      }
+      TRACE("    best = %f, beamthres = %f, cutoff = %f",
+            best, beamthres, cutoff);
+
+      _order.clear();
+      for (int i = 0; i < cands.size(); ++ i) {
+        if (_cand_keys[i] <= beamthres &&
+            _slot_best[_cand_slots[i]] <= cutoff &&
+            (! cands[i].word_end || _cand_keys[i] <= word_end_thres)) {
+          _order.push_back(i);
         }
       }
+      std::sort(_order.begin(), _order.end(), [&cands](int a, int b) {
+          return cands[a].weight < cands[b].weight ||
+            (cands[a].weight == cands[b].weight && a < b);
+        });
     }
 
-    void fold_and_branch(const hypos& oldhypos, hypos* pnewhypos) {
-      // oldhypos must be sorted
-      assert (&oldhypos != pnewhypos);
-      
-      static std::unordered_map<int, int> fstst_to_besthypoidx;
-      fstst_to_besthypoidx.clear();
-
-      for (auto hyp : oldhypos) {
-        int fstst = hyp.get_next_fst_state();
-        auto pit = fstst_to_besthypoidx.find(fstst);
-        if (pit == fstst_to_besthypoidx.end()) {
-          pnewhypos->push_back(hyp);
-          fstst_to_besthypoidx.insert(std::make_pair(fstst,
-                                                     pnewhypos->size() - 1));
+    void prune_by_maxactive(std::vector<int>* pheads) {
+      // only ties at the cutoff weight can exceed the limit
+      if (pheads->size() > _maxactive) pheads->resize(_maxactive);
+    }
+
+    /// Pick the best surviving candidate for each FST state and chain the
+    /// others to it as branches.  Results are left in _heads and
+    /// _branch_links.
+    void fold_and_branch(const candidates& cands) {
+      _heads.clear();
+      _branch_links.assign(cands.size(), -1);
+      _branch_tails.clear();
+      _slot_head.assign(_slot_best.size(), -1);
+      int maxbranch = _best_path_only ? 1 : _maxbranch;
+
+      for (int i : _order) {
+        const candidate& hyp = cands[i];
+        int& head = _slot_head[_cand_slots[i]];
+        if (head < 0) {
+          head = _heads.size();
+          _heads.push_back(i);
+          _branch_tails.push_back(i);
         } else {
           bool found = false;
-          hypo& besthypo = pnewhypos->at(pit->second);
-          for (auto branch : besthypo.merged_branch) {
-            if (branch.signature == hyp.signature) {
+          int nbranch = 0;
+          for (int br = _branch_links[_heads[head]]; br >= 0;
+               br = _branch_links[br]) {
+            if (cands[br].signature == hyp.signature) {
               found = true;
               break;
             }
+            ++ nbranch;
           }
           if (found) {
             // redundant hypothesis
-          } else if (besthypo.merged_branch.size() < (_maxbranch - 1)) {
+          } else if (nbranch < (maxbranch - 1)) {
             // add branch and delete this from active hypo
-            besthypo.merged_branch.push_back(hyp);
+            _branch_links[_branch_tails[head]] = i;
+            _branch_tails[head] = i;
           }
         }
       }
+    }
 
+    /// Commit the folded candidates as the next active hypotheses
+    void commit_heads(const candidates& cands) {
+      if (_best_path_only) {
+        // records two frames before are no longer referenced
+        _use_spare_arena = ! _use_spare_arena;
+        current_arena().clear();
+      }
+      _active.clear();
+      for (auto head : _heads) {
+        hypo* best = commit(cands[head]);
+        hypo* tail = best;
+        for (int br = _branch_links[head]; br >= 0; br = _branch_links[br]) {
+          hypo* h = commit(cands[br]);
+          tail->next_branch = h;
+          tail = h;
+          ++ best->nbranches;
+        }
+        _active.push_back(best);
+      }
+      ++ _nframes;
+      if (_best_path_only && _traces.size() > _trace_gc_threshold) {
+        collect_traces();
+      }
+    }
+
+    /// Score all the HMM states reachable from the active hypotheses at once
+    void score_frame(int scorer_toff) {
+      if (_state_slot.size() < _scorer->nstates()) {
+        _state_slot.resize(_scorer->nstates(), -1);
+      }
+      _frame_states.clear();
+      auto add_state = [this](int s) {
+        if (_state_slot[s] < 0) {
+          _state_slot[s] = _frame_states.size();
+          _frame_states.push_back(s);
+        }
+      };
+      for (const hypo* h : _active) {
+        if (scorer_toff != 0) add_state(h->next_hmm_state);
+        auto range = _table->emitting(h->get_next_fst_state());
+        for (auto trit = range.first; trit != range.second; ++ trit) {
+          add_state(trit->next_hmm_state);
+        }
+      }
+      _frame_scores.resize(_frame_states.size());
+      if (! _frame_states.empty()) {
+        _scorer->get_scores(scorer_toff, _frame_states, &_frame_scores[0]);
+      }
+    }
+
+    float frame_score(int s) const { return _frame_scores[_state_slot[s]]; }
+
+    /// Reset the slots used by score_frame()
+    void clear_frame_scores() {
+      for (auto s : _frame_states) _state_slot[s] = -1;
+      _frame_states.clear();
     }
 
     bool expand_frame(int scorer_toff) {
-      float minweight = HUGE_VALF; // minweight tracker for earlier pruning
+      float minweight = HUGE_VALF; // tracker of pruning weight for earlier pruning
 
-      static hypos next_vector_all;
+      candidates& next_vector_all = _next_candidates;
       next_vector_all.clear();
 
-      static std::vector<transition> trans;
-      trans.clear();
-          
-      for (hypos::iterator it = last_hypos()->begin(),
-             last = last_hypos()->end(); it != last; ++ it) {
+      score_frame(scorer_toff);
+      for (auto it = _active.begin(), last = _active.end();
+           it != last; ++ it) {
+        const hypo* h = *it;
 
         // Expand self loop
         if (scorer_toff != 0) {
-          transition looptr(it->trans.prev_fst_state, 0.0);
-          looptr.self_loop = true;
-          looptr.next_hmm_state = it->trans.next_hmm_state;
-
-          fst_arc arc = it->get_last_arc();
-          looptr.arcs.push_back(arc);
-
-          float w = it->weight;
+          float w = h->weight;
 
-          float acscore = _scorer->get_score(scorer_toff,
-                                             looptr.next_hmm_state);
+          float acscore = frame_score(h->next_hmm_state);
           w -= acscore * _acscale;
           
-          if (minweight > w) minweight = w;
-          if (w < minweight + _beamwidth) { // early pruning
-            hypo h_loop(&(*it), looptr, w, it->signature);
-            next_vector_all.push_back(h_loop);
+          float key = pruning_weight(w, h->get_next_fst_state());
+          if (minweight > key) minweight = key;
+          if (key < minweight + _beamwidth) { // early pruning
+            candidate loop;
+            loop.prev_hypo = h;
+            loop.arcs = &(h->get_last_arc());
+            loop.narcs = 1;
+            loop.prev_fst_state = h->prev_fst_state;
+            loop.next_hmm_state = h->next_hmm_state;
+            loop.self_loop = true;
+            loop.word_end = false;
+            loop.trans_weight = 0.0;
+            loop.weight = w;
+            loop.signature = h->signature;
+            next_vector_all.push_back(loop);
           }
         }
 
-        trans.clear();
-        find_possible_transition(&trans, it->get_next_fst_state(), false);
-        
-        for (auto trit = trans.begin(), trlast = trans.end();
-             trit != trlast; ++ trit) {
-          float w = it->weight + trit->weight;
+        auto range = _table->emitting(h->get_next_fst_state());
+        for (auto trit = range.first; trit != range.second; ++ trit) {
+          float w = h->weight + trit->weight;
+          const fst_arc* arcs = _table->arcs(*trit);
 
-          int nsign = trit->update_signature(it->signature);
+          uint64_t nsign = update_signature(h->signature, arcs, trit->narcs);
             
-          float acscore = _scorer->get_score(scorer_toff, trit->next_hmm_state);
+          float acscore = frame_score(trit->next_hmm_state);
           w -= acscore * _acscale;
 
-          for (int n = 0; n < trit->arcs.size() - 1; ++ n) {
-            assert(_ilabel_to_hmm_state[trit->arcs[n].ilabel] < 0);
-            assert(_decodingnet.InputSymbols()->Find(trit->arcs[n].ilabel)[0] != 'S');
+          for (int n = 0; n < trit->narcs - 1; ++ n) {
+            assert(_table->hmm_state(arcs[n].ilabel) < 0);
+            assert(_table->input_symbol(arcs[n].ilabel)[0] != 'S');
           }
           
-          if (minweight > w) minweight = w;
-          if (w < minweight + _beamwidth) { // early pruning
-            hypo h_enter(&(*it), *trit, w, nsign);
-            next_vector_all.push_back(h_enter);
+          float key = pruning_weight(w, arcs[trit->narcs - 1].nextstate);
+          if (minweight > key) minweight = key;
+          if (key < minweight + _beamwidth) { // early pruning
+            next_vector_all.push_back(make_candidate(h, *trit, w, nsign));
           }
         }
       }
+      clear_frame_scores();
       if (next_vector_all.size() == 0) {
         //throw no_hypothesis();
         return false;
       }
       TRACE("t = %d: Current # of hypotheses (before pruning) = %d",
             scorer_toff, next_vector_all.size());
-      prune_by_beam(&next_vector_all);
+      prune(next_vector_all);
       TRACE("t = %d: Current # of hypotheses (after beam pruning) = %d",
-            scorer_toff, next_vector_all.size());
-      if (next_vector_all.size() == 0) {
-        return false;
-      }
-
-      auto lasthypos = _frame_hypos.insert(_frame_hypos.end(), hypos());
+            scorer_toff, _order.size());
 
-      fold_and_branch(next_vector_all, &(*lasthypos));
-      prune_by_maxactive(&(*lasthypos));
+      fold_and_branch(next_vector_all);
+      prune_by_maxactive(&_heads);
+      commit_heads(next_vector_all);
+      adapt_beam();
       
-      TRACE("t = %d: Current # of hypotheses (after pruning) = %d",
-            scorer_toff, lasthypos->size());
-      if (lasthypos->size() == 0) return false;
+      TRACE("t = %d: Current # of hypotheses (after pruning) = %d, "
+            "next beam = %f", scorer_toff, _active.size(), _beamwidth);
+      TRACE("t = %d: # of records in arena = %d",
+            scorer_toff, _hypo_arena.size() + _spare_hypo_arena.size());
+      if (_active.size() == 0) return false;
       return true;
     }
     
     bool push_final() {
-      hypos next_vector_all;
-      for (hypos::iterator it = last_hypos()->begin(),
-             last = last_hypos()->end(); it != last; ++ it) {
-
-        std::vector<transition> trans;
-        find_possible_transition(&trans, it->get_next_fst_state(), true);
-        for (std::vector<transition>::iterator
-               trit = trans.begin(), trlast = trans.end();
-             trit != trlast; ++ trit) {
-
-          float w = it->weight + trit->weight ;
-          hypo h(&(*it), *trit, w, it->signature);
-          next_vector_all.push_back(h);
+      candidates& next_vector_all = _next_candidates;
+      next_vector_all.clear();
+      for (auto it = _active.begin(), last = _active.end();
+           it != last; ++ it) {
+        const hypo* h = *it;
+        auto range = _table->final(h->get_next_fst_state());
+        for (auto trit = range.first; trit != range.second; ++ trit) {
+          float w = h->weight + trit->weight ;
+          next_vector_all.push_back(make_candidate(h, *trit, w, h->signature));
         }
       }
-      prune_by_beam(&next_vector_all);
-      auto lasthypos = _frame_hypos.insert(_frame_hypos.end(), hypos());
-      fold_and_branch(next_vector_all, &(*lasthypos));
-      prune_by_maxactive(&(*lasthypos));
-      return lasthypos->size() != 0;
+      prune(next_vector_all);
+      fold_and_branch(next_vector_all);
+      prune_by_maxactive(&_heads);
+      commit_heads(next_vector_all);
+      return _active.size() != 0;
     }
 
     int find_lattice_state(std::unordered_map<const hypo*, int>* pmap,
@@ -432,10 +765,10 @@ namespace spin {
       int beg_t = end_t - 1;
       float total_arc_weight = 0.0;
       float last_weight = hyp->weight;
-      while (hyp->trans.is_self_loop()) {
-        assert (hyp->trans.arcs.size() == 1);
+      while (hyp->is_self_loop()) {
+        assert (hyp->narcs == 1);
         // ^ self loop must not have multiple arcs
-        total_arc_weight += hyp->trans.weight;
+        total_arc_weight += hyp->trans_weight;
         hyp = hyp->prev_hypo;
         beg_t -= 1;
       }
@@ -443,16 +776,16 @@ namespace spin {
       float acoustic_weight = last_weight - prev_weight - total_arc_weight;
 
       int head = -1;
-      if (hyp->trans.has_epsilon()) {
+      if (hyp->has_epsilon()) {
         head = plattice->AddState();
       } else {
         head = find_lattice_state(pmap, plattice, hyp->prev_hypo);
       }
-      int ilabel = hyp->trans.get_last_arc().ilabel,
-        olabel = hyp->trans.get_last_arc().olabel;
+      int ilabel = hyp->get_last_arc().ilabel,
+        olabel = hyp->get_last_arc().olabel;
       std::string
-        isym = _decodingnet.InputSymbols()->Find(ilabel),
-        osym = _decodingnet.OutputSymbols()->Find(olabel);
+        isym = _table->input_symbol(ilabel),
+        osym = _table->output_symbol(olabel);
 
       LatticeWeight weight(acoustic_weight, total_arc_weight,
                            TimingWeight<int>(beg_t, end_t));
@@ -461,12 +794,12 @@ namespace spin {
                      weight, tailst);
       plattice->AddArc(head, arc);
 
-      if (hyp->trans.has_epsilon()) {
+      if (hyp->has_epsilon()) {
         int tail = head;
         head = find_lattice_state(pmap, plattice, hyp->prev_hypo);
         generate_eps_path(plattice, isymtab, osymtab, 
-                          boost::next(hyp->trans.arcs.crbegin()),
-                          hyp->trans.arcs.crend(),
+                          boost::next(hyp->arcs_rbegin()),
+                          hyp->arcs_rend(),
                           head, tail, beg_t);
       }
 
@@ -476,20 +809,20 @@ namespace spin {
     void generate_eps_path(Lattice* plattice,
                            fst::SymbolTable& isymtab,
                            fst::SymbolTable& osymtab,
-                           transition::const_reverse_arc_iterator begin,
-                           transition::const_reverse_arc_iterator end,
+                           hypo::const_reverse_arc_iterator begin,
+                           hypo::const_reverse_arc_iterator end,
                            int headst, int tailst, int t) const {
       // generate from tail to head
-      transition::const_reverse_arc_iterator last = end;
+      hypo::const_reverse_arc_iterator last = end;
       -- last;
       for ( ; begin != end; ++ begin) {
         LatticeWeight weight(begin->weight.Value(), 0.0,
                              TimingWeight<int>(t, t));
         int nhead = (begin == last) ? headst : plattice->AddState();
-        assert (_ilabel_to_hmm_state[begin->ilabel] == -1);
+        assert (_table->hmm_state(begin->ilabel) == -1);
         std::string
-          isym = _decodingnet.InputSymbols()->Find(begin->ilabel),
-          osym = _decodingnet.OutputSymbols()->Find(begin->olabel);
+          isym = _table->input_symbol(begin->ilabel),
+          osym = _table->output_symbol(begin->olabel);
         LatticeArc arc(prepare_label(&isymtab, isym),
                        prepare_label(&osymtab, osym), weight, tailst);
         plattice->AddArc(nhead, arc);
@@ -499,8 +832,10 @@ namespace spin {
 
     float extract_lattice(Lattice* plattice, int nbranch) {
       // Lattice merges self-loop but generates epsilon transition
-      if (last_hypos()->size() == 0)
+      if (_active.size() == 0)
         throw std::runtime_error("Could not reach to a final state");
+      if (_best_path_only)
+        throw std::runtime_error("Lattice is not kept in the best-path mode");
 
       fst::SymbolTable isymtab, osymtab;
       isymtab.AddSymbol("<eps>", 0);
@@ -514,18 +849,19 @@ namespace spin {
       
       std::set<const hypo*> visited;
       std::queue<std::pair<const hypo*, int> > heads;
-      int last_t = _frame_hypos.size() - 2;
+      int last_t = _nframes - 2;
       bool is_first = true;
       float ret = 0.0;
       
       // expand finals
-      for (const hypo& hyp : *last_hypos()) {
+      for (const hypo* phyp : _active) {
+        const hypo& hyp = *phyp;
         if (is_first) {
           ret = hyp.weight;
           is_first = false;
         }
         
-        auto ait = hyp.trans.arcs.crbegin();
+        auto ait = hyp.arcs_rbegin();
         assert (ait->olabel == 0 && ait->ilabel == 0 && ait->nextstate == -1);
         // ^ Check that the final arc is dummy containing final weight
         int final = plattice->AddState();
@@ -533,12 +869,12 @@ namespace spin {
                                   TimingWeight<int>(last_t, last_t));
         plattice->SetFinal(final, finalweight);
 
-        if (hyp.trans.arcs.size() > 1) {
+        if (hyp.narcs > 1) {
           int headst = find_lattice_state(&hypo_to_latst, plattice,
                                           hyp.prev_hypo);
           ++ ait;
           generate_eps_path(plattice, isymtab, osymtab,
-                            ait, hyp.trans.arcs.crend(),
+                            ait, hyp.arcs_rend(),
                             headst, final, last_t);
           heads.push(std::make_pair(hyp.prev_hypo, last_t));
         } else {
@@ -559,12 +895,13 @@ namespace spin {
         visited.insert(head);
 
         for (int n = 0; n < nbranch; ++ n) {
-          if (n > 0 && (n - 1) >= (int) head->merged_branch.size()) break;
-          const hypo& br = (n == 0) ? *head : head->merged_branch[n - 1];
+          if (n > 0 && (n - 1) >= head->nbranches) break;
+          const hypo* br = head;
+          for (int i = 0; i < n; ++ i) br = br->next_branch;
 
           auto npair = generate_path(plattice,
                                      &hypo_to_latst,
-                                     isymtab, osymtab, &br, tail_t, tailst);
+                                     isymtab, osymtab, br, tail_t, tailst);
           const hypo* nhead = npair.first;
           int nhead_t = npair.second;
           if (nhead_t == 0) {
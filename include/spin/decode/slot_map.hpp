@@ -0,0 +1,62 @@
+#ifndef spin_decode_slot_map_hpp_
+#define spin_decode_slot_map_hpp_
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+
+namespace spin {
+  /**
+   * Map from small non-negative keys, such as FST states, to slot indices
+   * assigned in the order of insertion.
+   *
+   * Entries live in a dense array indexed by key and are valid only if
+   * their stamp equals the current generation, so clear() is O(1) and no
+   * memory is touched or rehashed between frames.
+   */
+  class dense_slot_map {
+    std::vector<uint32_t> _stamps;
+    std::vector<int> _slots;
+    uint32_t _generation;
+    int _size;
+  public:
+    explicit dense_slot_map(size_t nkeys = 0)
+      : _stamps(nkeys, 0), _slots(nkeys, -1), _generation(1), _size(0) {
+    }
+
+    /// Grow the key range, existing entries are kept
+    void reserve(size_t nkeys) {
+      if (nkeys > _stamps.size()) {
+        _stamps.resize(nkeys, 0);
+        _slots.resize(nkeys, -1);
+      }
+    }
+
+    void clear() {
+      _size = 0;
+      if (++ _generation == 0) { // wrapped around, stamps are ambiguous
+        std::fill(_stamps.begin(), _stamps.end(), 0);
+        _generation = 1;
+      }
+    }
+
+    /// Slot of the key, and whether it was newly assigned
+    std::pair<int, bool> insert(size_t key) {
+      if (_stamps[key] == _generation) return std::make_pair(_slots[key], false);
+      _stamps[key] = _generation;
+      _slots[key] = _size ++;
+      return std::make_pair(_slots[key], true);
+    }
+
+    /// Slot of the key, or -1
+    int find(size_t key) const {
+      return (_stamps[key] == _generation) ? _slots[key] : -1;
+    }
+
+    size_t size() const { return _size; }
+    size_t key_range() const { return _stamps.size(); }
+  };
+}
+
+#endif
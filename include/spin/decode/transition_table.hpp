@@ -0,0 +1,539 @@
+#ifndef spin_decode_transition_table_hpp_
+#define spin_decode_transition_table_hpp_
+
+#include <queue>
+#include <deque>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <fst/fst.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/container/small_vector.hpp>
+#include <gear/io/logging.hpp>
+#include <spin/io/mmap.hpp>
+
+namespace spin {
+  /**
+   * Epsilon-closure of a decoding network.
+   *
+   * For every FST state, this table holds the transitions that the decoder
+   * can take from the state: sequences of epsilon arcs terminated by an
+   * emitting arc, or (for the final table) by an arc reaching a final
+   * state.  The table is built once per network and is read-only
+   * afterwards, so it can be shared by several decoders.
+   *
+   * The table also keeps the network itself in CSR layout and its symbol
+   * strings, so that it can be written as a self-contained graph file
+   * and mapped to memory by load() without parsing.
+   *
+   * For LM lookahead, the table holds the weight of the best path from
+   * each state to the next arc with an output label (inclusive) or to a
+   * final state.
+   */
+  class transition_table {
+  public:
+    typedef fst::Fst<fst::StdArc> network;
+    typedef network::StateId fst_state;
+    typedef network::Arc fst_arc;
+
+    struct entry {
+      uint64_t arc_begin;
+      float weight; // sum of arc transition weight, i.e. LM weight
+      int32_t next_hmm_state; // -1 for the transitions in final table
+      int32_t narcs;
+      int32_t reserved; // keeps the record 8-byte aligned in graph files
+    };
+
+    typedef std::pair<const entry*, const entry*> entry_range;
+    typedef std::pair<const fst_arc*, const fst_arc*> arc_range;
+
+  private:
+    struct transition {
+      boost::container::small_vector<fst_arc, 2> arcs;
+      float weight;
+      int next_hmm_state;
+
+      transition() : arcs(), weight(0.0), next_hmm_state(-1) { }
+    };
+
+    enum SECTIONS {
+      SEC_STATE_OFFSETS = 0, SEC_ARCS, SEC_FINALS, SEC_ILABEL_TO_HMM,
+      SEC_EMITTING_OFFSETS, SEC_EMITTING, SEC_FINAL_OFFSETS, SEC_FINAL,
+      SEC_CLOSURE_ARCS, SEC_ISYM_OFFSETS, SEC_ISYMS,
+      SEC_OSYM_OFFSETS, SEC_OSYMS, SEC_LOOKAHEAD, NUM_SECTIONS
+    };
+
+    /// Layout of graph files, all the offsets are in bytes from the head
+    struct file_header {
+      char magic[8];
+      uint32_t version;
+      int32_t start;
+      uint64_t nstates;
+      uint64_t sections[NUM_SECTIONS][2]; // offset and # of elements
+    };
+
+    // containers used when the table is built from a network
+    struct storage {
+      std::vector<uint64_t> state_offsets;
+      std::vector<fst_arc> arcs;
+      std::vector<float> finals;
+      std::vector<int32_t> ilabel_to_hmm_state;
+      std::vector<uint64_t> emitting_offsets;
+      std::vector<entry> emitting;
+      std::vector<uint64_t> final_offsets;
+      std::vector<entry> final;
+      std::vector<fst_arc> closure_arcs;
+      std::vector<uint64_t> isym_offsets;
+      std::vector<char> isyms;
+      std::vector<uint64_t> osym_offsets;
+      std::vector<char> osyms;
+      std::vector<float> lookahead;
+    };
+    boost::shared_ptr<storage> _storage;
+    mapped_file_ptr _mapping;
+
+    // views either to _storage or to _mapping
+    fst_state _start;
+    uint64_t _nstates;
+    uint64_t _sizes[NUM_SECTIONS];
+    const uint64_t* _state_offsets; // (# states + 1)
+    const fst_arc* _arcs;
+    const float* _finals;
+    const int32_t* _ilabel_to_hmm_state;
+    const uint64_t* _emitting_offsets; // (# states + 1)
+    const entry* _emitting;
+    const uint64_t* _final_offsets; // (# states + 1)
+    const entry* _final;
+    const fst_arc* _closure_arcs;
+    const uint64_t* _isym_offsets; // (# labels + 1)
+    const char* _isyms;
+    const uint64_t* _osym_offsets;
+    const char* _osyms;
+    const float* _lookahead; // (# states)
+
+    transition_table() { }
+    transition_table(const transition_table&);
+    transition_table& operator=(const transition_table&);
+
+    void add_entry(const transition& tr, std::vector<entry>* pentries) {
+      entry e;
+      e.arc_begin = _storage->closure_arcs.size();
+      e.weight = tr.weight;
+      e.next_hmm_state = tr.next_hmm_state;
+      e.narcs = tr.arcs.size();
+      e.reserved = 0;
+      _storage->closure_arcs.insert(_storage->closure_arcs.end(),
+                                    tr.arcs.begin(), tr.arcs.end());
+      pentries->push_back(e);
+    }
+
+    static void pack_symbols(const fst::SymbolTable* syms,
+                             std::vector<uint64_t>* poffsets,
+                             std::vector<char>* pblob) {
+      std::vector<std::string> table;
+      if (syms) {
+        for (fst::SymbolTableIterator it(*syms); ! it.Done(); it.Next()) {
+          size_t key = it.Value();
+          if (table.size() <= key) table.resize(key + 1);
+          table[key] = it.Symbol();
+        }
+      }
+      poffsets->assign(1, 0);
+      pblob->clear();
+      for (auto it = table.cbegin(); it != table.cend(); ++ it) {
+        pblob->insert(pblob->end(), it->begin(), it->end());
+        poffsets->push_back(pblob->size());
+      }
+    }
+
+    template <typename T>
+    void bind(int sec, const T** pdest, const std::vector<T>& src) {
+      *pdest = src.data();
+      _sizes[sec] = src.size();
+    }
+
+    void bind_storage() {
+      storage& st = *_storage;
+      bind(SEC_STATE_OFFSETS, &_state_offsets, st.state_offsets);
+      bind(SEC_ARCS, &_arcs, st.arcs);
+      bind(SEC_FINALS, &_finals, st.finals);
+      bind(SEC_ILABEL_TO_HMM, &_ilabel_to_hmm_state, st.ilabel_to_hmm_state);
+      bind(SEC_EMITTING_OFFSETS, &_emitting_offsets, st.emitting_offsets);
+      bind(SEC_EMITTING, &_emitting, st.emitting);
+      bind(SEC_FINAL_OFFSETS, &_final_offsets, st.final_offsets);
+      bind(SEC_FINAL, &_final, st.final);
+      bind(SEC_CLOSURE_ARCS, &_closure_arcs, st.closure_arcs);
+      bind(SEC_ISYM_OFFSETS, &_isym_offsets, st.isym_offsets);
+      bind(SEC_ISYMS, &_isyms, st.isyms);
+      bind(SEC_OSYM_OFFSETS, &_osym_offsets, st.osym_offsets);
+      bind(SEC_OSYMS, &_osyms, st.osyms);
+      bind(SEC_LOOKAHEAD, &_lookahead, st.lookahead);
+    }
+
+    template <typename T>
+    void bind(int sec, const T** pdest, const file_header& header) {
+      uint64_t offset = header.sections[sec][0];
+      uint64_t size = header.sections[sec][1];
+      if (offset % sizeof(uint64_t) != 0 ||
+          offset + size * sizeof(T) > _mapping->size()) {
+        throw std::runtime_error("Broken graph file");
+      }
+      *pdest = reinterpret_cast<const T*>(_mapping->data() + offset);
+      _sizes[sec] = size;
+    }
+
+    void bind_mapping() {
+      if (_mapping->size() < sizeof(file_header)) {
+        throw std::runtime_error("Broken graph file");
+      }
+      file_header header;
+      std::memcpy(&header, _mapping->data(), sizeof(file_header));
+      if (std::string(header.magic, 8) != "SpinGrph") {
+        throw std::runtime_error("Not a graph file");
+      }
+      if (header.version != 2) {
+        throw std::runtime_error("Unsupported graph file version, "
+                                 "compile the graph again");
+      }
+      _start = header.start;
+      _nstates = header.nstates;
+      bind(SEC_STATE_OFFSETS, &_state_offsets, header);
+      bind(SEC_ARCS, &_arcs, header);
+      bind(SEC_FINALS, &_finals, header);
+      bind(SEC_ILABEL_TO_HMM, &_ilabel_to_hmm_state, header);
+      bind(SEC_EMITTING_OFFSETS, &_emitting_offsets, header);
+      bind(SEC_EMITTING, &_emitting, header);
+      bind(SEC_FINAL_OFFSETS, &_final_offsets, header);
+      bind(SEC_FINAL, &_final, header);
+      bind(SEC_CLOSURE_ARCS, &_closure_arcs, header);
+      bind(SEC_ISYM_OFFSETS, &_isym_offsets, header);
+      bind(SEC_ISYMS, &_isyms, header);
+      bind(SEC_OSYM_OFFSETS, &_osym_offsets, header);
+      bind(SEC_OSYMS, &_osyms, header);
+      bind(SEC_LOOKAHEAD, &_lookahead, header);
+      if (_sizes[SEC_STATE_OFFSETS] != _nstates + 1 ||
+          _sizes[SEC_LOOKAHEAD] != _nstates ||
+          _sizes[SEC_EMITTING_OFFSETS] != _nstates + 1 ||
+          _sizes[SEC_FINAL_OFFSETS] != _nstates + 1) {
+        throw std::runtime_error("Broken graph file");
+      }
+    }
+
+    static std::string find_symbol(const uint64_t* offsets, size_t noffsets,
+                                   const char* blob, int label) {
+      if (label < 0 || label + 1 >= noffsets) return std::string();
+      return std::string(blob + offsets[label],
+                         blob + offsets[label + 1]);
+    }
+
+  public:
+    transition_table(const network& net) : _storage(new storage()) {
+      initialize_ilabel_map(net);
+      build(net);
+      bind_storage();
+    }
+
+    /// Check the magic of graph files written by write()
+    static bool is_graph_file(const std::string& path) {
+      std::ifstream ifs(path.c_str(), std::ios::binary);
+      char magic[8];
+      ifs.read(magic, 8);
+      return ifs && std::string(magic, 8) == "SpinGrph";
+    }
+
+    /// Map a graph file written by write()
+    static boost::shared_ptr<const transition_table>
+    load(const std::string& path) {
+      boost::shared_ptr<transition_table> ret(new transition_table());
+      ret->_mapping.reset(new mapped_file(path));
+      ret->bind_mapping();
+      INFO("Graph file %s: %d states, %d emitting and %d final transitions",
+           path.c_str(), static_cast<int>(ret->_nstates),
+           static_cast<int>(ret->_sizes[SEC_EMITTING]),
+           static_cast<int>(ret->_sizes[SEC_FINAL]));
+      return ret;
+    }
+
+    /// Load mapping between FST ilabel and HMM state
+    void initialize_ilabel_map(const network& net) {
+      if (net.InputSymbols() == 0) {
+        ERROR("Decoding net doesn't have an input symbol table");
+        throw std::runtime_error("Decoding net doesn't have an input symbol table");
+      }
+      std::vector<int32_t>& ilabel_to_hmm_state = _storage->ilabel_to_hmm_state;
+      for (fst::StateIterator<network> stit(net);
+           ! stit.Done(); stit.Next()) {
+        for (fst::ArcIterator<network> ait(net, stit.Value());
+             ! ait.Done(); ait.Next()) {
+          int ilab = ait.Value().ilabel;
+          const std::string& isym = net.InputSymbols()->Find(ilab);
+          int hmmst = -1;
+          if (ilab == 0) {
+            hmmst = -1;
+          } else if (isym[0] == 'S') {
+            size_t sep = isym.find(';');
+            size_t len = (sep == std::string::npos)
+              ? std::string::npos : sep - 1;
+            try {
+              hmmst = boost::lexical_cast<int>(isym.substr(1, len));
+            } catch (boost::bad_lexical_cast) {
+              ERROR("Failed to parse input symbol: %s", isym.c_str());
+              throw;
+            }
+          } else {
+            hmmst = -1;
+          }
+
+          while (ilabel_to_hmm_state.size() < ilab + 1) {
+            ilabel_to_hmm_state.push_back(-1);
+          }
+          ilabel_to_hmm_state[ilab] = hmmst;
+        }
+      }
+      // find_possible_transition() refers the map while building
+      _ilabel_to_hmm_state = ilabel_to_hmm_state.data();
+    }
+
+    /// Enumerate possible transitions from all the states
+    void build(const network& net) {
+      storage& st = *_storage;
+      _start = net.Start();
+      fst_state nstates = 0;
+      for (fst::StateIterator<network> stit(net);
+           ! stit.Done(); stit.Next()) {
+        nstates = std::max(nstates, stit.Value() + 1);
+      }
+      _nstates = nstates;
+
+      std::vector<transition> emitting, final;
+      st.state_offsets.assign(1, 0);
+      st.emitting_offsets.assign(1, 0);
+      st.final_offsets.assign(1, 0);
+      for (fst_state s = 0; s < nstates; ++ s) {
+        for (fst::ArcIterator<network> ait(net, s);
+             ! ait.Done(); ait.Next()) {
+          st.arcs.push_back(ait.Value());
+        }
+        st.state_offsets.push_back(st.arcs.size());
+        st.finals.push_back(net.Final(s).Value());
+
+        emitting.clear();
+        final.clear();
+        find_possible_transition(net, &emitting, s, false);
+        find_possible_transition(net, &final, s, true);
+        for (auto it = emitting.cbegin(); it != emitting.cend(); ++ it) {
+          add_entry(*it, &st.emitting);
+        }
+        for (auto it = final.cbegin(); it != final.cend(); ++ it) {
+          add_entry(*it, &st.final);
+        }
+        st.emitting_offsets.push_back(st.emitting.size());
+        st.final_offsets.push_back(st.final.size());
+      }
+      pack_symbols(net.InputSymbols(), &st.isym_offsets, &st.isyms);
+      pack_symbols(net.OutputSymbols(), &st.osym_offsets, &st.osyms);
+      compute_lookahead();
+      INFO("Transition table: %d states, %d emitting and %d final transitions",
+           static_cast<int>(nstates), static_cast<int>(st.emitting.size()),
+           static_cast<int>(st.final.size()));
+    }
+
+    /// Shortest distance to the next output label or final state, computed
+    /// by relaxing the arcs without output labels backward.
+    void compute_lookahead() {
+      storage& st = *_storage;
+      std::vector<float>& la = st.lookahead;
+      la.assign(st.finals.begin(), st.finals.end());
+
+      // reversed arcs without output label, in CSR
+      std::vector<uint64_t> roffsets(_nstates + 1, 0);
+      for (fst_state s = 0; s < _nstates; ++ s) {
+        for (uint64_t a = st.state_offsets[s]; a < st.state_offsets[s + 1];
+             ++ a) {
+          const fst_arc& arc = st.arcs[a];
+          if (arc.olabel != 0) {
+            la[s] = std::min(la[s], arc.weight.Value());
+          } else {
+            ++ roffsets[arc.nextstate + 1];
+          }
+        }
+      }
+      for (fst_state s = 0; s < _nstates; ++ s) {
+        roffsets[s + 1] += roffsets[s];
+      }
+      std::vector<std::pair<fst_state, float> > rarcs(roffsets[_nstates]);
+      std::vector<uint64_t> fill(roffsets.begin(), roffsets.end() - 1);
+      for (fst_state s = 0; s < _nstates; ++ s) {
+        for (uint64_t a = st.state_offsets[s]; a < st.state_offsets[s + 1];
+             ++ a) {
+          const fst_arc& arc = st.arcs[a];
+          if (arc.olabel == 0) {
+            rarcs[fill[arc.nextstate] ++] =
+              std::make_pair(s, arc.weight.Value());
+          }
+        }
+      }
+
+      std::deque<fst_state> queue;
+      std::vector<bool> queued(_nstates, true);
+      for (fst_state s = 0; s < _nstates; ++ s) queue.push_back(s);
+      // weights may be negative, give up on negative cycles
+      uint64_t budget = 100 * (rarcs.size() + _nstates);
+      while (! queue.empty()) {
+        fst_state v = queue.front();
+        queue.pop_front();
+        queued[v] = false;
+        for (uint64_t r = roffsets[v]; r < roffsets[v + 1]; ++ r) {
+          fst_state u = rarcs[r].first;
+          float w = rarcs[r].second + la[v];
+          if (w < la[u]) {
+            la[u] = w;
+            if (! queued[u]) {
+              queued[u] = true;
+              queue.push_back(u);
+            }
+          }
+        }
+        if (budget -- == 0) {
+          WARN("LM lookahead did not converge, disabled");
+          la.assign(_nstates, 0.0);
+          break;
+        }
+      }
+    }
+
+    void find_possible_transition(const network& net,
+                                  std::vector<transition>* ptrs,
+                                  int state, bool search_final) const {
+      // TO DO: do not generate redundant transition
+      std::queue<transition> queue;
+      queue.push(transition());
+
+      while (! queue.empty()) {
+        transition tr = queue.front();
+        queue.pop();
+
+        fst_state cur = tr.arcs.empty() ? state : tr.arcs.back().nextstate;
+        for (fst::ArcIterator<network> ait(net, cur);
+             ! ait.Done(); ait.Next()) {
+          transition ntr = tr;
+          fst::StdArc arc = ait.Value();
+          int hmmst = _ilabel_to_hmm_state[arc.ilabel];
+
+          ntr.weight = tr.weight + arc.weight.Value();
+          ntr.arcs.push_back(arc);
+          if (search_final) {
+            if (net.Final(arc.nextstate) != fst::TropicalWeight::Zero()) {
+              fst::StdArc final(0, 0, net.Final(arc.nextstate), -1);
+              ntr.weight += final.weight.Value();
+              ntr.arcs.push_back(final);
+              ptrs->push_back(ntr);
+            } else if (hmmst < 0) { // only transit epsilon arcs
+              queue.push(ntr);
+            }
+          } else {
+            if (hmmst < 0) {
+              queue.push(ntr);
+            } else {
+              ntr.next_hmm_state = hmmst;
+              ptrs->push_back(ntr);
+            }
+          }
+        }
+      }
+    }
+
+    /// Write the table as a graph file that can be loaded by load()
+    void write(const std::string& path) const {
+      const void* data[NUM_SECTIONS] = {
+        _state_offsets, _arcs, _finals, _ilabel_to_hmm_state,
+        _emitting_offsets, _emitting, _final_offsets, _final,
+        _closure_arcs, _isym_offsets, _isyms, _osym_offsets, _osyms,
+        _lookahead
+      };
+      const size_t elemsize[NUM_SECTIONS] = {
+        sizeof(uint64_t), sizeof(fst_arc), sizeof(float), sizeof(int32_t),
+        sizeof(uint64_t), sizeof(entry), sizeof(uint64_t), sizeof(entry),
+        sizeof(fst_arc), sizeof(uint64_t), sizeof(char),
+        sizeof(uint64_t), sizeof(char), sizeof(float)
+      };
+
+      file_header header;
+      std::memset(&header, 0, sizeof(file_header));
+      std::memcpy(header.magic, "SpinGrph", 8);
+      header.version = 2;
+      header.start = _start;
+      header.nstates = _nstates;
+      uint64_t offset = sizeof(file_header);
+      for (int sec = 0; sec < NUM_SECTIONS; ++ sec) {
+        offset = (offset + 7) / 8 * 8;
+        header.sections[sec][0] = offset;
+        header.sections[sec][1] = _sizes[sec];
+        offset += _sizes[sec] * elemsize[sec];
+      }
+
+      std::ofstream ofs(path.c_str(), std::ios::binary);
+      ofs.write(reinterpret_cast<const char*>(&header), sizeof(file_header));
+      const char zeros[8] = { 0 };
+      for (int sec = 0; sec < NUM_SECTIONS; ++ sec) {
+        ofs.write(zeros, header.sections[sec][0] - ofs.tellp());
+        ofs.write(static_cast<const char*>(data[sec]),
+                  _sizes[sec] * elemsize[sec]);
+      }
+      if (! ofs) {
+        throw std::runtime_error("Failed to write graph file " + path);
+      }
+    }
+
+    fst_state start() const { return _start; }
+
+    size_t num_states() const { return _nstates; }
+
+    /// Arcs leaving state s in the original network
+    arc_range network_arcs(fst_state s) const {
+      return std::make_pair(_arcs + _state_offsets[s],
+                            _arcs + _state_offsets[s + 1]);
+    }
+
+    float final_weight(fst_state s) const { return _finals[s]; }
+
+    /// Best weight from s to the next output label or a final state
+    float lookahead(fst_state s) const { return _lookahead[s]; }
+
+    int hmm_state(int ilabel) const { return _ilabel_to_hmm_state[ilabel]; }
+
+    std::string input_symbol(int label) const {
+      return find_symbol(_isym_offsets, _sizes[SEC_ISYM_OFFSETS], _isyms,
+                         label);
+    }
+
+    std::string output_symbol(int label) const {
+      return find_symbol(_osym_offsets, _sizes[SEC_OSYM_OFFSETS], _osyms,
+                         label);
+    }
+
+    /// Transitions ending with an emitting arc
+    entry_range emitting(fst_state s) const {
+      return std::make_pair(_emitting + _emitting_offsets[s],
+                            _emitting + _emitting_offsets[s + 1]);
+    }
+
+    /// Transitions ending with a dummy arc holding the final weight
+    entry_range final(fst_state s) const {
+      return std::make_pair(_final + _final_offsets[s],
+                            _final + _final_offsets[s + 1]);
+    }
+
+    const fst_arc* arcs(const entry& e) const {
+      return _closure_arcs + e.arc_begin;
+    }
+  };
+
+  typedef boost::shared_ptr<const transition_table> transition_table_ptr;
+}
+
+#endif
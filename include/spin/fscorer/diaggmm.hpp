@@ -4,6 +4,11 @@
 #include <spin/types.hpp>
 #include <spin/variant.hpp>
 #include <spin/fscorer/frame_scorer.hpp>
+#include <spin/fscorer/diaggmm_kernel.hpp>
+#include <spin/fscorer/gselect.hpp>
+#include <spin/fscorer/score_cache.hpp>
+#include <spin/fscorer/frame_buffer.hpp>
+#include <memory>
 
 namespace spin {
 
@@ -14,6 +19,7 @@ namespace spin {
   };
   
   class diagonal_GMM_parameter;
+  class worker_pool;
 
   class diagonal_GMM_statistics {
   public:
@@ -25,15 +31,36 @@ namespace spin {
     statmatrix _zero; // (max # mixt) x (# state)
     statmatrix _first; // (feadim) x (# mean)
     statmatrix _second; // (feadim) x (# var)
+    bool _float_accumulation; // not serialized
+
+    template <typename NumT>
+    void accumulate_products(int s, const Eigen::Ref<const fmatrix>& features,
+                             const dmatrix& post,
+                             const diagonal_GMM_parameter& param);
   public:
 
     void accumulate(const diagonal_GMM_statistics& other);
-    void accumulate(int s, fmatrix features,
+
+    /// Accumulates the frames of a segment aligned to state s.  The
+    /// posteriors of the mixtures are computed for the whole segment, and
+    /// the first and the second order statistics are updated by the matrix
+    /// products X * P^T and (X o X) * P^T.
+    void accumulate(int s, const Eigen::Ref<const fmatrix>& features,
                     const diagonal_GMM_parameter& param);
-    
-    diagonal_GMM_statistics() { }
+
+    /// If enabled, the matrix products of accumulate() are computed in
+    /// single precision and only added to the statistics in double.
+    void set_float_accumulation(bool enabled) {
+      _float_accumulation = enabled;
+    }
+    bool float_accumulation() const { return _float_accumulation; }
+
+    diagonal_GMM_statistics() : _loglike(0.0), _float_accumulation(false) { }
     diagonal_GMM_statistics(const diagonal_GMM_parameter& param);
-    diagonal_GMM_statistics(const variant_t& src) { read(src); }
+    diagonal_GMM_statistics(const variant_t& src)
+      : _loglike(0.0), _float_accumulation(false) {
+      read(src);
+    }
     diagonal_GMM_statistics(int ndim, int nmaxmix, int nstate,
                             int nmean, int nvar);
 
@@ -50,6 +77,14 @@ namespace spin {
 
     void read(const variant_t& src);
     void write(variant_t* dest);
+
+    /// Raw statistics file that can be mapped and summed in place
+    static bool is_binary_file(const std::string& path);
+    void write_binary(const std::string& path) const;
+    void accumulate_binary(const std::string& path);
+
+    /// Load either a binary file or a variant file
+    void load(const std::string& path);
   };
   
   class diagonal_GMM_parameter : public frame_scorer_parameter {
@@ -62,6 +97,7 @@ namespace spin {
     fmatrix _sqrtprecs;
     fvector _logzs;
     std::vector<diagonal_GMM_statedef> _states;
+    gaussian_selection_ptr _gselect; // optional
     void recompute_logZs();
   public:
     diagonal_GMM_parameter() { }
@@ -92,6 +128,13 @@ namespace spin {
     fvector logweights(int s) const;
 
     std::vector<diagonal_GMM_statedef>& statedefs() { return _states; }
+    const std::vector<diagonal_GMM_statedef>& statedefs() const {
+      return _states;
+    }
+
+    /// Gaussian selection table, null if the model doesn't have it
+    gaussian_selection_ptr gselect() const { return _gselect; }
+    void set_gselect(gaussian_selection_ptr p) { _gselect = p; }
 
     void reestimation(const diagonal_GMM_statistics& stats,
                       float var_minocc, float var_floor);
@@ -124,14 +167,49 @@ namespace spin {
 
   class diagonal_GMM_scorer : public frame_scorer {
     diagonal_GMM_parameter_ptr _parameter;
-
-    fmatrix _input_buffer;
-    fmatrix _score_cache;
+    boost::shared_ptr<const compiled_diagonal_GMM> _compiled;
+    gaussian_selection_ptr _gselect; // null if disabled
+    float _gselect_floor;
+
+    sliding_frame_buffer _input_buffer;
+    int _latest; // latest frame requested, -1 if none
+    windowed_score_cache _score_cache; // scores of recent frames
+    std::vector<int> _pending; // states to be computed in a batch
+    int _batchsize; // # of frames scored ahead when a frame is requested
+
+    std::shared_ptr<worker_pool> _pool; // null if single-threaded
+    std::vector<std::vector<int> > _part_states; // work split for _pool
+    std::vector<fmatrix> _part_scores;
+
+    void find_pending(int t, int nframes, const std::vector<int>& states);
+    void compute_scores(int t, int nframes, const std::vector<int>& states);
   public:
     diagonal_GMM_scorer(diagonal_GMM_parameter_ptr param);
     virtual void set_frames(const fmatrix& frames);
+
+    /// Frames before the cache window ending at the latest frame requested
+    /// are discarded, and requesting them afterwards is an error
+    virtual void append_frames(const fmatrix& frames);
     virtual float get_score(int t, int s);
+    virtual void get_scores(int t, const std::vector<int>& states, float* out);
+    virtual void get_scores(int t, int nframes, const std::vector<int>& states,
+                            float* out);
     virtual size_t nstates() const;
+    virtual std::shared_ptr<frame_scorer> fork() const;
+
+    /// Range of the frames held for scoring
+    int begin_frame() const { return _input_buffer.begin_frame(); }
+    int end_frame() const { return _input_buffer.end_frame(); }
+    int buffer_capacity() const { return _input_buffer.capacity(); }
+
+    /// Evaluate only the shortlisted mixtures of the model's selection
+    /// table, the others are scored as floor
+    void enable_gaussian_selection(float floor);
+
+    /// Split scoring over states into nthreads threads.  When a frame is
+    /// requested, nframes_ahead frames (up to the cache window) are scored
+    /// at once so that each thread has enough work.
+    void set_num_threads(int nthreads, int nframes_ahead = 32);
   };
 }
 
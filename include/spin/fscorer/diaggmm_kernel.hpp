@@ -0,0 +1,59 @@
+#ifndef spin_fscorer_diaggmm_kernel_hpp_
+#define spin_fscorer_diaggmm_kernel_hpp_
+
+#include <spin/types.hpp>
+#include <vector>
+#include <cmath>
+
+namespace spin {
+  class diagonal_GMM_parameter;
+  class gaussian_selection;
+
+  /**
+   * Scoring layout of diagonal GMMs.
+   *
+   * Parameters of all the mixtures are stored state-major in contiguous
+   * arrays padded to a multiple of 16 floats, and the log-likelihood of a
+   * Gaussian is evaluated as the quadratic-form expansion
+   *   const - 0.5 x^2 . prec + x . (mean * prec)
+   * where const folds the mixture weight, the normalizer and the mean
+   * term.  The inner products are computed by an AVX-512/AVX2 kernel when
+   * the library is compiled for those instruction sets.
+   */
+  class compiled_diagonal_GMM {
+    int _ndim;
+    int _stride; // padded dimensionality
+    std::vector<int> _offsets; // first mixture of each state, (# states + 1)
+    std::vector<float> _precs; // (# gaussians) x _stride
+    std::vector<float> _mprecs; // (# gaussians) x _stride
+    std::vector<float> _consts; // (# gaussians)
+  public:
+    compiled_diagonal_GMM() : _ndim(0), _stride(0), _offsets(1, 0) { }
+    compiled_diagonal_GMM(const diagonal_GMM_parameter& param) {
+      compile(param);
+    }
+
+    void compile(const diagonal_GMM_parameter& param);
+
+    size_t nstates() const { return _offsets.size() - 1; }
+    size_t nfeatures() const { return _ndim; }
+    size_t nmixtures(int s) const { return _offsets[s + 1] - _offsets[s]; }
+
+    /// Weighted log-likelihood of each mixture of state s, x and x2h are
+    /// a frame and -0.5 x^2 in the padded layout
+    void get_mixture_scores(int s, const float* x, const float* x2h,
+                            float* dest) const;
+
+    /// Log-likelihood of the given states, dest becomes (# states) x T.
+    /// If gselect is given, the mixtures not in the shortlist are regarded
+    /// as having the log-likelihood floor.
+    void get_scores(const fmatrix& feats, const std::vector<int>& states,
+                    fmatrix* dest, const gaussian_selection* gselect = 0,
+                    float floor = -HUGE_VALF) const;
+
+    /// Name of the kernel selected at compile time
+    static const char* kernel_name();
+  };
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef spin_fscorer_frame_buffer_hpp_
+#define spin_fscorer_frame_buffer_hpp_
+
+#include <spin/types.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace spin {
+  /**
+   * Columns of a stream of frames, addressed by absolute frame index.
+   *
+   * Frames are appended at the end and discarded from the beginning, so
+   * that a streaming scorer keeps only the frames it may still be asked
+   * for.  Live frames are kept contiguous in the storage; they are moved
+   * to the front when at least half of the storage is free, and the
+   * storage grows geometrically otherwise.  Appending is therefore
+   * amortized O(1) per frame, and the storage stays within a constant
+   * factor of the largest number of live frames.
+   */
+  class sliding_frame_buffer {
+    fmatrix _data; // rows x capacity
+    int _offset; // absolute index of the first live frame
+    int _begin; // column of the first live frame in _data
+    int _size; // # of live frames
+  public:
+    sliding_frame_buffer() : _offset(0), _begin(0), _size(0) { }
+
+    /// Start a new stream with the frames, indexed from 0
+    void reset(const fmatrix& frames) {
+      _data = frames;
+      _offset = 0;
+      _begin = 0;
+      _size = frames.cols();
+    }
+
+    /// Start a new stream without frames, the first frame appended has
+    /// index offset.  The storage is kept for reuse.
+    void clear(int offset = 0) {
+      _offset = offset;
+      _begin = 0;
+      _size = 0;
+    }
+
+    void append(const fmatrix& frames) {
+      int n = frames.cols();
+      if (_size == 0) {
+        _begin = 0;
+        if (_data.rows() != frames.rows()) {
+          _data.resize(frames.rows(), std::max<int>(_data.cols(), n));
+        }
+      } else if (_data.rows() != frames.rows()) {
+        throw std::runtime_error("Frame dimension mismatch");
+      }
+      if (_begin + _size + n > _data.cols()) {
+        if (2 * (_size + n) <= _data.cols()) {
+          // left-to-right copy is safe since the destination is ahead
+          for (int c = 0; c < _size; ++ c) {
+            _data.col(c) = _data.col(_begin + c);
+          }
+        } else {
+          fmatrix grown(_data.rows(), std::max<int>(2 * _data.cols(),
+                                                    2 * (_size + n)));
+          grown.leftCols(_size) = _data.middleCols(_begin, _size);
+          _data.swap(grown);
+        }
+        _begin = 0;
+      }
+      _data.middleCols(_begin + _size, n) = frames;
+      _size += n;
+    }
+
+    /// Discard the frames before t
+    void discard_before(int t) {
+      int n = std::min(std::max(t - _offset, 0), _size);
+      _offset += n;
+      _begin += n;
+      _size -= n;
+      if (_size == 0) _begin = 0;
+    }
+
+    int begin_frame() const { return _offset; }
+    int end_frame() const { return _offset + _size; }
+    int size() const { return _size; }
+    int rows() const { return _data.rows(); }
+    int capacity() const { return _data.cols(); }
+
+    bool contains(int t) const {
+      return t >= _offset && t < _offset + _size;
+    }
+
+    /// Frames [t, t + n), which must be live
+    Eigen::Block<const fmatrix> frames(int t, int n) const {
+      return Eigen::Block<const fmatrix>(_data, 0, _begin + t - _offset,
+                                         _data.rows(), n);
+    }
+
+    float operator () (int r, int t) const {
+      return _data(r, _begin + t - _offset);
+    }
+  };
+}
+
+#endif
@@ -1,6 +1,10 @@
 #ifndef spin_fscorer_frame_scorer_hpp_
 #define spin_fscorer_frame_scorer_hpp_
 
+#include <vector>
+#include <memory>
+#include <stdexcept>
+
 namespace spin {
   
   // parameter, statistics, gradients shares same topology
@@ -17,8 +21,39 @@ namespace spin {
   class frame_scorer {
   public:
     virtual void set_frames(const fmatrix& features)=0;
+
+    /// Append frames after the ones given so far, for streaming use.
+    /// Frame indices continue from the previous frames.
+    virtual void append_frames(const fmatrix& features) {
+      throw std::runtime_error("This scorer doesn't support streaming");
+    }
+
     virtual float get_score(int t, int s)=0;
+
+    /// Scores of several states at frame t, out[n] is the score of states[n]
+    virtual void get_scores(int t, const std::vector<int>& states,
+                            float* out) {
+      for (int n = 0; n < states.size(); ++ n) {
+        out[n] = get_score(t, states[n]);
+      }
+    }
+
+    /// Scores of several states over frames [t, t + nframes),
+    /// out[f * states.size() + n] is the score of states[n] at frame t + f
+    virtual void get_scores(int t, int nframes, const std::vector<int>& states,
+                            float* out) {
+      for (int f = 0; f < nframes; ++ f) {
+        get_scores(t + f, states, out + f * states.size());
+      }
+    }
+
     virtual size_t nstates() const =0;
+
+    /// Create a scorer for another thread, that shares the parameters but
+    /// has its own frame buffer and cache
+    virtual std::shared_ptr<frame_scorer> fork() const {
+      throw std::runtime_error("This scorer cannot be used from multiple threads");
+    }
   };
 }
 
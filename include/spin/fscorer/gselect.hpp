@@ -0,0 +1,60 @@
+#ifndef spin_fscorer_gselect_hpp_
+#define spin_fscorer_gselect_hpp_
+
+#include <spin/types.hpp>
+#include <spin/variant.hpp>
+#include <vector>
+
+namespace spin {
+  class diagonal_GMM_parameter;
+
+  /**
+   * Gaussian selection table for diagonal GMMs.
+   *
+   * The table holds a VQ codebook clustered from the Gaussian means and,
+   * for each pair of codeword and state, a shortlist of the mixtures that
+   * give the highest likelihood at the codeword.  At scoring time, a frame
+   * is quantized to the nearest codeword and only the shortlisted mixtures
+   * of each state are evaluated.
+   */
+  class gaussian_selection {
+    fmatrix _codebook; // feadim x # codewords
+    fvector _dimweights; // global precision used as the VQ metric
+    int _nstates;
+    std::vector<int> _offsets; // (# codewords x # states + 1)
+    std::vector<int> _mixtures;
+    std::vector<float> _rest_logweights; // log sum of unselected weights
+  public:
+    gaussian_selection() : _nstates(0) { }
+    gaussian_selection(const variant_t& src) { read(src); }
+
+    /// Cluster the means and compute the shortlists
+    void build(const diagonal_GMM_parameter& param, int ncodewords,
+               int nshortlist, int niter);
+
+    size_t ncodewords() const { return _codebook.cols(); }
+    size_t nstates() const { return _nstates; }
+
+    /// Index of the codeword nearest to the given frame
+    int find_codeword(const float* x) const;
+
+    /// Shortlisted mixture indices of state s for codeword c
+    std::pair<const int*, const int*> shortlist(int c, int s) const {
+      int n = c * _nstates + s;
+      const int* p = _mixtures.data();
+      return std::make_pair(p + _offsets[n], p + _offsets[n + 1]);
+    }
+
+    /// Log of the total weight of the mixtures not in the shortlist
+    float rest_logweight(int c, int s) const {
+      return _rest_logweights[c * _nstates + s];
+    }
+
+    void read(const variant_t& src);
+    void write(variant_t* dest) const;
+  };
+
+  typedef boost::shared_ptr<gaussian_selection> gaussian_selection_ptr;
+}
+
+#endif
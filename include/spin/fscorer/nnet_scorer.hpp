@@ -4,6 +4,7 @@
 #include <spin/types.hpp>
 #include <spin/variant.hpp>
 #include <spin/fscorer/frame_scorer.hpp>
+#include <spin/fscorer/frame_buffer.hpp>
 
 namespace spin {
   class nnet;
@@ -18,13 +19,29 @@ namespace spin {
 
     std::shared_ptr<nnet_context> _context;
 
-    bool _feed_forward_done;
-    fmatrix _score;
+    sliding_frame_buffer _input_buffer; // frames not fed forward yet
+    sliding_frame_buffer _score; // scores of the frames fed forward
+    int _latest; // latest frame requested, -1 if none
+
+    void feed_forward();
+    void check_range(int t);
   public:
+    /// # of frames before the latest one requested whose scores are kept
+    /// while streaming
+    static const int history = 32;
+
     nnet_scorer(std::shared_ptr<nnet> param);
     virtual void set_frames(const fmatrix& frames);
+
+    /// Scores of the frames more than history frames before the latest
+    /// frame requested are discarded, and requesting them afterwards is an
+    /// error
+    virtual void append_frames(const fmatrix& frames);
     virtual float get_score(int t, int s);
+    virtual void get_scores(int t, const std::vector<int>& states, float* out);
+    using frame_scorer::get_scores;
     virtual size_t nstates() const;
+    virtual std::shared_ptr<frame_scorer> fork() const;
   };
 }
 
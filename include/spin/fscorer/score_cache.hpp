@@ -0,0 +1,60 @@
+#ifndef spin_fscorer_score_cache_hpp_
+#define spin_fscorer_score_cache_hpp_
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+
+namespace spin {
+  /**
+   * Cache of state scores for a window of recent frames.
+   *
+   * Frame t is stored in slot t % window of a ring, and each entry is
+   * stamped with a key unique over utterances (frame index plus the base
+   * of the utterance).  An entry is valid only if its stamp matches, so
+   * starting an utterance or sliding the window does not touch memory,
+   * and the footprint is bounded by (window x # states) regardless of
+   * the utterance length.
+   */
+  class windowed_score_cache {
+    int _nstates;
+    int _window;
+    int64_t _base; // key of frame 0 of the current utterance
+    int64_t _next_base; // larger than all the keys used so far
+    std::vector<float> _scores; // _window x _nstates
+    std::vector<int64_t> _stamps; // key + 1 of each entry, 0 if unused
+
+    size_t index(int t, int s) const {
+      return static_cast<size_t>(t % _window) * _nstates + s;
+    }
+  public:
+    windowed_score_cache(int nstates = 0, int window = 32)
+      : _nstates(nstates), _window(window), _base(0), _next_base(0),
+        _scores(static_cast<size_t>(nstates) * window),
+        _stamps(static_cast<size_t>(nstates) * window, 0) {
+    }
+
+    /// Forget all the entries for a new utterance, O(1)
+    void reset() { _base = _next_base; }
+
+    bool contains(int t, int s) const {
+      return _stamps[index(t, s)] == _base + t + 1;
+    }
+
+    /// Score of a cached entry, contains(t, s) must hold
+    float get(int t, int s) const { return _scores[index(t, s)]; }
+
+    void set(int t, int s, float score) {
+      size_t i = index(t, s);
+      int64_t key = _base + t;
+      _scores[i] = score;
+      _stamps[i] = key + 1;
+      if (key >= _next_base) _next_base = key + 1;
+    }
+
+    int window() const { return _window; }
+    int nstates() const { return _nstates; }
+  };
+}
+
+#endif
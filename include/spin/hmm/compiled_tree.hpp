@@ -0,0 +1,84 @@
+#ifndef spin_hmm_compiled_tree_hpp_
+#define spin_hmm_compiled_tree_hpp_
+
+#include <spin/hmm/tree.hpp>
+#include <stdexcept>
+#include <vector>
+#include <stdint.h>
+
+namespace spin {
+  class worker_pool;
+
+  /**
+   * Context decision tree lowered to a contiguous array of nodes, for
+   * resolving many contexts.  Context questions become tests on bitsets
+   * over the interned phone IDs, so that resolving involves neither virtual
+   * calls nor string comparisons.  Phones interned after the compilation
+   * belong to no category.  The tree may be destroyed after compilation.
+   */
+  class compiled_decision_tree {
+  public:
+    enum { LEAF = 0, CONTEXT, LOCATION };
+
+    struct node {
+      int32_t type;
+      int32_t arg; // position for CONTEXT, location, or leaf value
+      int32_t mask; // offset of the category bitset in masks, for CONTEXT
+      int32_t is_true; // -1 if not defined
+      int32_t is_false;
+    };
+
+  private:
+    std::vector<node> _nodes;
+    std::vector<uint64_t> _masks;
+    int _nphones; // # of phones covered by the bitsets
+    int _npositions;
+
+    int lower(const context_decision_tree& tree,
+              const context_decision_tree_node* src,
+              std::map<std::string, int>* mask_offsets);
+
+  public:
+    explicit compiled_decision_tree(const context_decision_tree& tree);
+
+    size_t size() const { return _nodes.size(); }
+    const node& get_node(int i) const { return _nodes[i]; }
+    int npositions() const { return _npositions; }
+
+    int resolve(const packed_context& ctx) const {
+      int n = 0;
+      while (_nodes[n].type != LEAF) {
+        const node& cur = _nodes[n];
+        bool answer;
+        if (cur.type == CONTEXT) {
+          int phone = ctx.phone(cur.arg);
+          if (phone == packed_context::NO_PHONE) {
+            throw std::runtime_error("question error");
+          }
+          answer = phone < _nphones &&
+            ((_masks[cur.mask + phone / 64] >> (phone % 64)) & 1);
+        } else {
+          answer = ctx.location() == cur.arg;
+        }
+        n = answer ? cur.is_true : cur.is_false;
+        if (n < 0) {
+          throw std::runtime_error("Falled into unspecified decision tree node");
+        }
+      }
+      return _nodes[n].arg;
+    }
+
+    /// dest[i] becomes the leaf of ctxs[i] for i < n.  pool is used for
+    /// splitting the work if given.
+    void resolve_many(const packed_context* ctxs, size_t n, int* dest,
+                      worker_pool* pool = 0) const;
+
+    void resolve_many(const std::vector<packed_context>& ctxs,
+                      std::vector<int>* dest, worker_pool* pool = 0) const {
+      dest->resize(ctxs.size());
+      if (! ctxs.empty()) resolve_many(&ctxs[0], ctxs.size(), &(*dest)[0], pool);
+    }
+  };
+}
+
+#endif
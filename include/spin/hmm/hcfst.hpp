@@ -0,0 +1,86 @@
+#ifndef spin_hmm_hcfst_hpp_
+#define spin_hmm_hcfst_hpp_
+
+#include <spin/hmm/tree.hpp>
+#include <fst/vector-fst.h>
+#include <unordered_set>
+#include <vector>
+#include <stdint.h>
+
+namespace spin {
+  /**
+   * Constraint on the context windows appearing in an HC FST.  A window
+   * is L + 1 + R phone IDs of phone_table with a phone at the center, and
+   * the ID of the empty string stands for the utterance boundary.
+   */
+  class context_license {
+  public:
+    virtual ~context_license() { }
+    virtual bool licensed(const std::vector<int>& window) const = 0;
+  };
+
+  /**
+   * Windows whose adjacent phones are allowed to follow each other.
+   * Pairs are given directly, or derived from pronunciations: phones
+   * within a word, and the last phone of any word followed by the first
+   * phone of any word (or the boundary).
+   */
+  class phone_pair_license : public context_license {
+    int _boundary;
+    std::unordered_set<uint64_t> _pairs;
+    std::unordered_set<int> _initial, _final; // of words
+
+    static uint64_t pair_key(int a, int b) {
+      return (uint64_t(a) << 32) | static_cast<uint32_t>(b);
+    }
+    bool allowed(int a, int b) const {
+      return _pairs.count(pair_key(a, b)) > 0 ||
+        (_final.count(a) > 0 && _initial.count(b) > 0);
+    }
+  public:
+    phone_pair_license();
+
+    /// b may follow a, empty string for the utterance boundary
+    void add_pair(const std::string& a, const std::string& b);
+
+    void add_pronunciation(const std::vector<std::string>& phones);
+
+    bool licensed(const std::vector<int>& window) const;
+  };
+
+  /// Explicit set of windows, typically those observed in tree statistics
+  class context_whitelist : public context_license {
+    std::unordered_set<packed_context, packed_context_hash> _windows;
+  public:
+    void add(const std::vector<std::string>& window);
+
+    /// Labels of a context, the location is ignored
+    void add(const packed_context& ctx);
+
+    size_t size() const { return _windows.size(); }
+
+    bool licensed(const std::vector<int>& window) const;
+  };
+
+  /**
+   * HC FST with the same labels and topology as
+   * context_decision_tree::create_HC_FST(), but built from the windows of
+   * the license reachable from the utterance start only.  Context states
+   * are generated on demand, and the HMM-state chains leaving a context
+   * state are shared while their leaf sequences agree.  Initial context
+   * states begin a window with a phone at the center, so there is no path
+   * for the empty phone sequence; neither does create_HC_FST() create the
+   * all-boundary context, since it skips windows without a center phone.
+   */
+  void build_HC_FST(const context_decision_tree& tree, int nstate,
+                    const std::vector<std::string>& disamb,
+                    const context_license& license,
+                    fst::StdVectorFst* dest);
+
+  fst::script::VectorFstClass
+  create_HC_FST(const context_decision_tree& tree, int nstate,
+                const std::vector<std::string>& disamb,
+                const context_license& license);
+}
+
+#endif
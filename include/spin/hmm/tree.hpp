@@ -4,6 +4,7 @@
 #include <spin/types.hpp>
 #include <boost/utility.hpp>
 #include <spin/io/yaml.hpp>
+#include <stdint.h>
 
 // Deserializing tree is bit tricky for readability
 // If question node is list, the it's red as case-statement and expanded to 
@@ -12,6 +13,81 @@
 namespace spin {
   class context_decision_tree;
 
+  /**
+   * Process-wide interning table of phone symbols.  IDs are dense and
+   * never change during the lifetime of the process, so contexts and
+   * category masks built by different objects can be compared by ID.
+   * All the functions are thread-safe.
+   */
+  class phone_table {
+  public:
+    static const int MAX_PHONES = 0xFFFF;
+
+    /// ID of the phone, registered if it's new
+    static int intern(const std::string& phone);
+
+    /// ID of the phone, -1 if it has never been interned
+    static int find(const std::string& phone);
+
+    static std::string name(int id);
+    static int size();
+  };
+
+  /**
+   * Fixed-width key of an HMM_context: up to MAX_POSITIONS 16-bit phone
+   * IDs followed by the location, packed in two 64-bit words.
+   */
+  struct packed_context {
+    static const int MAX_POSITIONS = 7;
+    static const int NO_PHONE = 0xFFFF; // unused positions
+    uint64_t words[2];
+
+    packed_context() { words[0] = words[1] = ~uint64_t(0); }
+
+    int phone(int p) const {
+      return (words[p / 4] >> (16 * (p % 4))) & 0xFFFF;
+    }
+    void set_phone(int p, int id) {
+      uint64_t& w = words[p / 4];
+      w = (w & ~(uint64_t(0xFFFF) << (16 * (p % 4))))
+        | (uint64_t(id & 0xFFFF) << (16 * (p % 4)));
+    }
+    int location() const { return static_cast<int16_t>(words[1] >> 48); }
+    void set_location(int loc) {
+      words[1] = (words[1] & ~(uint64_t(0xFFFF) << 48))
+        | (uint64_t(static_cast<uint16_t>(loc)) << 48);
+    }
+    int npositions() const {
+      int n = 0;
+      while (n < MAX_POSITIONS && phone(n) != NO_PHONE) ++ n;
+      return n;
+    }
+
+    bool operator == (const packed_context& oth) const {
+      return words[0] == oth.words[0] && words[1] == oth.words[1];
+    }
+    bool operator != (const packed_context& oth) const {
+      return ! (*this == oth);
+    }
+    bool operator < (const packed_context& oth) const {
+      return words[0] != oth.words[0] ? words[0] < oth.words[0]
+        : words[1] < oth.words[1];
+    }
+
+    uint64_t hash() const {
+      uint64_t z = words[0] ^ (words[1] * 0x9e3779b97f4a7c15ULL);
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      return z ^ (z >> 31);
+    }
+  };
+
+  struct packed_context_hash {
+    size_t operator () (const packed_context& key) const {
+      return key.hash();
+    }
+  };
+
   struct HMM_context {
     std::vector<std::string> label;
     int loc;
@@ -19,6 +95,10 @@ namespace spin {
     std::string to_string() const;
     void parse_string(const std::string& s);
 
+    /// Key with interned phone IDs
+    packed_context pack() const;
+    static HMM_context unpack(const packed_context& key);
+
     bool operator < (const HMM_context& oth) const {
       if (label == oth.label) {
         return loc < oth.loc;
@@ -43,6 +123,9 @@ namespace spin {
   public:
     virtual ~tree_question() { }
     virtual bool question(const HMM_context& ctx) const = 0;
+    virtual bool question(const packed_context& ctx) const {
+      return question(HMM_context::unpack(ctx));
+    }
     virtual void write(variant_t* dest) const = 0;
     static boost::shared_ptr<tree_question>
     create_question(const variant_t source, 
@@ -53,7 +136,13 @@ namespace spin {
   class context_question : public tree_question {
     std::string _category_name;
     int _target_id;
+    std::vector<uint64_t> _mask; // bitset of the phone IDs in the category
 
+    void build_mask();
+    bool in_category(int phone) const {
+      return phone >= 0 && phone / 64 < static_cast<int>(_mask.size()) &&
+        ((_mask[phone / 64] >> (phone % 64)) & 1);
+    }
   public:
     context_question(const variant_t& source, 
                      const context_decision_tree& tree) : tree_question(tree) {
@@ -61,14 +150,20 @@ namespace spin {
     }
     context_question(const context_decision_tree& tree, const std::string& cn, int target)
       : tree_question(tree), _category_name(cn), _target_id(target) {
+      build_mask();
     }
     virtual ~context_question() { }
 
     void read(const variant_t& source);
     void write(variant_t* dest) const;
 
+    const std::string& category_name() const { return _category_name; }
+    int target() const { return _target_id; }
+
     virtual bool 
     question(const HMM_context& ctx) const;
+    virtual bool
+    question(const packed_context& ctx) const;
   };
 
   class location_question : public tree_question {
@@ -85,8 +180,14 @@ namespace spin {
     void read(const variant_t& source);
     void write(variant_t* dest) const;
 
+    int location() const { return _location; }
+
     virtual bool 
     question(const HMM_context& ctx) const;
+    virtual bool
+    question(const packed_context& ctx) const {
+      return ctx.location() == _location;
+    }
   };
 
   struct context_decision_tree_node {
@@ -119,6 +220,7 @@ namespace spin {
     void write(variant_t* dest);
 
     int resolve(const HMM_context& ctx) const;
+    int resolve(const packed_context& ctx) const;
                 //const std::vector<std::string>& labels, int state_location) const;
 
     int max_state_id() const;
@@ -143,6 +245,9 @@ namespace spin {
     int resolve(const HMM_context& ctx) const {
       return _root->resolve(ctx);
     }
+    int resolve(const packed_context& ctx) const {
+      return _root->resolve(ctx);
+    }
     const context_decision_tree_node* root() const { return _root; }
     context_decision_tree_node* root() { return _root; }
 
@@ -0,0 +1,90 @@
+#ifndef spin_hmm_tree_split_hpp_
+#define spin_hmm_tree_split_hpp_
+
+#include <spin/hmm/tree.hpp>
+#include <spin/hmm/treestat.hpp>
+#include <map>
+#include <vector>
+#include <stdint.h>
+
+namespace spin {
+  class worker_pool;
+
+  /// Question considered for splitting a leaf, see tree_split_engine
+  struct split_question {
+    enum { NONE = 0, CONTEXT, LOCATION };
+    int type;
+    int position; // context offset from the center, for CONTEXT
+    int category; // index in context_decision_tree::categories()
+    int location; // for LOCATION
+
+    split_question() : type(NONE), position(0), category(-1), location(-1) { }
+  };
+
+  /**
+   * Search of the best question for splitting leaves of a context
+   * decision tree.
+   *
+   * Phones appearing in the statistics are given compact label IDs once,
+   * and each category becomes a bitset over the label IDs.  To
+   * examine a leaf, the statistics of its contexts are summed per (context
+   * position, label) and per location in a single pass, and the gain of
+   * every question is computed from those sums.  The contexts are referred
+   * by their index in the statistics given to the constructor, which must
+   * outlive the engine.
+   */
+  class tree_split_engine {
+    const context_decision_tree& _tree;
+    const tree_statistics& _statistics;
+    int _npositions; // left + right + 1
+    int _ndim;
+    int _nlabels;
+    std::vector<std::string> _category_names;
+    std::vector<std::vector<uint64_t> > _category_bits; // over label IDs
+
+    std::vector<int> _labels; // (# contexts) x _npositions, compact IDs
+    std::vector<int> _locations;
+
+    static const int NLOCATIONS = 3;
+
+    int record_size() const { return 1 + 2 * _ndim; }
+
+    bool in_category(int category, int label) const {
+      return (_category_bits[category][label / 64] >> (label % 64)) & 1;
+    }
+
+    // sums of the records of entries [begin, end) of the list, per (position,
+    // label) followed by per location
+    void sum_statistics(const std::vector<int>& entries, size_t begin,
+                        size_t end, std::vector<double>* sums) const;
+
+    double loglikelihood(const double* record) const;
+  public:
+    tree_split_engine(const context_decision_tree& tree,
+                      const tree_statistics& stats);
+
+    size_t size() const { return _statistics.size(); }
+    HMM_context context(int i) const { return _statistics.context(i); }
+    const tree_Gaussian_statistics& statistics(int i) const {
+      return _statistics.statistics(i);
+    }
+
+    /// Indices of the contexts reaching each leaf of the current tree
+    void compute_membership(std::map<const context_decision_tree_node*,
+                                     std::vector<int> >* pmem) const;
+
+    /// Best question for the contexts of a leaf.  Questions leaving less
+    /// than minocc frames on either side are not considered.  *pgain
+    /// becomes 0 and the type of the result is NONE if nothing improves
+    /// the likelihood.  pool is used for splitting the work if given.
+    split_question find_best_question(const std::vector<int>& entries,
+                                      int minocc, double* pgain,
+                                      worker_pool* pool = 0) const;
+
+    bool answer(const split_question& q, int entry) const;
+
+    tree_question_ptr make_question(const split_question& q) const;
+  };
+}
+
+#endif
@@ -7,6 +7,7 @@
 #include <spin/fstext/latticearc.hpp>
 #include <spin/utils.hpp>
 #include <spin/hmm/tree.hpp>
+#include <spin/io/statfile.hpp>
 
 #include <boost/tuple/tuple.hpp>
 
@@ -38,7 +39,8 @@ namespace spin {
   };
 
   typedef
-  boost::tuple<HMM_context, const tree_Gaussian_statistics*> tree_context_stat;
+  boost::tuple<packed_context, const tree_Gaussian_statistics*>
+  tree_context_stat;
 
   typedef
   std::vector<tree_context_stat> tree_context_stat_list;
@@ -46,24 +48,70 @@ namespace spin {
   typedef
   std::map<const context_decision_tree_node*, tree_context_stat_list> tree_membership;
 
+  /**
+   * Gaussian statistics for each HMM context.
+   *
+   * Entries are stored contiguously in the order of insertion, and found
+   * through an open-addressing hash table over their packed keys, so
+   * accumulation doesn't compare or copy label strings.
+   */
   class tree_statistics {
-    std::map<HMM_context, tree_Gaussian_statistics> _data;
+    std::vector<packed_context> _keys;
+    std::vector<tree_Gaussian_statistics> _stats;
+    std::vector<int32_t> _index; // entry of each slot, -1 if empty
     int _left_context, _right_context;
+
+    size_t find_slot(const packed_context& key) const {
+      size_t mask = _index.size() - 1;
+      size_t slot = key.hash() & mask;
+      while (_index[slot] >= 0 && _keys[_index[slot]] != key) {
+        slot = (slot + 1) & mask;
+      }
+      return slot;
+    }
+    void rehash(size_t nslots);
+    tree_Gaussian_statistics& insert(const packed_context& key, int ndim);
   public:
-    tree_statistics() {}
-    tree_statistics(const variant_t& src) { read(src); }
-    void accumulate(const HMM_context& ctx, const fmatrix& features);
+    tree_statistics() : _index(16, -1), _left_context(0), _right_context(0) {}
+    tree_statistics(const variant_t& src)
+      : _index(16, -1), _left_context(0), _right_context(0) {
+      read(src);
+    }
+    void accumulate(const HMM_context& ctx, const fmatrix& features) {
+      accumulate(ctx.pack(), features);
+    }
+    void accumulate(const packed_context& key, const fmatrix& features);
+    void accumulate(const packed_context& key,
+                    const tree_Gaussian_statistics& stats);
     void accumulate(const tree_statistics& other);
     void read(const variant_t& src);
     void write(variant_t* dest);
 
+    /// Raw statistics file with entries sorted by the context strings
+    static bool is_binary_file(const std::string& path);
+    void write_binary(const std::string& path) const;
+
+    /// Load either a binary file or a variant file
+    void load(const std::string& path);
+
     int left_context_length() const { return _left_context; }
     int right_context_length() const { return _right_context; }
     void set_left_context_length(int n) { _left_context = n; }
     void set_right_context_length(int n) { _right_context = n; }
 
-    const std::map<HMM_context, tree_Gaussian_statistics>& data() const {
-      return _data;
+    size_t size() const { return _keys.size(); }
+    const packed_context& key(size_t i) const { return _keys[i]; }
+    const std::vector<packed_context>& keys() const { return _keys; }
+    HMM_context context(size_t i) const {
+      return HMM_context::unpack(_keys[i]);
+    }
+    const tree_Gaussian_statistics& statistics(size_t i) const {
+      return _stats[i];
+    }
+
+    /// Index of the entry of the key, -1 if not found
+    int find(const packed_context& key) const {
+      return _index[find_slot(key)];
     }
 
     void compute_membership(const context_decision_tree& tree,
@@ -71,6 +119,46 @@ namespace spin {
 
   };
   
+  /**
+   * Mapped binary tree statistics written by
+   * tree_statistics::write_binary().  Entry i consists of the string form
+   * of a context, and a record of (1 + 2 * ndim) doubles holding the zero,
+   * first and second order statistics.  The entries are sorted by the
+   * bytes of the context strings.
+   */
+  class tree_statistics_file {
+  public:
+    enum { SEC_KEY_OFFSETS = 0, SEC_KEYS, SEC_RECORDS };
+    enum { PARAM_LEFT = 0, PARAM_RIGHT, PARAM_NDIM, PARAM_NENTRIES };
+  private:
+    stat_file _file;
+    const uint64_t* _key_offsets; // (# entries + 1)
+    const char* _keys;
+    const double* _records;
+    size_t _nentries;
+    int _ndim;
+  public:
+    explicit tree_statistics_file(const std::string& path);
+
+    size_t size() const { return _nentries; }
+    int ndim() const { return _ndim; }
+    int left_context_length() const { return _file.param(PARAM_LEFT); }
+    int right_context_length() const { return _file.param(PARAM_RIGHT); }
+
+    const char* key_data(size_t i) const { return _keys + _key_offsets[i]; }
+    size_t key_size(size_t i) const {
+      return _key_offsets[i + 1] - _key_offsets[i];
+    }
+    const double* record(size_t i) const {
+      return _records + i * (1 + 2 * _ndim);
+    }
+  };
+
+  /// Sum binary tree statistics files into a binary file, by a k-way merge
+  /// over the sorted entries without loading the inputs entirely.
+  void merge_tree_statistics_files(const std::vector<std::string>& inputs,
+                                   const std::string& output);
+
   void get_alignment_context(const vector_fst& align, int leftctx, int rightctx,
                              std::vector<HMM_context>* pctxlist);
 
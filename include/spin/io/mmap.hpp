@@ -0,0 +1,33 @@
+#ifndef spin_io_mmap_hpp_
+#define spin_io_mmap_hpp_
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+
+namespace spin {
+  /**
+   * Read-only memory mapping of a whole file.
+   * Pages are shared through the page cache among processes mapping the
+   * same file.
+   */
+  class mapped_file {
+    const char* _data;
+    size_t _size;
+
+    mapped_file(const mapped_file&);
+    mapped_file& operator=(const mapped_file&);
+  public:
+    explicit mapped_file(const std::string& path);
+    ~mapped_file();
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    /// Hint that the mapping will be read from the beginning to the end
+    void advise_sequential() const;
+  };
+
+  typedef boost::shared_ptr<mapped_file> mapped_file_ptr;
+}
+
+#endif
@@ -5,10 +5,33 @@
 #include <spin/types.hpp>
 #include <spin/variant.hpp>
 #include <msgpack/adaptor/nil_fwd.hpp>
+#include <cstring>
+#include <stdexcept>
 #include <spin/io/fst.hpp>
 
 inline const msgpack::type::nil& get_nil();
 
+namespace spin {
+  /// Matrix from the payload of a STAC_*MATRIX ext: # of rows and columns
+  /// as uint64 followed by the column-major elements
+  template <typename MatrixT>
+  inline void decode_matrix_ext(const char* data, size_t size, MatrixT* dest) {
+    typedef typename MatrixT::Scalar scalar_type;
+    uint64_t row, col;
+    if (size < sizeof(row) + sizeof(col)) {
+      throw std::runtime_error("Broken matrix in msgpack");
+    }
+    std::memcpy(&row, data, sizeof(row));
+    std::memcpy(&col, data + sizeof(row), sizeof(col));
+    if (size < sizeof(row) + sizeof(col) + row * col * sizeof(scalar_type)) {
+      throw std::runtime_error("Broken matrix in msgpack");
+    }
+    dest->resize(row, col);
+    std::memcpy(dest->data(), data + sizeof(row) + sizeof(col),
+                row * col * sizeof(scalar_type));
+  }
+}
+
 namespace msgpack {
   enum spin_msgpack_typeid {
     STAC_FST,
@@ -52,44 +75,30 @@ namespace msgpack {
         o.convert(boost::get<std::string>(&v));
         break;
       case type::EXT: {
+        const char* data = o.via.ext.data();
         size_t siz = o.via.ext.size;
-        std::string buf(o.via.ext.data(), siz);
-        std::istringstream iss(buf);
         switch(o.via.ext.type()) {
         case STAC_FST: {
           //fst::FstReadOptions opt;
           //fst::script::FstClass* p = fst::script::FstClass::Read(iss, opt);
+          std::istringstream iss(std::string(data, siz));
           v = spin::read_fst(iss);
           break;
         }
-        case STAC_FMATRIX: {
-          uint64_t row, col;
-          iss.read(reinterpret_cast<char*>(&row), sizeof(row));
-          iss.read(reinterpret_cast<char*>(&col), sizeof(col));
-          v = spin::fmatrix(row, col);
-          iss.read(reinterpret_cast<char*>(boost::get<spin::fmatrix>(v).data()),
-                   row * col * sizeof(float));
+        case STAC_FMATRIX:
+          v = spin::fmatrix();
+          spin::decode_matrix_ext(data, siz, boost::get<spin::fmatrix>(&v));
           break;
-        }
-        case STAC_DMATRIX: {
-          uint64_t row, col;
-          iss.read(reinterpret_cast<char*>(&row), sizeof(row));
-          iss.read(reinterpret_cast<char*>(&col), sizeof(col));
-          v = spin::dmatrix(row, col);
-          iss.read(reinterpret_cast<char*>(boost::get<spin::dmatrix>(v).data()),
-                   row * col * sizeof(double));
+        case STAC_DMATRIX:
+          v = spin::dmatrix();
+          spin::decode_matrix_ext(data, siz, boost::get<spin::dmatrix>(&v));
           break;
-        }
-        case STAC_INTMATRIX: {
-          uint64_t row, col;
-          iss.read(reinterpret_cast<char*>(&row), sizeof(row));
-          iss.read(reinterpret_cast<char*>(&col), sizeof(col));
-          v = spin::intmatrix(row, col);
-          iss.read(reinterpret_cast<char*>(boost::get<spin::intmatrix>(v).data()),
-                   row * col * sizeof(int));          
+        case STAC_INTMATRIX:
+          v = spin::intmatrix();
+          spin::decode_matrix_ext(data, siz, boost::get<spin::intmatrix>(&v));
           break;
-        }
         case STAC_REF: {
+          std::istringstream iss(std::string(data, siz));
           spin::ext_ref ref;
           std::getline(iss, ref.loc);
           std::getline(iss, ref.format);
@@ -0,0 +1,82 @@
+#ifndef spin_io_statfile_hpp_
+#define spin_io_statfile_hpp_
+
+#include <spin/io/mmap.hpp>
+#include <string>
+#include <fstream>
+#include <stdint.h>
+
+namespace spin {
+  /**
+   * Raw container of statistics.
+   *
+   * A file is a fixed header followed by up to MAX_SECTIONS sections of
+   * dense arrays, each aligned to 8 bytes.  The header holds a magic that
+   * identifies the content, integer parameters (dimensions etc.), and the
+   * offset and the size of every section, so that the arrays can be used
+   * directly from a memory mapping.
+   */
+  class stat_file {
+  public:
+    enum { MAX_SECTIONS = 8, MAX_PARAMS = 8, VERSION = 1 };
+
+    struct file_header {
+      char magic[8];
+      uint32_t version;
+      uint32_t reserved;
+      int64_t params[MAX_PARAMS];
+      uint64_t sections[MAX_SECTIONS][2]; // offset and size in bytes
+    };
+  private:
+    mapped_file_ptr _mapping;
+    file_header _header;
+  public:
+    /// Maps path, throws if it is not a statistics file of the magic
+    stat_file(const std::string& path, const std::string& magic);
+
+    /// Check if path is a statistics file of the magic
+    static bool is_stat_file(const std::string& path,
+                             const std::string& magic);
+
+    int64_t param(int i) const { return _header.params[i]; }
+
+    /// Section sec as an array of T, *psize becomes # of the elements
+    template <typename T>
+    const T* section(int sec, size_t* psize) const {
+      *psize = _header.sections[sec][1] / sizeof(T);
+      return reinterpret_cast<const T*>(_mapping->data() +
+                                        _header.sections[sec][0]);
+    }
+  };
+
+  /**
+   * Writes a file read by stat_file.  Sections are written sequentially
+   * in any order by begin_section() and write(), and the header is written
+   * by close(), so that the sizes needn't be known in advance.
+   */
+  class stat_file_writer {
+    std::string _path;
+    std::ofstream _ofs;
+    stat_file::file_header _header;
+    int _current;
+
+    stat_file_writer(const stat_file_writer&);
+    stat_file_writer& operator=(const stat_file_writer&);
+  public:
+    stat_file_writer(const std::string& path, const std::string& magic);
+
+    void set_param(int i, int64_t value) { _header.params[i] = value; }
+
+    void begin_section(int sec);
+
+    template <typename T>
+    void write(const T* data, size_t n) {
+      _ofs.write(reinterpret_cast<const char*>(data), n * sizeof(T));
+      _header.sections[_current][1] += n * sizeof(T);
+    }
+
+    void close();
+  };
+}
+
+#endif
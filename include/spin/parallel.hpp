@@ -0,0 +1,264 @@
+#ifndef spin_parallel_hpp_
+#define spin_parallel_hpp_
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <vector>
+#include <functional>
+#include <exception>
+
+namespace spin {
+  /**
+   * Blocking FIFO with a capacity limit.
+   * push() waits while the queue is full, pop() waits while it is empty.
+   * After close(), push() returns false without adding the item, and pop()
+   * returns false once the queue is drained.
+   */
+  template <typename T>
+  class bounded_queue {
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+    std::deque<T> _items;
+    size_t _capacity;
+    bool _closed;
+  public:
+    explicit bounded_queue(size_t capacity)
+      : _capacity(capacity), _closed(false) { }
+
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _not_full.wait(lock, [this] {
+          return _closed || _items.size() < _capacity;
+        });
+      if (_closed) return false;
+      _items.push_back(std::move(item));
+      _not_empty.notify_one();
+      return true;
+    }
+
+    bool pop(T* dest) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _not_empty.wait(lock, [this] { return _closed || ! _items.empty(); });
+      if (_items.empty()) return false;
+      *dest = std::move(_items.front());
+      _items.pop_front();
+      _not_full.notify_one();
+      return true;
+    }
+
+    void close() {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+      _not_empty.notify_all();
+      _not_full.notify_all();
+    }
+  };
+
+  /**
+   * Fixed set of threads for data-parallel loops.
+   *
+   * run(njobs, job) calls job(0), ..., job(njobs - 1) on the pool threads
+   * and the calling thread, and returns when all of them are finished.
+   * An exception thrown by a job is rethrown from run().  run() must not
+   * be called concurrently from several threads.
+   */
+  class worker_pool {
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    std::function<void (int)> _job;
+    int _njobs;
+    int _next; // next job index to be taken
+    int _nfinished;
+    bool _stop;
+    std::exception_ptr _error;
+
+    worker_pool(const worker_pool&);
+    worker_pool& operator=(const worker_pool&);
+
+    // take and run jobs while any is left, lock must be held
+    void work(std::unique_lock<std::mutex>& lock) {
+      while (_next < _njobs) {
+        int n = _next ++;
+        lock.unlock();
+        try {
+          _job(n);
+        } catch (...) {
+          lock.lock();
+          if (! _error) _error = std::current_exception();
+          lock.unlock();
+        }
+        lock.lock();
+        if (++ _nfinished == _njobs) _done.notify_all();
+      }
+    }
+  public:
+    /// nthreads includes the calling thread of run()
+    explicit worker_pool(int nthreads)
+      : _njobs(0), _next(0), _nfinished(0), _stop(false) {
+      for (int w = 1; w < nthreads; ++ w) {
+        _threads.push_back(std::thread([this] {
+              std::unique_lock<std::mutex> lock(_mutex);
+              while (true) {
+                _wake.wait(lock, [this] { return _stop || _next < _njobs; });
+                if (_stop) return;
+                work(lock);
+              }
+            }));
+      }
+    }
+
+    ~worker_pool() {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _wake.notify_all();
+      }
+      for (auto& th : _threads) th.join();
+    }
+
+    int size() const { return _threads.size() + 1; }
+
+    void run(int njobs, std::function<void (int)> job) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _job = job;
+      _njobs = njobs;
+      _next = 0;
+      _nfinished = 0;
+      _error = std::exception_ptr();
+      _wake.notify_all();
+      work(lock);
+      _done.wait(lock, [this] { return _nfinished == _njobs; });
+      _njobs = 0;
+      _next = 0;
+      std::exception_ptr error = _error;
+      lock.unlock();
+      if (error) std::rethrow_exception(error);
+    }
+  };
+
+  /**
+   * Pairwise tree reduction of items into items[0].
+   *
+   * In each round, item i absorbs item i + step by merge(items[i],
+   * items[i + step]) for every i multiple of 2 * step, and step doubles.
+   * The merges of a round are independent and run on pool if given, so
+   * that n items are reduced in ceil(log2(n)) rounds.
+   */
+  template <typename T>
+  void tree_reduce(std::vector<T>& items,
+                   std::function<void (T&, const T&)> merge,
+                   worker_pool* pool = 0) {
+    int n = items.size();
+    for (int step = 1; step < n; step *= 2) {
+      int nmerges = (n - step + 2 * step - 1) / (2 * step);
+      auto job = [&](int k) {
+        int i = k * 2 * step;
+        merge(items[i], items[i + step]);
+      };
+      if (pool) {
+        pool->run(nmerges, job);
+      } else {
+        for (int k = 0; k < nmerges; ++ k) job(k);
+      }
+    }
+  }
+
+  /**
+   * Runs work on items produced sequentially, in nthreads workers, and
+   * hands the results to consume() in the order of production.
+   *
+   * produce(&item) returns false at the end of the input, and is called
+   * from the calling thread together with consume().  work(worker, item,
+   * &result) is called from the worker threads; worker is an index in
+   * [0, nthreads) so that the caller can keep per-thread resources.  At
+   * most maxinflight items are processed or waiting to be consumed at a
+   * time.  An exception thrown by work() is rethrown from run().
+   */
+  template <typename In, typename Out>
+  class ordered_pipeline {
+    typedef std::pair<size_t, In> job;
+
+    int _nthreads;
+    size_t _maxinflight;
+
+    std::mutex _mutex;
+    std::condition_variable _done;
+    std::map<size_t, Out> _results;
+    std::exception_ptr _error;
+  public:
+    ordered_pipeline(int nthreads, size_t maxinflight = 0)
+      : _nthreads(nthreads),
+        _maxinflight(maxinflight > 0 ? maxinflight : nthreads * 2) {
+    }
+
+    void run(std::function<bool (In*)> produce,
+             std::function<void (int, In&, Out*)> work,
+             std::function<void (Out&)> consume) {
+      bounded_queue<job> jobs(_maxinflight);
+      std::vector<std::thread> workers;
+      for (int w = 0; w < _nthreads; ++ w) {
+        workers.push_back(std::thread([&, w] {
+              job j;
+              while (jobs.pop(&j)) {
+                Out result;
+                try {
+                  work(w, j.second, &result);
+                } catch (...) {
+                  std::lock_guard<std::mutex> lock(_mutex);
+                  if (! _error) _error = std::current_exception();
+                }
+                std::lock_guard<std::mutex> lock(_mutex);
+                _results.insert(std::make_pair(j.first, std::move(result)));
+                _done.notify_all();
+              }
+            }));
+      }
+
+      size_t nproduced = 0, nconsumed = 0;
+      // consume results in order while waiting for pred
+      auto drain = [&](std::function<bool ()> pred) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (true) {
+          auto it = _results.find(nconsumed);
+          if (it != _results.end() && ! _error) {
+            Out result = std::move(it->second);
+            _results.erase(it);
+            lock.unlock();
+            consume(result);
+            lock.lock();
+            ++ nconsumed;
+            continue;
+          }
+          if (_error || pred()) break;
+          _done.wait(lock);
+        }
+      };
+
+      try {
+        In item;
+        while (produce(&item)) {
+          jobs.push(std::make_pair(nproduced ++, std::move(item)));
+          item = In();
+          drain([&] { return nproduced - nconsumed < _maxinflight; });
+          if (_error) break;
+        }
+        drain([&] { return nconsumed == nproduced; });
+      } catch (...) {
+        jobs.close();
+        for (auto& th : workers) th.join();
+        throw;
+      }
+      jobs.close();
+      for (auto& th : workers) th.join();
+      if (_error) std::rethrow_exception(_error);
+    }
+  };
+}
+
+#endif
@@ -1,36 +1,64 @@
 #include <spin/corpus/corpus.hpp>
 #include <spin/corpus/yaml.hpp>
 #include <spin/corpus/msgpack.hpp>
+#include <spin/corpus/index.hpp>
+#include <spin/corpus/prefetch.hpp>
 #include <spin/io/file.hpp>
 #include <gear/io/logging.hpp>
+#include <sys/stat.h>
 
 namespace spin {
-  corpus_iterator_ptr
-  make_corpus_iterator(const std::string& path, 
-                       boost::logic::tribool is_binary) {
-    if (boost::logic::indeterminate(is_binary)) {
-      is_binary = check_binary_header(path);
+  namespace {
+    // pipes etc. are read as streams since they cannot be mapped
+    bool is_regular_file(const std::string& path) {
+      struct stat st;
+      return ::stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode);
     }
-    corpus_iterator* p = (is_binary)
-      ? (corpus_iterator*) new msgpack_corpus_iterator(path)
-      : (corpus_iterator*) new yaml_corpus_iterator(path);
-
-    return corpus_iterator_ptr(p);
   }
+
   corpus_iterator_ptr
+  make_corpus_iterator(const std::string& path, 
+                       boost::logic::tribool is_binary, size_t prefetch) {
+    return make_corpus_iterator(path, 0, is_binary, prefetch);
+  }
 
+  corpus_iterator_ptr
   make_corpus_iterator(const std::string& path, corpus_pos_t pos,
-                       boost::logic::tribool is_binary) {
+                       boost::logic::tribool is_binary, size_t prefetch) {
     if (boost::logic::indeterminate(is_binary)) {
       is_binary = check_binary_header(path);
     }
-    corpus_iterator* p = (is_binary)
-      ? (corpus_iterator*) new msgpack_corpus_iterator(path, pos)
-      : (corpus_iterator*) new yaml_corpus_iterator(path, pos);
-
-    return corpus_iterator_ptr(p);
+    corpus_iterator* p;
+    if (! is_binary) {
+      p = new yaml_corpus_iterator(path, pos);
+    } else if (is_regular_file(path)) {
+      p = new mapped_msgpack_corpus_iterator(path, pos);
+    } else {
+      p = new msgpack_corpus_iterator(path, pos);
+    }
+    corpus_iterator_ptr ret(p);
+    if (prefetch > 0) {
+      ret.reset(new prefetching_corpus_iterator(ret, prefetch));
+    }
+    return ret;
   }
 
+  corpus_iterator_ptr
+  make_corpus_iterator(const std::string& path,
+                       const std::vector<std::string>& keys) {
+    corpus_index index(path);
+    std::vector<corpus_pos_t> positions;
+    for (auto it = keys.cbegin(), last = keys.cend(); it != last; ++ it) {
+      int i = index.find(*it);
+      if (i < 0) {
+        throw std::runtime_error("Key " + *it + " is not found in the index of "
+                                 + path);
+      }
+      positions.push_back(index.position(i));
+    }
+    return corpus_iterator_ptr(new positioned_corpus_iterator(path, positions,
+                                                              index.is_binary()));
+  }
   
   corpus_writer_ptr
   make_corpus_writer(const std::string& path, 
@@ -67,8 +95,18 @@ namespace spin {
   }
   */
 
-  zipped_corpus_iterator::zipped_corpus_iterator(corpus_iterators& ites) 
+  zipped_corpus_iterator::zipped_corpus_iterator(corpus_iterators& ites,
+                                                 size_t prefetch)
     : _iterators(ites) {
+    if (prefetch > 0) {
+      for (auto it = _iterators.begin(), last = _iterators.end();
+           it != last; ++ it) {
+        if (! dynamic_cast<prefetching_corpus_iterator*>(it->second.get())) {
+          it->second.reset(new prefetching_corpus_iterator(it->second,
+                                                           prefetch));
+        }
+      }
+    }
     skip_unseen_entries();
     update_merged_entry();
   }
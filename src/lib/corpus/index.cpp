@@ -0,0 +1,138 @@
+#include <spin/corpus/index.hpp>
+#include <gear/io/logging.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <sys/stat.h>
+
+namespace spin {
+  namespace {
+    const char corpus_index_magic[] = "SpinCIDX";
+
+    bool get_file_size(const std::string& path, uint64_t* psize) {
+      struct stat st;
+      if (::stat(path.c_str(), &st) != 0) return false;
+      *psize = st.st_size;
+      return true;
+    }
+  }
+
+  corpus_index::corpus_index(const std::string& corpus_path)
+    : _file(index_path(corpus_path), corpus_index_magic) {
+    _nentries = _file.param(PARAM_NENTRIES);
+    size_t noffsets, nkeys, nrecords;
+    _key_offsets = _file.section<uint64_t>(SEC_KEY_OFFSETS, &noffsets);
+    _keys = _file.section<char>(SEC_KEYS, &nkeys);
+    _records = _file.section<uint64_t>(SEC_RECORDS, &nrecords);
+    if (noffsets != _nentries + 1 || _key_offsets[0] != 0 ||
+        _key_offsets[_nentries] != nkeys || nrecords != 2 * _nentries) {
+      throw std::runtime_error("Broken corpus index " +
+                               index_path(corpus_path));
+    }
+    for (size_t i = 0; i < _nentries; ++ i) {
+      if (_key_offsets[i] > _key_offsets[i + 1]) {
+        throw std::runtime_error("Broken corpus index " +
+                                 index_path(corpus_path));
+      }
+    }
+    uint64_t size;
+    if (! get_file_size(corpus_path, &size) ||
+        size != static_cast<uint64_t>(_file.param(PARAM_CORPUS_SIZE))) {
+      throw std::runtime_error("Corpus index " + index_path(corpus_path) +
+                               " is not up to date");
+    }
+  }
+
+  std::string corpus_index::index_path(const std::string& corpus_path) {
+    return corpus_path + ".idx";
+  }
+
+  bool corpus_index::is_available(const std::string& corpus_path) {
+    if (! stat_file::is_stat_file(index_path(corpus_path),
+                                  corpus_index_magic)) {
+      return false;
+    }
+    try {
+      corpus_index index(corpus_path);
+    } catch (const std::runtime_error& e) {
+      WARN("%s", e.what());
+      return false;
+    }
+    return true;
+  }
+
+  int corpus_index::find(const std::string& key) const {
+    size_t lo = 0, hi = _nentries;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      const char* k = _keys + _key_offsets[mid];
+      size_t ksize = _key_offsets[mid + 1] - _key_offsets[mid];
+      int c = std::memcmp(k, key.data(), std::min(ksize, key.size()));
+      if (c < 0 || (c == 0 && ksize < key.size())) {
+        lo = mid + 1;
+      } else {
+        hi = mid;
+      }
+    }
+    if (lo < _nentries && key == this->key(lo)) return lo;
+    return -1;
+  }
+
+  void corpus_index_writer::add(const corpus_entry& entry, corpus_pos_t pos,
+                                size_t length) {
+    corpus_entry::const_iterator it = entry.find("+key");
+    if (it == entry.end() || it->second.which() != VARIANT_STRING) return;
+    record rec;
+    rec.key = boost::get<std::string>(it->second);
+    rec.position = pos;
+    rec.length = length;
+    _records.push_back(rec);
+  }
+
+  void corpus_index_writer::write(const std::string& corpus_path,
+                                  size_t corpus_size, bool is_binary) {
+    std::string path = corpus_index::index_path(corpus_path);
+    try {
+      std::stable_sort(_records.begin(), _records.end());
+      stat_file_writer writer(path, corpus_index_magic);
+      writer.set_param(corpus_index::PARAM_NENTRIES, _records.size());
+      writer.set_param(corpus_index::PARAM_CORPUS_SIZE, corpus_size);
+      writer.set_param(corpus_index::PARAM_BINARY, is_binary ? 1 : 0);
+
+      std::vector<uint64_t> offsets(1, 0);
+      writer.begin_section(corpus_index::SEC_KEYS);
+      for (auto it = _records.cbegin(), last = _records.cend();
+           it != last; ++ it) {
+        writer.write(it->key.data(), it->key.size());
+        offsets.push_back(offsets.back() + it->key.size());
+      }
+      writer.begin_section(corpus_index::SEC_KEY_OFFSETS);
+      writer.write(offsets.data(), offsets.size());
+      writer.begin_section(corpus_index::SEC_RECORDS);
+      for (auto it = _records.cbegin(), last = _records.cend();
+           it != last; ++ it) {
+        uint64_t rec[2] = { it->position, it->length };
+        writer.write(rec, 2);
+      }
+      writer.close();
+    } catch (const std::runtime_error& e) {
+      WARN("Corpus index is not written: %s", e.what());
+      std::remove(path.c_str());
+    }
+  }
+
+  positioned_corpus_iterator::positioned_corpus_iterator(
+      const std::string& path, const std::vector<corpus_pos_t>& positions,
+      boost::logic::tribool is_binary)
+    : _positions(positions), _cur(0) {
+    if (! _positions.empty()) {
+      _base = make_corpus_iterator(path, _positions[0], is_binary);
+    }
+  }
+
+  void positioned_corpus_iterator::next() {
+    ++ _cur;
+    if (! done()) _base->seek(_positions[_cur]);
+  }
+}
@@ -2,9 +2,23 @@
 #include <spin/io/msgpack.hpp>
 
 namespace spin {
+  namespace {
+    bool reference_payloads(msgpack::type::object_type, std::size_t, void*) {
+      return true;
+    }
+  }
+
   msgpack_corpus_iterator::msgpack_corpus_iterator(const std::string& filepath,
-                                                   corpus_pos_t pos) {
-    _input_stream = new std::ifstream(filepath);
+                                                   corpus_pos_t pos)
+    : _path(filepath), _input_stream(0) {
+    seek(pos);
+  }
+
+  void msgpack_corpus_iterator::seek(corpus_pos_t pos) {
+    if (! _input_stream) {
+      _input_stream = new std::ifstream(_path);
+    }
+    _input_stream->clear();
     _input_stream->seekg(pos, std::ios_base::beg);
     this->next();
   }
@@ -35,8 +49,9 @@ namespace spin {
     std::string buf(siz, '\0');
     _input_stream->read(&buf[0], siz); // is it safe operation?
     
+    // buf outlives the conversion, so the payloads needn't be copied
     msgpack::unpacked result;
-    msgpack::unpack(result, buf.data(), buf.size());
+    msgpack::unpack(result, buf.data(), buf.size(), reference_payloads);
     
     msgpack::object deserialized = result.get();
     deserialized.convert(&_cursor);
@@ -46,12 +61,103 @@ namespace spin {
     return _cursor;
   }
 
-  msgpack_corpus_writer::msgpack_corpus_writer(const std::string& filepath) {
+  mapped_msgpack_corpus_iterator::mapped_msgpack_corpus_iterator(
+      const std::string& filepath, corpus_pos_t pos)
+    : _mapping(new mapped_file(filepath)) {
+    _mapping->advise_sequential();
+    seek(pos);
+  }
+
+  void mapped_msgpack_corpus_iterator::seek(corpus_pos_t pos) {
+    _nextpos = pos;
+    next();
+  }
+
+  void mapped_msgpack_corpus_iterator::next() {
+    _curpos = _nextpos;
+    _converted = false;
+    _copies.clear();
+    _done = _curpos >= _mapping->size();
+    if (_done) return;
+
+    const char* record = _mapping->data() + _curpos;
+    uint64 siz;
+    if (_curpos + 8 + sizeof(siz) > _mapping->size()) {
+      throw std::runtime_error("Broken corpus: truncated record header");
+    }
+    std::memcpy(&siz, record + 8, sizeof(siz));
+    if (siz > _mapping->size() - _curpos - 8 - sizeof(siz)) {
+      throw std::runtime_error("Broken corpus: truncated record");
+    }
+    msgpack::unpack(_record, record + 8 + sizeof(siz), siz,
+                    reference_payloads);
+    _nextpos = _curpos + 8 + sizeof(siz) + siz;
+  }
+
+  const corpus_entry& mapped_msgpack_corpus_iterator::value() {
+    if (! _converted) {
+      _cursor.clear();
+      _record.get().convert(&_cursor);
+      _converted = true;
+    }
+    return _cursor;
+  }
+
+  const msgpack::object*
+  mapped_msgpack_corpus_iterator::find_field(const std::string& key) const {
+    const msgpack::object& o = _record.get();
+    if (o.type != msgpack::type::MAP) return 0;
+    for (uint32_t i = 0; i < o.via.map.size; ++ i) {
+      const msgpack::object& k = o.via.map.ptr[i].key;
+      if (k.type == msgpack::type::STR && k.via.str.size == key.size() &&
+          std::memcmp(k.via.str.ptr, key.data(), key.size()) == 0) {
+        return &o.via.map.ptr[i].val;
+      }
+    }
+    return 0;
+  }
+
+  std::string mapped_msgpack_corpus_iterator::get_key() {
+    const msgpack::object* o = find_field("+key");
+    if (! o || o->type != msgpack::type::STR) {
+      throw std::runtime_error("Invalid corpus: Cannot find +key");
+    }
+    return std::string(o->via.str.ptr, o->via.str.size);
+  }
+
+  mapped_msgpack_corpus_iterator::fmatrix_view
+  mapped_msgpack_corpus_iterator::fmatrix_field(const std::string& key) {
+    const msgpack::object* o = find_field(key);
+    if (! o || o->type != msgpack::type::EXT ||
+        o->via.ext.type() != msgpack::STAC_FMATRIX) {
+      throw std::runtime_error(key + " is not a float matrix in the corpus");
+    }
+    const char* data = o->via.ext.data();
+    uint64_t row, col;
+    if (o->via.ext.size < sizeof(row) + sizeof(col)) {
+      throw std::runtime_error("Broken matrix in msgpack");
+    }
+    std::memcpy(&row, data, sizeof(row));
+    std::memcpy(&col, data + sizeof(row), sizeof(col));
+    if (o->via.ext.size < sizeof(row) + sizeof(col) + row * col * sizeof(float)) {
+      throw std::runtime_error("Broken matrix in msgpack");
+    }
+    const char* elems = data + sizeof(row) + sizeof(col);
+    if (reinterpret_cast<uintptr_t>(elems) % alignof(float) != 0) {
+      _copies.push_back(fmatrix());
+      decode_matrix_ext(data, o->via.ext.size, &_copies.back());
+      return fmatrix_view(_copies.back().data(), row, col);
+    }
+    return fmatrix_view(reinterpret_cast<const float*>(elems), row, col);
+  }
+
+  msgpack_corpus_writer::msgpack_corpus_writer(const std::string& filepath)
+    : _path(filepath) {
     _output_stream = new std::ofstream(filepath);
   }
 
   msgpack_corpus_writer::~msgpack_corpus_writer() {
-    if (_output_stream) { delete _output_stream; }
+    close();
   }
 
   void msgpack_corpus_writer::write(const corpus_entry& object) {
@@ -59,10 +165,21 @@ namespace spin {
     msgpack::pack(oss, object);
     uint64 siz = oss.str().size();
     const char* magic = "StacCrps";
+    corpus_pos_t pos = _output_stream->tellp();
     _output_stream->write(magic, 8);
     _output_stream->write(reinterpret_cast<const char*>(&siz), sizeof(siz));
     _output_stream->write(reinterpret_cast<const char*>(oss.str().c_str()),
                           siz);
+    _index.add(object, pos, 8 + sizeof(siz) + siz);
+  }
+
+  void msgpack_corpus_writer::close() {
+    if (! _output_stream) return;
+    _output_stream->flush();
+    std::streamoff size = _output_stream->tellp();
+    delete _output_stream;
+    _output_stream = 0;
+    if (size >= 0) _index.write(_path, size, true);
   }
 
 
@@ -0,0 +1,67 @@
+#include <spin/corpus/prefetch.hpp>
+
+namespace spin {
+  prefetching_corpus_iterator::
+  prefetching_corpus_iterator(corpus_iterator_ptr base, size_t depth)
+    : _base(base), _depth(depth > 0 ? depth : 1), _done(false) {
+    start();
+  }
+
+  prefetching_corpus_iterator::~prefetching_corpus_iterator() {
+    stop();
+  }
+
+  void prefetching_corpus_iterator::start() {
+    _queue.reset(new bounded_queue<item>(_depth));
+    _reader = std::thread([this] { fetch(); });
+    _done = false;
+    try {
+      next();
+    } catch (...) {
+      stop(); // not joined by the destructor if thrown in the constructor
+      throw;
+    }
+  }
+
+  void prefetching_corpus_iterator::stop() {
+    if (! _reader.joinable()) return;
+    _queue->close();
+    _reader.join();
+  }
+
+  void prefetching_corpus_iterator::fetch() {
+    try {
+      for (; ! _base->done(); _base->next()) {
+        item it;
+        it.entry = _base->value();
+        it.pos = _base->pos();
+        if (! _queue->push(std::move(it))) return;
+      }
+    } catch (...) {
+      item it;
+      it.error = std::current_exception();
+      _queue->push(std::move(it));
+    }
+    _queue->close();
+  }
+
+  void prefetching_corpus_iterator::next() {
+    if (! _queue->pop(&_current)) {
+      _current = item();
+      _done = true;
+      return;
+    }
+    if (_current.error) {
+      std::exception_ptr error = _current.error;
+      _current = item();
+      _done = true;
+      std::rethrow_exception(error);
+    }
+  }
+
+  void prefetching_corpus_iterator::seek(corpus_pos_t pos) {
+    stop();
+    _base->seek(pos);
+    start();
+  }
+}
@@ -4,9 +4,20 @@
 namespace spin {
   yaml_corpus_iterator::yaml_corpus_iterator(const std::string& filepath,
                                              corpus_pos_t pos)
-    : _curpos(pos), _nextpos(pos) {
-    _input_stream = new std::ifstream(filepath);
+    : _path(filepath), _input_stream(0) {
+    seek(pos);
+  }
+
+  void yaml_corpus_iterator::seek(corpus_pos_t pos) {
+    if (_path.empty()) {
+      throw std::runtime_error("Seek is not supported in YAML stream");
+    }
+    if (! _input_stream) {
+      _input_stream = new std::ifstream(_path);
+    }
+    _input_stream->clear();
     _input_stream->seekg(pos, std::ios_base::beg);
+    _curpos = _nextpos = pos;
     _buffer = "\n";
     _done = false;
     std::string s;
@@ -86,18 +97,31 @@ namespace spin {
     return boost::get<corpus_entry>(_cursor);
   }
 
-  yaml_corpus_writer::yaml_corpus_writer(const std::string& filepath) {
+  yaml_corpus_writer::yaml_corpus_writer(const std::string& filepath)
+    : _path(filepath) {
     _output_stream = new std::ofstream(filepath);
   }
 
   yaml_corpus_writer::~yaml_corpus_writer() {
-    if (_output_stream) delete _output_stream;
+    close();
   }
 
   void yaml_corpus_writer::write(const corpus_entry& entry) {
     variant_t v = entry;
     YAML::Node n = make_node_from_variant(v);
+    corpus_pos_t pos = _output_stream->tellp();
     *_output_stream << "---" << std::endl << n << std::endl;
+    _index.add(entry, pos, static_cast<corpus_pos_t>(_output_stream->tellp())
+               - pos);
+  }
+
+  void yaml_corpus_writer::close() {
+    if (! _output_stream) return;
+    _output_stream->flush();
+    std::streamoff size = _output_stream->tellp();
+    delete _output_stream;
+    _output_stream = 0;
+    if (size >= 0) _index.write(_path, size, false);
   }
   
 }
@@ -1,12 +1,17 @@
 #include <spin/fscorer/diaggmm.hpp>
 #include <spin/utils.hpp>
 #include <gear/io/logging.hpp>
+#include <spin/parallel.hpp>
+#include <spin/io/statfile.hpp>
+#include <spin/io/variant.hpp>
 #include <cfloat>
+#include <algorithm>
 
 namespace spin {
 
   diagonal_GMM_statistics::diagonal_GMM_statistics(const diagonal_GMM_parameter&
-                                                   param) {
+                                                   param)
+    : _loglike(0.0), _float_accumulation(false) {
     _zero = statmatrix::Zero(param.max_nmixtures(), param.nstates());
     _first = statmatrix::Zero(param.nfeatures(), param.nmeans());
     _second = statmatrix::Zero(param.nfeatures(), param.nsqrtprecs());
@@ -14,7 +19,8 @@ namespace spin {
 
   diagonal_GMM_statistics::diagonal_GMM_statistics(int ndim, int nmaxmix,
                                                    int nstate, int nmean,
-                                                   int nvar) {
+                                                   int nvar)
+    : _loglike(0.0), _float_accumulation(false) {
     _zero = statmatrix::Zero(nmaxmix, nstate);
     _first = statmatrix::Zero(ndim, nmean);
     _second = statmatrix::Zero(ndim, nvar);    
@@ -30,36 +36,59 @@ namespace spin {
   }
   
   void
-  diagonal_GMM_statistics::accumulate(int s, fmatrix features,
+  diagonal_GMM_statistics::accumulate(int s,
+                                      const Eigen::Ref<const fmatrix>& features,
                                       const diagonal_GMM_parameter& param) {
-    dmatrix gll;
-    param.get_gaussian_scores<double>(features,
-                                      param.means(s),
-                                      param.sqrtprecs(s),
-                                      param.logzs(s),
-                                      &gll);
-    //std::cout << "Gaussian Loglikes = " << std::endl << gll << std::endl;
-    std::vector<int> means = param.mean_ids(s);
-    std::vector<int> sqprs = param.sqrtprec_ids(s);
-    for (int t = 0; t < features.cols(); ++ t) {
-      statvector lik = gll.col(t).cast<statscalar>();
-      statvector logprior = param.logweights(s).cast<statscalar>();
-      statvector logjoint = lik + logprior;
-      //logjoint = logjoint.cwiseMax(logjoint.maxCoeff() - 10.0f);
-      statscalar framell = log_sum_exp(logjoint);
-      this->get_loglikelihood() += framell;
-
-      statvector logpost =
-        (logjoint.array() - framell).matrix();
-      //std::cout << "Log posterior " << t << " = " << std::endl << logpost << std::endl;
-      statvector post = logpost.array().exp().matrix();
-
-      this->get_zero().col(s) += post;
-      statvector x = features.col(t).cast<statscalar>();
-      for(int m = 0; m < gll.rows(); ++ m) {
-        this->get_first().col(means[m]) += post(m) * x;
-        this->get_second().col(sqprs[m]) += post(m) * x.cwiseProduct(x);
-      }
+    const diagonal_GMM_statedef& def = param.statedefs()[s];
+    int M = def.mean_ids.size();
+    int D = features.rows();
+    int T = features.cols();
+    if (T == 0) return;
+
+    // Log-likelihoods of the Gaussians as the quadratic-form expansion
+    //   const - 0.5 prec . x^2 + (prec * mean) . x
+    // so that the segment is scored by two matrix products.
+    dmatrix precs(D, M), mprecs(D, M);
+    dvector consts(M);
+    for (int m = 0; m < M; ++ m) {
+      dvector sqrtprec = param.sqrtprecs().col(def.var_ids[m]).cast<double>();
+      dvector mean = param.means().col(def.mean_ids[m]).cast<double>();
+      precs.col(m) = sqrtprec.cwiseProduct(sqrtprec);
+      mprecs.col(m) = precs.col(m).cwiseProduct(mean);
+      consts(m) = - 0.5 * mprecs.col(m).dot(mean)
+        - param.logzs()(def.var_ids[m]) + def.logweights(m);
+    }
+    dmatrix x = features.cast<double>();
+    dmatrix logjoint = mprecs.transpose() * x;
+    logjoint.noalias() -= 0.5 * precs.transpose() * x.cwiseAbs2();
+    logjoint.colwise() += consts;
+
+    // posteriors, (# mixtures) x T
+    Eigen::Matrix<double, 1, Eigen::Dynamic> framell = log_sum_exp(logjoint);
+    _loglike += framell.sum();
+    dmatrix post = (logjoint.rowwise() - framell).array().exp().matrix();
+    _zero.col(s).head(M) += post.rowwise().sum();
+
+    if (_float_accumulation) {
+      accumulate_products<float>(s, features, post, param);
+    } else {
+      accumulate_products<double>(s, features, post, param);
+    }
+  }
+
+  template <typename NumT>
+  void diagonal_GMM_statistics::accumulate_products(
+      int s, const Eigen::Ref<const fmatrix>& features, const dmatrix& post,
+      const diagonal_GMM_parameter& param) {
+    typedef Eigen::Matrix<NumT, Eigen::Dynamic, Eigen::Dynamic> matrix;
+    const diagonal_GMM_statedef& def = param.statedefs()[s];
+    matrix x = features.cast<NumT>();
+    matrix postt = post.transpose().cast<NumT>();
+    matrix first = x * postt; // (feadim) x (# mixtures)
+    matrix second = x.cwiseAbs2() * postt;
+    for (int m = 0; m < postt.cols(); ++ m) {
+      _first.col(def.mean_ids[m]) += first.col(m).template cast<statscalar>();
+      _second.col(def.var_ids[m]) += second.col(m).template cast<statscalar>();
     }
   }
 
@@ -80,6 +109,77 @@ namespace spin {
     *dest = props;
   }
 
+  namespace {
+    const char gmm_stats_magic[] = "SpinDGST";
+    enum { GMMST_LOGLIKE = 0, GMMST_ZERO, GMMST_FIRST, GMMST_SECOND };
+    enum { GMMST_NMAXMIX = 0, GMMST_NSTATE, GMMST_NDIM, GMMST_NMEAN,
+           GMMST_NVAR };
+  }
+
+  bool diagonal_GMM_statistics::is_binary_file(const std::string& path) {
+    return stat_file::is_stat_file(path, gmm_stats_magic);
+  }
+
+  void diagonal_GMM_statistics::write_binary(const std::string& path) const {
+    stat_file_writer writer(path, gmm_stats_magic);
+    writer.set_param(GMMST_NMAXMIX, _zero.rows());
+    writer.set_param(GMMST_NSTATE, _zero.cols());
+    writer.set_param(GMMST_NDIM, _first.rows());
+    writer.set_param(GMMST_NMEAN, _first.cols());
+    writer.set_param(GMMST_NVAR, _second.cols());
+    writer.begin_section(GMMST_LOGLIKE);
+    writer.write(&_loglike, 1);
+    writer.begin_section(GMMST_ZERO);
+    writer.write(_zero.data(), _zero.size());
+    writer.begin_section(GMMST_FIRST);
+    writer.write(_first.data(), _first.size());
+    writer.begin_section(GMMST_SECOND);
+    writer.write(_second.data(), _second.size());
+    writer.close();
+  }
+
+  void diagonal_GMM_statistics::accumulate_binary(const std::string& path) {
+    stat_file file(path, gmm_stats_magic);
+    if (file.param(GMMST_NMAXMIX) != _zero.rows() ||
+        file.param(GMMST_NSTATE) != _zero.cols() ||
+        file.param(GMMST_NDIM) != _first.rows() ||
+        file.param(GMMST_NMEAN) != _first.cols() ||
+        file.param(GMMST_NVAR) != _second.cols()) {
+      throw std::runtime_error("Statistics size mismatch in " + path);
+    }
+    size_t size;
+    const statscalar* loglike =
+      file.section<statscalar>(GMMST_LOGLIKE, &size);
+    if (size != 1) throw std::runtime_error("Broken statistics file " + path);
+    _loglike += *loglike;
+
+    statmatrix* dests[] = { &_zero, &_first, &_second };
+    for (int k = 0; k < 3; ++ k) {
+      const statscalar* src = file.section<statscalar>(GMMST_ZERO + k, &size);
+      if (size != static_cast<size_t>(dests[k]->size())) {
+        throw std::runtime_error("Broken statistics file " + path);
+      }
+      *dests[k] += Eigen::Map<const statmatrix>(src, dests[k]->rows(),
+                                                dests[k]->cols());
+    }
+  }
+
+  void diagonal_GMM_statistics::load(const std::string& path) {
+    if (is_binary_file(path)) {
+      stat_file file(path, gmm_stats_magic);
+      *this = diagonal_GMM_statistics(file.param(GMMST_NDIM),
+                                      file.param(GMMST_NMAXMIX),
+                                      file.param(GMMST_NSTATE),
+                                      file.param(GMMST_NMEAN),
+                                      file.param(GMMST_NVAR));
+      accumulate_binary(path);
+    } else {
+      variant_t src;
+      load_variant(&src, path);
+      read(src);
+    }
+  }
+
   diagonal_GMM_parameter::diagonal_GMM_parameter(variant_t node) {
     variant_map& map = boost::get<variant_map>(node);
     _means = boost::get<fmatrix>(map["means"]);
@@ -108,6 +208,13 @@ namespace spin {
 
       _states.push_back(statedef);
     }
+
+    if (map.find("gselect") != map.end()) {
+      _gselect.reset(new gaussian_selection(map["gselect"]));
+      if (_gselect->nstates() != _states.size()) {
+        throw std::runtime_error("Gaussian selection table doesn't match the model");
+      }
+    }
   }
 
   void diagonal_GMM_parameter::write(variant_t* dest) {
@@ -134,6 +241,9 @@ namespace spin {
       states.push_back(stateprops);
     }
     props["states"] = states;
+    if (_gselect) {
+      _gselect->write(&props["gselect"]);
+    }
     *dest = props;
   }
 
@@ -243,10 +353,12 @@ namespace spin {
     }
 
     recompute_logZs();
+    _gselect.reset(); // shortlists are no longer valid
   }
 
   
   void diagonal_GMM_parameter::split_all_components(int s, float deltafac) {
+    _gselect.reset(); // shortlists are no longer valid
     int oldM = _states[s].logweights.size();
     for (int m = 0; m < oldM; ++ m) {
       _states[s].logweights(m) = _states[s].logweights(m) - M_LOG2;
@@ -273,7 +385,12 @@ namespace spin {
   }
 
   diagonal_GMM_scorer::diagonal_GMM_scorer(diagonal_GMM_parameter_ptr param) 
-    : _parameter(param) {
+    : _parameter(param), _compiled(new compiled_diagonal_GMM(*param)),
+      _gselect_floor(-HUGE_VALF), _latest(-1),
+      _score_cache(param->nstates()),
+      _batchsize(16) {
+    INFO("Diagonal GMM scorer uses %s kernel",
+         compiled_diagonal_GMM::kernel_name());
   }
 
   inline fmatrix bind_vectors(int dim, const std::vector<int>& ids,
@@ -317,37 +434,159 @@ namespace spin {
 
 
   void diagonal_GMM_scorer::set_frames(const fmatrix& f) {
-    _input_buffer = f;
-    _score_cache = fmatrix::Constant(this->nstates(), f.cols(), std::nanf(""));
+    _input_buffer.reset(f);
+    _latest = -1;
+    _score_cache.reset();
   }
 
+  void diagonal_GMM_scorer::append_frames(const fmatrix& f) {
+    if (_latest >= 0) {
+      _input_buffer.discard_before(_latest - _score_cache.window() + 1);
+    }
+    _input_buffer.append(f);
+  }
 
   float diagonal_GMM_scorer::get_score(int t, int s) {
-    if (! std::isnan(_score_cache(s, t))) {
-      return _score_cache(s, t);
-    }
-    if (t < 0 || t >= _input_buffer.cols()) 
+    if (! _input_buffer.contains(t))
       throw std::runtime_error("Input range error");
     if (s < 0 || s >= _parameter->nstates())
       throw std::runtime_error("State range error");
+    _latest = std::max(_latest, t);
+    if (_score_cache.contains(t, s)) {
+      return _score_cache.get(t, s);
+    }
 
-    static int batchsize = 16;
-    int bs = std::min(static_cast<int>(t + batchsize),
-                      static_cast<int>(_input_buffer.cols())) - t;
-    size_t D = _input_buffer.rows();
+    int bs = std::min(t + _batchsize, _input_buffer.end_frame()) - t;
+    _pending.assign(1, s);
+    compute_scores(t, bs, _pending);
+    return _score_cache.get(t, s);
+  }
 
-    fmatrix glogll;
-    _parameter->get_gaussian_scores<float>(_input_buffer.block(0, t, D, bs),
-                                           _parameter->means(s),
-                                           _parameter->sqrtprecs(s),
-                                           _parameter->logzs(s),
-                                           &glogll);
-    glogll.colwise() += _parameter->logweights(s);
-    _score_cache.block(s, t, 1, bs) = log_sum_exp(glogll);
-    return _score_cache(s, t);
+  void diagonal_GMM_scorer::enable_gaussian_selection(float floor) {
+    _gselect = _parameter->gselect();
+    if (! _gselect) {
+      throw std::runtime_error("GMM doesn't have a Gaussian selection table");
+    }
+    _gselect_floor = floor;
+    INFO("Gaussian selection enabled (%d codewords)",
+         static_cast<int>(_gselect->ncodewords()));
+  }
+
+  void diagonal_GMM_scorer::set_num_threads(int nthreads,
+                                            int nframes_ahead) {
+    if (nthreads > 1) {
+      _pool.reset(new worker_pool(nthreads));
+      _batchsize = std::max(1, std::min(nframes_ahead,
+                                        _score_cache.window()));
+    } else {
+      _pool.reset();
+      _batchsize = 16;
+    }
+  }
+
+  void diagonal_GMM_scorer::compute_scores(int t, int nframes,
+                                           const std::vector<int>& states) {
+    fmatrix feats = _input_buffer.frames(t, nframes);
+    // contiguous ranges of states, a few per thread for load balancing
+    int nparts = 1;
+    if (_pool) {
+      nparts = std::min(static_cast<int>(states.size()) / 4,
+                        _pool->size() * 4);
+      nparts = std::max(nparts, 1);
+    }
+    _part_states.resize(nparts);
+    _part_scores.resize(nparts);
+    for (int p = 0; p < nparts; ++ p) {
+      _part_states[p].assign(states.begin() + states.size() * p / nparts,
+                             states.begin() + states.size() * (p + 1) / nparts);
+    }
+    auto score_part = [&](int p) {
+      _compiled->get_scores(feats, _part_states[p], &_part_scores[p],
+                            _gselect.get(), _gselect_floor);
+    };
+    if (nparts > 1) {
+      _pool->run(nparts, score_part);
+    } else {
+      score_part(0);
+    }
+
+    for (int p = 0; p < nparts; ++ p) {
+      const std::vector<int>& part = _part_states[p];
+      for (int n = 0; n < part.size(); ++ n) {
+        for (int f = 0; f < nframes; ++ f) {
+          _score_cache.set(t + f, part[n], _part_scores[p](n, f));
+        }
+      }
+    }
+  }
+
+  void diagonal_GMM_scorer::find_pending(int t, int nframes,
+                                         const std::vector<int>& states) {
+    _pending.assign(states.begin(), states.end());
+    std::sort(_pending.begin(), _pending.end());
+    _pending.erase(std::unique(_pending.begin(), _pending.end()),
+                   _pending.end());
+    auto last = std::remove_if(_pending.begin(), _pending.end(), [&](int s) {
+        if (s < 0 || s >= _parameter->nstates())
+          throw std::runtime_error("State range error");
+        for (int f = 0; f < nframes; ++ f) {
+          if (! _score_cache.contains(t + f, s)) return false;
+        }
+        return true;
+      });
+    _pending.erase(last, _pending.end());
+  }
+
+  void diagonal_GMM_scorer::get_scores(int t, const std::vector<int>& states,
+                                       float* out) {
+    if (! _input_buffer.contains(t))
+      throw std::runtime_error("Input range error");
+    _latest = std::max(_latest, t);
+
+    find_pending(t, 1, states);
+    if (! _pending.empty()) {
+      int bs = std::min(t + _batchsize, _input_buffer.end_frame()) - t;
+      compute_scores(t, bs, _pending);
+    }
+    for (int n = 0; n < states.size(); ++ n) {
+      out[n] = _score_cache.get(t, states[n]);
+    }
+  }
+
+  void diagonal_GMM_scorer::get_scores(int t, int nframes,
+                                       const std::vector<int>& states,
+                                       float* out) {
+    if (nframes < 0 || t < _input_buffer.begin_frame() ||
+        t + nframes > _input_buffer.end_frame())
+      throw std::runtime_error("Input range error");
+    if (nframes > 0) _latest = std::max(_latest, t + nframes - 1);
+
+    // the range is split so that each part fits in the cache window
+    for (int t0 = t; t0 < t + nframes; t0 += _score_cache.window()) {
+      int n = std::min(_score_cache.window(), t + nframes - t0);
+      find_pending(t0, n, states);
+      if (! _pending.empty()) {
+        compute_scores(t0, n, _pending);
+      }
+      for (int f = t0 - t; f < t0 - t + n; ++ f) {
+        for (int k = 0; k < states.size(); ++ k) {
+          out[f * states.size() + k] = _score_cache.get(t + f, states[k]);
+        }
+      }
+    }
   }
 
   size_t diagonal_GMM_scorer::nstates() const {
     return _parameter->nstates();
   }
+
+  std::shared_ptr<frame_scorer> diagonal_GMM_scorer::fork() const {
+    // copies share the parameter and the compiled layout
+    std::shared_ptr<diagonal_GMM_scorer> ret(new diagonal_GMM_scorer(*this));
+    ret->_input_buffer = sliding_frame_buffer();
+    ret->_latest = -1;
+    ret->_score_cache.reset();
+    if (_pool) ret->_pool.reset(new worker_pool(_pool->size()));
+    return ret;
+  }
 }
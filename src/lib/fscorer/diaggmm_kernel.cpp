@@ -0,0 +1,162 @@
+#include <spin/fscorer/diaggmm_kernel.hpp>
+#include <spin/fscorer/diaggmm.hpp>
+#include <spin/fscorer/gselect.hpp>
+#include <cmath>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+namespace spin {
+
+  namespace {
+    const int padding = 16;
+
+#if defined(__AVX512F__)
+    inline float quadratic_form(const float* x, const float* x2h,
+                                const float* mp, const float* p, int n) {
+      __m512 acc = _mm512_setzero_ps();
+      for (int d = 0; d < n; d += 16) {
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(x2h + d),
+                              _mm512_loadu_ps(p + d), acc);
+        acc = _mm512_fmadd_ps(_mm512_loadu_ps(x + d),
+                              _mm512_loadu_ps(mp + d), acc);
+      }
+      return _mm512_reduce_add_ps(acc);
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    inline float quadratic_form(const float* x, const float* x2h,
+                                const float* mp, const float* p, int n) {
+      __m256 acc0 = _mm256_setzero_ps();
+      __m256 acc1 = _mm256_setzero_ps();
+      for (int d = 0; d < n; d += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x2h + d),
+                               _mm256_loadu_ps(p + d), acc0);
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(x + d),
+                               _mm256_loadu_ps(mp + d), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x2h + d + 8),
+                               _mm256_loadu_ps(p + d + 8), acc1);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(x + d + 8),
+                               _mm256_loadu_ps(mp + d + 8), acc1);
+      }
+      __m256 acc = _mm256_add_ps(acc0, acc1);
+      __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc),
+                              _mm256_extractf128_ps(acc, 1));
+      sum = _mm_hadd_ps(sum, sum);
+      sum = _mm_hadd_ps(sum, sum);
+      return _mm_cvtss_f32(sum);
+    }
+#else
+    inline float quadratic_form(const float* x, const float* x2h,
+                                const float* mp, const float* p, int n) {
+      float acc = 0.0;
+      for (int d = 0; d < n; ++ d) {
+        acc += x2h[d] * p[d] + x[d] * mp[d];
+      }
+      return acc;
+    }
+#endif
+  }
+
+  const char* compiled_diagonal_GMM::kernel_name() {
+#if defined(__AVX512F__)
+    return "AVX-512";
+#elif defined(__AVX2__) && defined(__FMA__)
+    return "AVX2";
+#else
+    return "scalar";
+#endif
+  }
+
+  void compiled_diagonal_GMM::compile(const diagonal_GMM_parameter& param) {
+    _ndim = param.nfeatures();
+    _stride = (_ndim + padding - 1) / padding * padding;
+    const std::vector<diagonal_GMM_statedef>& defs = param.statedefs();
+
+    _offsets.assign(1, 0);
+    for (int s = 0; s < defs.size(); ++ s) {
+      _offsets.push_back(_offsets.back() + defs[s].mean_ids.size());
+    }
+    int ngauss = _offsets.back();
+    _precs.assign(ngauss * _stride, 0.0);
+    _mprecs.assign(ngauss * _stride, 0.0);
+    _consts.resize(ngauss);
+
+    for (int s = 0; s < defs.size(); ++ s) {
+      for (int m = 0; m < defs[s].mean_ids.size(); ++ m) {
+        int g = _offsets[s] + m;
+        auto mean = param.means().col(defs[s].mean_ids[m]);
+        auto sqrtprec = param.sqrtprecs().col(defs[s].var_ids[m]);
+        double mterm = 0.0;
+        for (int d = 0; d < _ndim; ++ d) {
+          double prec = static_cast<double>(sqrtprec(d)) * sqrtprec(d);
+          _precs[g * _stride + d] = prec;
+          _mprecs[g * _stride + d] = mean(d) * prec;
+          mterm += mean(d) * mean(d) * prec;
+        }
+        _consts[g] = defs[s].logweights(m)
+          - param.logzs()(defs[s].var_ids[m]) - 0.5 * mterm;
+      }
+    }
+  }
+
+  void compiled_diagonal_GMM::get_mixture_scores(int s, const float* x,
+                                                 const float* x2h,
+                                                 float* dest) const {
+    for (int g = _offsets[s], last = _offsets[s + 1]; g < last; ++ g) {
+      *(dest ++) = _consts[g] +
+        quadratic_form(x, x2h, &_mprecs[g * _stride], &_precs[g * _stride],
+                       _stride);
+    }
+  }
+
+  void compiled_diagonal_GMM::get_scores(const fmatrix& feats,
+                                         const std::vector<int>& states,
+                                         fmatrix* dest,
+                                         const gaussian_selection* gselect,
+                                         float floor) const {
+    if (feats.rows() != _ndim) {
+      throw std::runtime_error("Feature dimensionality mismatch");
+    }
+    dest->resize(states.size(), feats.cols());
+
+    int maxmixt = 0;
+    for (int n = 0; n < states.size(); ++ n) {
+      maxmixt = std::max(maxmixt, static_cast<int>(nmixtures(states[n])));
+    }
+    std::vector<float> x(_stride, 0.0), x2h(_stride, 0.0), mixt(maxmixt + 1);
+
+    for (int t = 0; t < feats.cols(); ++ t) {
+      for (int d = 0; d < _ndim; ++ d) {
+        x[d] = feats(d, t);
+        x2h[d] = -0.5 * x[d] * x[d];
+      }
+      int c = gselect ? gselect->find_codeword(&x[0]) : -1;
+      for (int n = 0; n < states.size(); ++ n) {
+        int s = states[n];
+        int M = nmixtures(s);
+        if (gselect) {
+          auto list = gselect->shortlist(c, s);
+          M = 0;
+          for (auto it = list.first; it != list.second; ++ it) {
+            int g = _offsets[s] + *it;
+            mixt[M ++] = _consts[g] +
+              quadratic_form(&x[0], &x2h[0], &_mprecs[g * _stride],
+                             &_precs[g * _stride], _stride);
+          }
+          if (floor > -HUGE_VALF) {
+            mixt[M ++] = floor + gselect->rest_logweight(c, s);
+          }
+        } else {
+          get_mixture_scores(s, &x[0], &x2h[0], &mixt[0]);
+        }
+
+        // log-sum-exp over the mixtures
+        float maxc = -HUGE_VALF;
+        for (int m = 0; m < M; ++ m) maxc = std::max(maxc, mixt[m]);
+        float sum = 0.0;
+        for (int m = 0; m < M; ++ m) sum += std::exp(mixt[m] - maxc);
+        (*dest)(n, t) = std::log(sum) + maxc;
+      }
+    }
+  }
+}
@@ -0,0 +1,136 @@
+#include <spin/fscorer/gselect.hpp>
+#include <spin/fscorer/diaggmm.hpp>
+#include <gear/io/logging.hpp>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+namespace spin {
+
+  void gaussian_selection::build(const diagonal_GMM_parameter& param,
+                                 int ncodewords, int nshortlist, int niter) {
+    const fmatrix& means = param.means();
+    int D = means.rows();
+    int G = means.cols();
+    if (G == 0) throw std::runtime_error("GMM has no Gaussian");
+    if (ncodewords < 1 || nshortlist < 1)
+      throw std::runtime_error("Codebook and shortlist must not be empty");
+    int K = std::min(ncodewords, G);
+
+    _dimweights = param.sqrtprecs().array().square().matrix()
+      .rowwise().mean();
+
+    // k-means over the Gaussian means, initialized with evenly spaced means
+    _codebook.resize(D, K);
+    for (int k = 0; k < K; ++ k) {
+      _codebook.col(k) = means.col(static_cast<long>(k) * G / K);
+    }
+    std::vector<int> assign(G, -1);
+    for (int iter = 0; iter < niter; ++ iter) {
+      int nchanged = 0;
+      for (int g = 0; g < G; ++ g) {
+        int k = find_codeword(&means(0, g));
+        if (k != assign[g]) ++ nchanged;
+        assign[g] = k;
+      }
+      fmatrix sums = fmatrix::Zero(D, K);
+      fvector counts = fvector::Zero(K);
+      for (int g = 0; g < G; ++ g) {
+        sums.col(assign[g]) += means.col(g);
+        counts(assign[g]) += 1.0;
+      }
+      for (int k = 0; k < K; ++ k) {
+        if (counts(k) > 0) _codebook.col(k) = sums.col(k) / counts(k);
+      }
+      INFO("VQ iteration %d: %d assignments changed", iter, nchanged);
+      if (nchanged == 0) break;
+    }
+
+    // shortlist of each state for each codeword
+    compiled_diagonal_GMM compiled(param);
+    _nstates = param.nstates();
+    int stride = (D + 15) / 16 * 16;
+    std::vector<float> x(stride, 0.0), x2h(stride, 0.0);
+    std::vector<float> scores;
+    std::vector<int> order;
+    _offsets.assign(1, 0);
+    _mixtures.clear();
+    _rest_logweights.clear();
+    for (int k = 0; k < K; ++ k) {
+      for (int d = 0; d < D; ++ d) {
+        x[d] = _codebook(d, k);
+        x2h[d] = -0.5 * x[d] * x[d];
+      }
+      for (int s = 0; s < _nstates; ++ s) {
+        const diagonal_GMM_statedef& def = param.statedefs()[s];
+        int M = compiled.nmixtures(s);
+        scores.resize(M);
+        compiled.get_mixture_scores(s, &x[0], &x2h[0], &scores[0]);
+        order.resize(M);
+        std::iota(order.begin(), order.end(), 0);
+        int N = std::min(nshortlist, M);
+        std::partial_sort(order.begin(), order.begin() + N, order.end(),
+                          [&](int a, int b) { return scores[a] > scores[b]; });
+        std::sort(order.begin(), order.begin() + N);
+        _mixtures.insert(_mixtures.end(), order.begin(), order.begin() + N);
+        _offsets.push_back(_mixtures.size());
+
+        float rest = 0.0;
+        for (int m = N; m < M; ++ m) rest += std::exp(def.logweights(order[m]));
+        _rest_logweights.push_back(std::log(rest));
+      }
+    }
+  }
+
+  int gaussian_selection::find_codeword(const float* x) const {
+    int best = -1;
+    float bestdist = HUGE_VALF;
+    int D = _codebook.rows();
+    for (int k = 0; k < _codebook.cols(); ++ k) {
+      float dist = 0.0;
+      for (int d = 0; d < D; ++ d) {
+        float diff = x[d] - _codebook(d, k);
+        dist += diff * diff * _dimweights(d);
+      }
+      if (dist < bestdist) {
+        bestdist = dist;
+        best = k;
+      }
+    }
+    return best;
+  }
+
+  void gaussian_selection::read(const variant_t& src) {
+    const variant_map& map = boost::get<variant_map>(src);
+    _codebook = get_prop<fmatrix>(map, "codebook");
+    _dimweights = get_prop<fmatrix>(map, "dimweights").col(0);
+    _nstates = get_prop<int>(map, "nstates");
+    const intmatrix& offsets = get_prop<intmatrix>(map, "offsets");
+    const intmatrix& mixtures = get_prop<intmatrix>(map, "mixtures");
+    const fmatrix& rests = get_prop<fmatrix>(map, "restweights");
+    _offsets.assign(offsets.data(), offsets.data() + offsets.size());
+    _mixtures.assign(mixtures.data(), mixtures.data() + mixtures.size());
+    _rest_logweights.assign(rests.data(), rests.data() + rests.size());
+    if (_offsets.size() != _codebook.cols() * _nstates + 1 ||
+        _rest_logweights.size() != _codebook.cols() * _nstates) {
+      throw std::runtime_error("Inconsistent Gaussian selection table");
+    }
+  }
+
+  void gaussian_selection::write(variant_t* dest) const {
+    variant_map props;
+    props["codebook"] = _codebook;
+    props["dimweights"] = fmatrix(_dimweights);
+    props["nstates"] = _nstates;
+    props["offsets"] = intmatrix(Eigen::Map<const intmatrix>(_offsets.data(),
+                                                             _offsets.size(),
+                                                             1));
+    props["mixtures"] = intmatrix(Eigen::Map<const intmatrix>(_mixtures.data(),
+                                                              _mixtures.size(),
+                                                              1));
+    props["restweights"] =
+      fmatrix(Eigen::Map<const fmatrix>(_rest_logweights.data(),
+                                        _rest_logweights.size(), 1));
+    *dest = props;
+  }
+}
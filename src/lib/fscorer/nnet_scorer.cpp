@@ -3,36 +3,71 @@
 #include <spin/utils.hpp>
 #include <gear/io/logging.hpp>
 #include <spin/nnet/ident.hpp>
+#include <algorithm>
 
 namespace spin {
   nnet_scorer::nnet_scorer(std::shared_ptr<nnet> param) 
-    : _parameter(param), _nnet_config(new nnet_config(*param)) {
+    : _parameter(param), _nnet_config(new nnet_config(*param)), _latest(-1) {
     _context.reset(new nnet_context(*_parameter, 1, 2048));
   }
 
   void nnet_scorer::set_frames(const fmatrix& f) {
-    _feed_forward_done = false;
-    if (f.cols() > 2048) {
-      throw std::runtime_error("Not implemented");
-    }
-    _context->get("input")->get_output().load(0, f);
-    _context->set_forward_stream_flag(_parameter->get_node_location("input"),
-                                      true);
+    _input_buffer.reset(f);
+    _score.clear();
+    _latest = -1;
   }
 
-  float nnet_scorer::get_score(int t, int s) {
-    if (! _feed_forward_done) {
+  void nnet_scorer::append_frames(const fmatrix& f) {
+    if (_latest >= 0) _score.discard_before(_latest - history);
+    _input_buffer.append(f);
+  }
+
+  void nnet_scorer::feed_forward() {
+    // frames not scored yet are fed in batches that fit in the context, and
+    // dropped once scored
+    static const int maxbatchsize = 2048;
+    while (_input_buffer.size() > 0) {
+      int t = _input_buffer.begin_frame();
+      int n = std::min(maxbatchsize, _input_buffer.size());
+      _context->get("input")->get_output().load(0,
+                                                _input_buffer.frames(t, n));
+      _context->set_forward_stream_flag(_parameter->get_node_location("input"),
+                                        true);
       _parameter->feed_forward(*_nnet_config, _context.get());
-      _score.resize(_context->get("output")->get_input().ndim(),
+
+      fmatrix batch(_context->get("output")->get_input().ndim(),
                     _context->get("output")->get_input().size(0));
       viennacl::copy(NNET_BATCH(_context->get("output")->get_input(), 0),
-                     _score);
-      _feed_forward_done = true;
+                     batch);
+      _score.append(batch);
+      _input_buffer.discard_before(t + n);
     }
+  }
+
+  void nnet_scorer::check_range(int t) {
+    feed_forward();
+    if (! _score.contains(t)) throw std::runtime_error("Input range error");
+    _latest = std::max(_latest, t);
+  }
 
+  float nnet_scorer::get_score(int t, int s) {
+    check_range(t);
     return _score(s, t);
   }
 
+  void nnet_scorer::get_scores(int t, const std::vector<int>& states,
+                               float* out) {
+    check_range(t);
+    for (int n = 0; n < states.size(); ++ n) {
+      out[n] = _score(states[n], t);
+    }
+  }
+
+  std::shared_ptr<frame_scorer> nnet_scorer::fork() const {
+    // the network is shared, the context holding activations is not
+    return std::shared_ptr<frame_scorer>(new nnet_scorer(_parameter));
+  }
+
   size_t nnet_scorer::nstates() const {
     auto p = _parameter->node("output");
     auto pident = std::dynamic_pointer_cast<const nnet_node_ident>(p);
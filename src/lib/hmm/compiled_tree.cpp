@@ -0,0 +1,94 @@
+#include <spin/hmm/compiled_tree.hpp>
+#include <spin/parallel.hpp>
+#include <gear/io/logging.hpp>
+#include <algorithm>
+
+namespace spin {
+  compiled_decision_tree::compiled_decision_tree(
+      const context_decision_tree& tree)
+    : _nphones(0),
+      _npositions(tree.left_context_length() + tree.right_context_length()
+                  + 1) {
+    if (_npositions > packed_context::MAX_POSITIONS) {
+      throw std::runtime_error("Context is too long to be compiled");
+    }
+    // questions intern the phones of their categories when they are read,
+    // so every phone of the bitsets has its ID already
+    _nphones = phone_table::size();
+    std::map<std::string, int> mask_offsets;
+    lower(tree, tree.root(), &mask_offsets);
+    INFO("Compiled decision tree: %d nodes, %d category masks",
+         static_cast<int>(_nodes.size()),
+         static_cast<int>(mask_offsets.size()));
+  }
+
+  int compiled_decision_tree::lower(const context_decision_tree& tree,
+                                    const context_decision_tree_node* src,
+                                    std::map<std::string, int>* mask_offsets) {
+    int id = _nodes.size();
+    _nodes.push_back(node());
+    node cur;
+    cur.mask = -1;
+    cur.is_true = cur.is_false = -1;
+    if (src->is_leaf) {
+      cur.type = LEAF;
+      cur.arg = src->value;
+      _nodes[id] = cur;
+      return id;
+    }
+
+    const tree_question* q = src->question.get();
+    if (const context_question* cq = dynamic_cast<const context_question*>(q)) {
+      cur.type = CONTEXT;
+      cur.arg = tree.left_context_length() + cq->target();
+      if (cur.arg < 0 || cur.arg >= _npositions) {
+        throw std::runtime_error("question error");
+      }
+      auto mit = mask_offsets->find(cq->category_name());
+      if (mit == mask_offsets->end()) {
+        int nwords = _nphones / 64 + 1;
+        int offset = _masks.size();
+        _masks.resize(offset + nwords, 0);
+        const std::set<std::string>& category =
+          tree.category(cq->category_name());
+        for (auto it = category.cbegin(), last = category.cend();
+             it != last; ++ it) {
+          int phone = phone_table::find(*it);
+          if (phone < 0 || phone >= _nphones) continue;
+          _masks[offset + phone / 64] |= uint64_t(1) << (phone % 64);
+        }
+        mit = mask_offsets->insert(std::make_pair(cq->category_name(),
+                                                  offset)).first;
+      }
+      cur.mask = mit->second;
+    } else if (const location_question* lq =
+               dynamic_cast<const location_question*>(q)) {
+      cur.type = LOCATION;
+      cur.arg = lq->location();
+    } else {
+      throw std::runtime_error("Unknown question type in decision tree");
+    }
+
+    // true branches are laid out right after their parents
+    cur.is_true = src->is_true ? lower(tree, src->is_true, mask_offsets) : -1;
+    cur.is_false = src->is_false ? lower(tree, src->is_false, mask_offsets)
+      : -1;
+    _nodes[id] = cur;
+    return id;
+  }
+
+  void compiled_decision_tree::resolve_many(const packed_context* ctxs,
+                                            size_t n, int* dest,
+                                            worker_pool* pool) const {
+    int njobs = pool ? std::min<int>(pool->size(), n / 1024 + 1) : 1;
+    auto resolve_part = [&](int k) {
+      size_t begin = n * k / njobs, end = n * (k + 1) / njobs;
+      for (size_t i = begin; i < end; ++ i) dest[i] = resolve(ctxs[i]);
+    };
+    if (pool && njobs > 1) {
+      pool->run(njobs, resolve_part);
+    } else {
+      resolve_part(0);
+    }
+  }
+}
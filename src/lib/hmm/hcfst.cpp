@@ -0,0 +1,253 @@
+#include <spin/hmm/hcfst.hpp>
+#include <spin/hmm/compiled_tree.hpp>
+#include <spin/io/fst.hpp>
+#include <gear/io/logging.hpp>
+#include <deque>
+#include <unordered_map>
+
+namespace spin {
+  namespace {
+    packed_context make_key(const std::vector<int>& labels, size_t begin,
+                            size_t end) {
+      packed_context key;
+      for (size_t p = begin; p < end; ++ p) {
+        key.set_phone(p - begin, labels[p]);
+      }
+      return key;
+    }
+  }
+
+  phone_pair_license::phone_pair_license()
+    : _boundary(phone_table::intern("")) {
+    _initial.insert(_boundary);
+    _final.insert(_boundary);
+  }
+
+  void phone_pair_license::add_pair(const std::string& a,
+                                    const std::string& b) {
+    _pairs.insert(pair_key(phone_table::intern(a), phone_table::intern(b)));
+  }
+
+  void
+  phone_pair_license::add_pronunciation(const std::vector<std::string>& phones) {
+    if (phones.empty()) return;
+    int prev = phone_table::intern(phones[0]);
+    _initial.insert(prev);
+    for (size_t i = 1; i < phones.size(); ++ i) {
+      int cur = phone_table::intern(phones[i]);
+      _pairs.insert(pair_key(prev, cur));
+      prev = cur;
+    }
+    _final.insert(prev);
+  }
+
+  bool phone_pair_license::licensed(const std::vector<int>& window) const {
+    // boundaries may only precede or follow the phones
+    size_t begin = 0, end = window.size();
+    while (begin < end && window[begin] == _boundary) ++ begin;
+    while (end > begin && window[end - 1] == _boundary) -- end;
+    if (begin == end) return false;
+    for (size_t i = begin + 1; i < end; ++ i) {
+      if (window[i] == _boundary || ! allowed(window[i - 1], window[i])) {
+        return false;
+      }
+    }
+    if (begin > 0 && ! allowed(_boundary, window[begin])) return false;
+    if (end < window.size() && ! allowed(window[end - 1], _boundary)) {
+      return false;
+    }
+    return true;
+  }
+
+  void context_whitelist::add(const std::vector<std::string>& window) {
+    if (window.size() > packed_context::MAX_POSITIONS) {
+      throw std::runtime_error("Context is too long to be packed");
+    }
+    packed_context key;
+    for (size_t p = 0; p < window.size(); ++ p) {
+      key.set_phone(p, phone_table::intern(window[p]));
+    }
+    _windows.insert(key);
+  }
+
+  void context_whitelist::add(const packed_context& ctx) {
+    packed_context key;
+    int n = ctx.npositions();
+    for (int p = 0; p < n; ++ p) key.set_phone(p, ctx.phone(p));
+    _windows.insert(key);
+  }
+
+  bool context_whitelist::licensed(const std::vector<int>& window) const {
+    return _windows.count(make_key(window, 0, window.size())) > 0;
+  }
+
+  void build_HC_FST(const context_decision_tree& tree, int nstate,
+                    const std::vector<std::string>& disamb,
+                    const context_license& license,
+                    fst::StdVectorFst* dest) {
+    int L = tree.left_context_length(), R = tree.right_context_length();
+    compiled_decision_tree compiled(tree);
+
+    std::set<std::string> labset;
+    tree.obtain_label_set(&labset);
+    labset.insert("");
+    std::vector<int> labs;
+    for (auto it = labset.cbegin(), last = labset.cend(); it != last; ++ it) {
+      labs.push_back(phone_table::intern(*it));
+    }
+    int boundary = phone_table::intern("");
+    for (auto it = disamb.cbegin(), last = disamb.cend(); it != last; ++ it) {
+      if (it->size() == 0) {
+        ERROR("Empty disambiguation symbol is not allowed");
+        throw std::runtime_error("Empty disambiguation symbol is not allowed");
+      }
+    }
+
+    fst::StdVectorFst& fst = *dest;
+    fst::SymbolTable isym, osym;
+    isym.AddSymbol("<eps>", 0);
+    osym.AddSymbol("<eps>", 0);
+    int start_state = fst.AddState();
+    fst.SetStart(start_state);
+    int final_state = fst.AddState();
+    fst.SetFinal(final_state, fst::TropicalWeight::One());
+
+    // context states are keyed by the L + R labels of the window
+    std::unordered_map<packed_context, int, packed_context_hash> states;
+    std::deque<std::pair<int, std::vector<int> > > queue;
+    auto get_state = [&](const std::vector<int>& window, int begin) -> int {
+      packed_context key = make_key(window, begin, begin + L + R);
+      auto it = states.find(key);
+      if (it != states.end()) return it->second;
+      int id = fst.AddState();
+      states.insert(std::make_pair(key, id));
+      queue.push_back(std::make_pair(id, std::vector<int>(window.begin() + begin,
+                                                          window.begin() + begin
+                                                          + L + R)));
+      bool is_final = true;
+      for (int p = begin + L; p < begin + L + R; ++ p) {
+        if (window[p] != boundary) is_final = false;
+      }
+      if (is_final) {
+        fst.AddArc(id, fst::StdArc(0, 0, fst::TropicalWeight::One(),
+                                   final_state));
+      }
+      return id;
+    };
+
+    // initial states: L boundaries followed by any R labels that can
+    // begin a licensed window.  The all-boundary context is not included,
+    // so the empty phone sequence is rejected as in create_HC_FST().
+    std::vector<int> window(L + R + 1, boundary);
+    std::vector<size_t> digits(R, 0);
+    for (bool done = false; ! done; ) {
+      for (int p = 0; p < R; ++ p) window[L + p] = labs[digits[p]];
+      for (size_t x = 0; x < labs.size(); ++ x) {
+        window[L + R] = labs[x];
+        if (window[L] != boundary && license.licensed(window)) {
+          fst.AddArc(start_state,
+                     fst::StdArc(0, 0, fst::TropicalWeight::One(),
+                                 get_state(window, 0)));
+          break;
+        }
+      }
+      done = true;
+      for (int p = R - 1; p >= 0; -- p) {
+        if (++ digits[p] < labs.size()) {
+          done = false;
+          break;
+        }
+        digits[p] = 0;
+      }
+    }
+
+    std::unordered_map<uint64_t, int> ilabels; // (leaf, center, loc)
+    std::unordered_map<uint64_t, int> chains; // (state, ilabel) -> state
+    std::unordered_set<int> disamb_loop_added;
+    std::vector<int> successors, leaves;
+    std::vector<packed_context> ctxs;
+    while (! queue.empty()) {
+      int prevst = queue.front().first;
+      window = queue.front().second;
+      queue.pop_front();
+      window.push_back(boundary);
+
+      successors.clear();
+      ctxs.clear();
+      for (size_t x = 0; x < labs.size(); ++ x) {
+        window[L + R] = labs[x];
+        if (window[L] == boundary || ! license.licensed(window)) continue;
+        successors.push_back(labs[x]);
+        packed_context key = make_key(window, 0, L + R + 1);
+        for (int loc = 0; loc < nstate; ++ loc) {
+          key.set_location(loc);
+          ctxs.push_back(key);
+        }
+      }
+      compiled.resolve_many(ctxs, &leaves);
+
+      for (size_t k = 0; k < successors.size(); ++ k) {
+        window[L + R] = successors[k];
+        int center = window[L];
+        std::string centlabel = phone_table::name(center);
+
+        int prev = prevst;
+        for (int loc = 0; loc < nstate; ++ loc) {
+          int st = leaves[k * nstate + loc];
+          uint64_t lkey = (uint64_t(st) << 32) | (uint64_t(center) << 16) | loc;
+          auto lit = ilabels.find(lkey);
+          if (lit == ilabels.end()) {
+            int ilabel = prepare_label(&isym,
+                                       "S" + boost::lexical_cast<std::string>(st)
+                                       + ";" + centlabel + ";"
+                                       + boost::lexical_cast<std::string>(loc));
+            lit = ilabels.insert(std::make_pair(lkey, ilabel)).first;
+          }
+          uint64_t ckey = (uint64_t(prev) << 32) | lit->second;
+          auto cit = chains.find(ckey);
+          if (cit == chains.end()) {
+            int next = fst.AddState();
+            int olabel = (loc == 0) ? prepare_label(&osym, centlabel) : 0;
+            fst.AddArc(prev,
+                       fst::StdArc(lit->second, olabel,
+                                   fst::TropicalWeight::One(), next));
+            cit = chains.insert(std::make_pair(ckey, next)).first;
+          }
+          prev = cit->second;
+        }
+
+        // Phone boundary
+        int nextst = get_state(window, 1);
+        fst.AddArc(prev,
+                   fst::StdArc(prepare_label(&isym, "#]" + centlabel), 0,
+                               fst::TropicalWeight::One(), nextst));
+
+        // Consume disambiguators
+        if (disamb_loop_added.insert(nextst).second) {
+          for (auto it = disamb.cbegin(), last = disamb.cend();
+               it != last; ++ it) {
+            int ilabel = prepare_label(&isym, *it);
+            int olabel = prepare_label(&osym, *it);
+            fst.AddArc(nextst,
+                       fst::StdArc(ilabel, olabel,
+                                   fst::TropicalWeight::One(), nextst));
+          }
+        }
+      }
+    }
+    INFO("HC FST: %d context states, %d HMM states",
+         static_cast<int>(states.size()), static_cast<int>(chains.size()));
+
+    fst.SetInputSymbols(&isym);
+    fst.SetOutputSymbols(&osym);
+  }
+
+  fst::script::VectorFstClass
+  create_HC_FST(const context_decision_tree& tree, int nstate,
+                const std::vector<std::string>& disamb,
+                const context_license& license) {
+    fst::StdVectorFst fst;
+    build_HC_FST(tree, nstate, disamb, license, &fst);
+    return fst::script::VectorFstClass(fst);
+  }
+}
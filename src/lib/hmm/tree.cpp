@@ -1,10 +1,63 @@
 #include <spin/hmm/tree.hpp>
+#include <spin/hmm/compiled_tree.hpp>
 #include <spin/io/yaml.hpp>
 #include <spin/utils.hpp>
 
 #include <gear/io/logging.hpp>
+#include <deque>
+#include <mutex>
+#include <unordered_map>
 
 namespace spin {
+  namespace {
+    struct phone_table_storage {
+      std::mutex mutex;
+      std::unordered_map<std::string, int> ids;
+      std::deque<std::string> names;
+    };
+
+    phone_table_storage& get_phone_table() {
+      static phone_table_storage table;
+      return table;
+    }
+  }
+
+  int phone_table::intern(const std::string& phone) {
+    phone_table_storage& table = get_phone_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    auto it = table.ids.find(phone);
+    if (it != table.ids.end()) return it->second;
+    int id = table.names.size();
+    if (id >= MAX_PHONES) {
+      throw std::runtime_error("Too many phone symbols");
+    }
+    table.ids.insert(std::make_pair(phone, id));
+    table.names.push_back(phone);
+    return id;
+  }
+
+  int phone_table::find(const std::string& phone) {
+    phone_table_storage& table = get_phone_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    auto it = table.ids.find(phone);
+    return it == table.ids.end() ? -1 : it->second;
+  }
+
+  std::string phone_table::name(int id) {
+    phone_table_storage& table = get_phone_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    if (id < 0 || id >= static_cast<int>(table.names.size())) {
+      throw std::runtime_error("Invalid phone ID");
+    }
+    return table.names[id];
+  }
+
+  int phone_table::size() {
+    phone_table_storage& table = get_phone_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    return table.names.size();
+  }
+
 
   std::string HMM_context::to_string() const {
     return boost::algorithm::join(label, " ")
@@ -16,6 +69,28 @@ namespace spin {
     loc = boost::lexical_cast<int>(label.back());
     label.pop_back();
   }
+
+  packed_context HMM_context::pack() const {
+    if (label.size() > packed_context::MAX_POSITIONS) {
+      throw std::runtime_error("Context is too long to be packed");
+    }
+    packed_context key;
+    for (size_t p = 0; p < label.size(); ++ p) {
+      key.set_phone(p, phone_table::intern(label[p]));
+    }
+    key.set_location(loc);
+    return key;
+  }
+
+  HMM_context HMM_context::unpack(const packed_context& key) {
+    HMM_context ctx;
+    int n = key.npositions();
+    for (int p = 0; p < n; ++ p) {
+      ctx.label.push_back(phone_table::name(key.phone(p)));
+    }
+    ctx.loc = key.location();
+    return ctx;
+  }
   
   tree_question_ptr
   tree_question::create_question(const variant_t source, 
@@ -48,6 +123,17 @@ namespace spin {
     if (ctxit == vmap.end()) 
       throw std::runtime_error("context not found in context Q");
     _target_id = boost::get<int>(ctxit->second);      
+    build_mask();
+  }
+
+  void context_question::build_mask() {
+    const std::set<std::string>& category = tree().category(_category_name);
+    _mask.clear();
+    for (auto it = category.cbegin(), last = category.cend(); it != last; ++ it) {
+      int id = phone_table::intern(*it);
+      if (id / 64 >= static_cast<int>(_mask.size())) _mask.resize(id / 64 + 1, 0);
+      _mask[id / 64] |= uint64_t(1) << (id % 64);
+    }
   }
   
   void context_question::write(variant_t* dest) const {
@@ -60,13 +146,22 @@ namespace spin {
 
   bool context_question::question(const HMM_context& ctx) const {
     int idx = tree().left_context_length() + _target_id;
-    if (idx < 0 || idx > ctx.label.size()) {
+    if (idx < 0 || idx >= ctx.label.size()) {
       throw std::runtime_error("question error");
     }
-    
-    const std::set<std::string>& category = tree().category(_category_name);
-    
-    return category.find(ctx.label[idx]) != category.end();
+    return in_category(phone_table::find(ctx.label[idx]));
+  }
+
+  bool context_question::question(const packed_context& ctx) const {
+    int idx = tree().left_context_length() + _target_id;
+    if (idx < 0 || idx >= packed_context::MAX_POSITIONS) {
+      throw std::runtime_error("question error");
+    }
+    int phone = ctx.phone(idx);
+    if (phone == packed_context::NO_PHONE) {
+      throw std::runtime_error("question error");
+    }
+    return in_category(phone);
   }
 
   void location_question::read(const variant_t& source) {
@@ -211,6 +306,22 @@ namespace spin {
     return node->value;
   }
 
+  int
+  context_decision_tree_node::resolve(const packed_context& ctx) const {
+    const context_decision_tree_node* node = this; 
+    while (! node->is_leaf) {
+      if (node->question->question(ctx)) {
+        node = node->is_true;
+      } else {
+        if (! node->is_false) {
+          throw std::runtime_error("Falled into unspecified decision tree node");
+        }
+        node = node->is_false;
+      }
+    }
+    return node->value;
+  }
+
   int context_decision_tree_node::max_state_id() const {
     if (is_leaf) return value;
     else return std::max(is_true ? is_true->max_state_id() : 0,
@@ -329,6 +440,14 @@ namespace spin {
     int clen = left_context_length() + 1 + right_context_length();
 
     std::set<int> disamb_loop_added;
+
+    compiled_decision_tree compiled(*this);
+    std::map<std::string, int> phone_ids;
+    for (auto it = labs.cbegin(), last = labs.cend(); it != last; ++ it) {
+      phone_ids[*it] = phone_table::intern(*it);
+    }
+    std::vector<packed_context> ctxs(nstate);
+    std::vector<int> leaves;
     
     for (auto cit = make_combinatorial_iterator(labs, clen);
          ! cit.done(); cit.next()) {
@@ -336,8 +455,6 @@ namespace spin {
       std::string centlabel = labs[left_context_length()];
       if (centlabel.size() == 0) continue;
 
-      std::cout << boost::algorithm::join(labs, "\t") << std::endl;
-      
       int lablabel = prepare_label(&osym, centlabel);
 
       std::vector<std::string> prevstlabs(labs.begin(), boost::prior(labs.end()));
@@ -354,27 +471,29 @@ namespace spin {
       }
       int nextst = statenames[nextstname];
 
-      std::cout << prevstname << " ---> " << nextstname << std::endl;
+      for (int loc = 0; loc < nstate; ++ loc) {
+        ctxs[loc] = packed_context();
+        for (int p = 0; p < clen; ++ p) {
+          ctxs[loc].set_phone(p, phone_ids[labs[p]]);
+        }
+        ctxs[loc].set_location(loc);
+      }
+      compiled.resolve_many(ctxs, &leaves);
+
       int prev = prevst;
       for (int loc = 0; loc < nstate; ++ loc) {
         int next = fst.AddState();
         int olabel = (loc == 0) ? lablabel : 0;
 
-        HMM_context ctx;
-        ctx.label = labs;
-        ctx.loc = loc;
-        int st = resolve(ctx);
+        int st = leaves[loc];
         int ilabel = prepare_label(&isym,
                                    "S" + boost::lexical_cast<std::string>(st)
                                    + ";" + centlabel + ";" + boost::lexical_cast<std::string>(loc));
-        std::string os = (loc == 0) ? centlabel : "";
-        std::cout << ("S" + boost::lexical_cast<std::string>(st)) << ":" << os << "\t";
         fst.AddArc(prev,
                    fst::StdArc(ilabel, olabel, 
                                fst::TropicalWeight::One(), next));
         prev = next;
       }
-      std::cout << std::endl;
 
       // Phone boundary
       int boundary = prepare_label(&isym,
@@ -402,7 +521,7 @@ namespace spin {
         disamb_loop_added.insert(prev);
       }
     }
-    std::cout << "# states = " << statenames.size() << std::endl;
+    INFO("HC FST: %d context states", static_cast<int>(statenames.size()));
 
     std::string begin_pred;
     for (int i = 0; i < left_context_length(); ++ i) begin_pred += "\t";
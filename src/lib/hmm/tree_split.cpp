@@ -0,0 +1,222 @@
+#include <spin/hmm/tree_split.hpp>
+#include <spin/parallel.hpp>
+#include <gear/io/logging.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace spin {
+  tree_split_engine::tree_split_engine(const context_decision_tree& tree,
+                                       const tree_statistics& stats)
+    : _tree(tree), _statistics(stats),
+      _npositions(tree.left_context_length() + tree.right_context_length() + 1),
+      _ndim(0), _nlabels(0) {
+    // compact label IDs of the phones appearing in the statistics
+    std::vector<int> label_ids(phone_table::size(), -1);
+    for (size_t i = 0; i < stats.size(); ++ i) {
+      const packed_context& key = stats.key(i);
+      if (key.npositions() != _npositions) {
+        throw std::runtime_error("Context length mismatch: " +
+                                 stats.context(i).to_string());
+      }
+      if (i == 0) {
+        _ndim = stats.statistics(i).first.rows();
+      } else if (stats.statistics(i).first.rows() != _ndim) {
+        throw std::runtime_error("Dimensionality mismatch in tree statistics");
+      }
+      for (int p = 0; p < _npositions; ++ p) {
+        int& id = label_ids[key.phone(p)];
+        if (id < 0) id = _nlabels ++;
+        _labels.push_back(id);
+      }
+      _locations.push_back(key.location());
+    }
+
+    size_t nwords = (_nlabels + 63) / 64 + 1;
+    for (auto cit = tree.categories().cbegin(), clast = tree.categories().cend();
+         cit != clast; ++ cit) {
+      std::vector<uint64_t> bits(nwords, 0);
+      for (auto lit = cit->second.cbegin(), llast = cit->second.cend();
+           lit != llast; ++ lit) {
+        int phone = phone_table::find(*lit);
+        if (phone < 0 || phone >= static_cast<int>(label_ids.size()) ||
+            label_ids[phone] < 0) {
+          continue; // never appears in the data
+        }
+        bits[label_ids[phone] / 64] |= uint64_t(1) << (label_ids[phone] % 64);
+      }
+      _category_names.push_back(cit->first);
+      _category_bits.push_back(bits);
+    }
+    INFO("Split engine: %d contexts, %d labels, %d categories",
+         static_cast<int>(stats.size()), _nlabels,
+         static_cast<int>(_category_names.size()));
+  }
+
+  void tree_split_engine::compute_membership(
+      std::map<const context_decision_tree_node*, std::vector<int> >* pmem)
+    const {
+    for (size_t i = 0; i < _statistics.size(); ++ i) {
+      const context_decision_tree_node* cur = _tree.root();
+      while (! cur->is_leaf) {
+        cur = cur->question->question(_statistics.key(i)) ? cur->is_true
+          : cur->is_false;
+        if (! cur) {
+          throw std::runtime_error("Fallen into undefined state");
+        }
+      }
+      (*pmem)[cur].push_back(i);
+    }
+  }
+
+  void tree_split_engine::sum_statistics(const std::vector<int>& entries,
+                                         size_t begin, size_t end,
+                                         std::vector<double>* sums) const {
+    int R = record_size();
+    sums->assign((_npositions * _nlabels + NLOCATIONS) * R, 0.0);
+    for (size_t n = begin; n < end; ++ n) {
+      int e = entries[n];
+      const tree_Gaussian_statistics& st = _statistics.statistics(e);
+      const int* labels = &_labels[e * _npositions];
+      for (int p = 0; p < _npositions; ++ p) {
+        double* dest = &(*sums)[(p * _nlabels + labels[p]) * R];
+        dest[0] += st.zero;
+        for (int d = 0; d < _ndim; ++ d) {
+          dest[1 + d] += st.first(d);
+          dest[1 + _ndim + d] += st.second(d);
+        }
+      }
+      int loc = _locations[e];
+      if (loc >= 0 && loc < NLOCATIONS) {
+        double* dest = &(*sums)[(_npositions * _nlabels + loc) * R];
+        dest[0] += st.zero;
+        for (int d = 0; d < _ndim; ++ d) {
+          dest[1 + d] += st.first(d);
+          dest[1 + _ndim + d] += st.second(d);
+        }
+      }
+    }
+  }
+
+  double tree_split_engine::loglikelihood(const double* record) const {
+    // same as tree_Gaussian_statistics::data_loglikelihood()
+    double zero = record[0];
+    double logdet = 0.0;
+    for (int d = 0; d < _ndim; ++ d) {
+      double mean = record[1 + d] / zero;
+      logdet += std::log(record[1 + _ndim + d] / zero - mean * mean);
+    }
+    return - zero / 2 * (_ndim * (M_LOG2PI - 1) + logdet);
+  }
+
+  split_question
+  tree_split_engine::find_best_question(const std::vector<int>& entries,
+                                        int minocc, double* pgain,
+                                        worker_pool* pool) const {
+    int R = record_size();
+    int njobs = pool ? std::min<int>(pool->size(), entries.size() / 256 + 1) : 1;
+
+    // one pass over the contexts of the leaf
+    std::vector<std::vector<double> > partial(njobs);
+    auto sum_part = [&](int k) {
+      sum_statistics(entries, entries.size() * k / njobs,
+                     entries.size() * (k + 1) / njobs, &partial[k]);
+    };
+    if (pool && njobs > 1) {
+      pool->run(njobs, sum_part);
+    } else {
+      sum_part(0);
+    }
+    std::vector<double>& sums = partial[0];
+    for (int k = 1; k < njobs; ++ k) {
+      for (size_t i = 0; i < sums.size(); ++ i) sums[i] += partial[k][i];
+    }
+
+    std::vector<double> all(R, 0.0);
+    for (int v = 0; v < _nlabels; ++ v) {
+      for (int i = 0; i < R; ++ i) all[i] += sums[v * R + i];
+    }
+    double all_ll = loglikelihood(&all[0]);
+
+    // gains of the context questions followed by the location questions
+    int ncategories = _category_names.size();
+    int ncontextqs = _npositions * ncategories;
+    std::vector<double> gains(ncontextqs + NLOCATIONS, 0.0);
+    auto examine = [&](int q, std::vector<double>& is_true,
+                       std::vector<double>& is_false) {
+      std::fill(is_true.begin(), is_true.end(), 0.0);
+      if (q < ncontextqs) {
+        int p = q / ncategories, c = q % ncategories;
+        for (int v = 0; v < _nlabels; ++ v) {
+          if (! in_category(c, v)) continue;
+          const double* src = &sums[(p * _nlabels + v) * R];
+          for (int i = 0; i < R; ++ i) is_true[i] += src[i];
+        }
+      } else {
+        int loc = q - ncontextqs;
+        const double* src = &sums[(_npositions * _nlabels + loc) * R];
+        std::copy(src, src + R, is_true.begin());
+      }
+      for (int i = 0; i < R; ++ i) is_false[i] = all[i] - is_true[i];
+      if (is_true[0] < minocc || is_false[0] < minocc) return;
+      gains[q] = loglikelihood(&is_true[0]) + loglikelihood(&is_false[0])
+        - all_ll;
+    };
+    int nqjobs = pool ? std::min<int>(pool->size(), gains.size()) : 1;
+    auto examine_part = [&](int k) {
+      std::vector<double> is_true(R), is_false(R);
+      for (size_t q = k; q < gains.size(); q += nqjobs) {
+        examine(q, is_true, is_false);
+      }
+    };
+    if (pool && nqjobs > 1) {
+      pool->run(nqjobs, examine_part);
+    } else {
+      examine_part(0);
+    }
+
+    // the first maximum in the order of the original serial search
+    split_question best;
+    double maxgain = 0.0;
+    for (size_t q = 0; q < gains.size(); ++ q) {
+      if (! (gains[q] > maxgain)) continue;
+      maxgain = gains[q];
+      if (static_cast<int>(q) < ncontextqs) {
+        best.type = split_question::CONTEXT;
+        best.position = q / ncategories - _tree.left_context_length();
+        best.category = q % ncategories;
+      } else {
+        best.type = split_question::LOCATION;
+        best.location = q - ncontextqs;
+      }
+    }
+    *pgain = maxgain;
+    return best;
+  }
+
+  bool tree_split_engine::answer(const split_question& q, int entry) const {
+    switch (q.type) {
+    case split_question::CONTEXT:
+      return in_category(q.category,
+                         _labels[entry * _npositions + q.position
+                                 + _tree.left_context_length()]);
+    case split_question::LOCATION:
+      return _locations[entry] == q.location;
+    default:
+      throw std::runtime_error("Invalid split question");
+    }
+  }
+
+  tree_question_ptr
+  tree_split_engine::make_question(const split_question& q) const {
+    switch (q.type) {
+    case split_question::CONTEXT:
+      return tree_question_ptr(new context_question(_tree,
+                                                    _category_names[q.category],
+                                                    q.position));
+    case split_question::LOCATION:
+      return tree_question_ptr(new location_question(_tree, q.location));
+    default:
+      return tree_question_ptr();
+    }
+  }
+}
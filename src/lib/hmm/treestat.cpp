@@ -4,22 +4,54 @@
 #include <boost/algorithm/string/split.hpp>
 #include <gear/io/logging.hpp>
 #include <spin/fst/linear.hpp>
+#include <spin/io/variant.hpp>
+#include <algorithm>
+#include <cstring>
 
 
 namespace spin {
 
-  void tree_statistics::accumulate(const HMM_context& ctx, const fmatrix& features) {
-    auto it = _data.find(ctx);
-    if (it == _data.end()) {
-      it = _data.insert(std::make_pair(ctx, tree_Gaussian_statistics())).first;
-      it->second.zero = 0.0;
-      it->second.first = dvector::Zero(features.rows());
-      it->second.second = dvector::Zero(features.rows());
+  void tree_statistics::rehash(size_t nslots) {
+    _index.assign(nslots, -1);
+    for (size_t i = 0; i < _keys.size(); ++ i) {
+      _index[find_slot(_keys[i])] = i;
     }
+  }
+
+  tree_Gaussian_statistics&
+  tree_statistics::insert(const packed_context& key, int ndim) {
+    size_t slot = find_slot(key);
+    if (_index[slot] >= 0) return _stats[_index[slot]];
+
+    // keep the load factor under 1/2
+    if ((_keys.size() + 1) * 2 > _index.size()) {
+      rehash(_index.size() * 2);
+      slot = find_slot(key);
+    }
+    _index[slot] = _keys.size();
+    _keys.push_back(key);
+    _stats.push_back(tree_Gaussian_statistics());
+    tree_Gaussian_statistics& st = _stats.back();
+    st.zero = 0.0;
+    st.first = dvector::Zero(ndim);
+    st.second = dvector::Zero(ndim);
+    return st;
+  }
+
+  void tree_statistics::accumulate(const packed_context& key,
+                                   const fmatrix& features) {
+    tree_Gaussian_statistics& st = insert(key, features.rows());
+    st.zero += features.cols();
+    st.first += features.cast<double>().rowwise().sum();
+    st.second += features.cast<double>().array().square().matrix().rowwise().sum();
+  }
 
-    it->second.zero += features.cols();
-    it->second.first += features.cast<double>().rowwise().sum();
-    it->second.second += features.cast<double>().array().square().matrix().rowwise().sum();
+  void tree_statistics::accumulate(const packed_context& key,
+                                   const tree_Gaussian_statistics& stats) {
+    tree_Gaussian_statistics& st = insert(key, stats.first.rows());
+    st.zero += stats.zero;
+    st.first += stats.first;
+    st.second += stats.second;
   }
 
   void tree_statistics::accumulate(const tree_statistics& other) {
@@ -31,16 +63,8 @@ namespace spin {
       throw std::runtime_error("Context size mismatch");
     }
 
-    for (auto otit = other._data.cbegin(), otlast = other._data.cend();
-         otit != otlast; ++ otit) {
-      auto thisit = _data.find(otit->first);
-      if (thisit == _data.end()) {
-        _data.insert(*otit); // just copy
-      } else {
-        thisit->second.zero += otit->second.zero;
-        thisit->second.first += otit->second.first;
-        thisit->second.second += otit->second.second;
-      }
+    for (size_t i = 0; i < other.size(); ++ i) {
+      accumulate(other._keys[i], other._stats[i]);
     }
   }
 
@@ -60,7 +84,7 @@ namespace spin {
       d.second = get_prop<dmatrix>(stat, "second");
       HMM_context ctx;
       ctx.parse_string(it->first);
-      _data.insert(std::make_pair(ctx, d));
+      accumulate(ctx.pack(), d);
     }
   }
   
@@ -74,26 +98,220 @@ namespace spin {
     
     props["stats"] = variant_map();
     variant_map& stats = boost::get<variant_map>(props["stats"]);
-    for (auto it = _data.cbegin(), last = _data.cend(); it != last; ++ it) {
+    for (size_t i = 0; i < _keys.size(); ++ i) {
       variant_map stat;
-      stat["zero"] = it->second.zero;
-      stat["first"] = dmatrix(it->second.first);
-      stat["second"] = dmatrix(it->second.second);
+      stat["zero"] = _stats[i].zero;
+      stat["first"] = dmatrix(_stats[i].first);
+      stat["second"] = dmatrix(_stats[i].second);
       
-      stats.insert(std::make_pair(it->first.to_string(), stat));
+      stats.insert(std::make_pair(context(i).to_string(), stat));
     }
     props["stats"] = stats;
     *dest = props;
   }
 
+  namespace {
+    const char tree_stats_magic[] = "SpinTRST";
+
+    // appends entries to a binary tree statistics file
+    class tree_statistics_writer {
+      stat_file_writer _writer;
+      int _ndim;
+      std::vector<uint64_t> _key_offsets;
+      std::vector<char> _keys;
+    public:
+      tree_statistics_writer(const std::string& path, int left, int right,
+                             int ndim)
+        : _writer(path, tree_stats_magic), _ndim(ndim), _key_offsets(1, 0) {
+        _writer.set_param(tree_statistics_file::PARAM_LEFT, left);
+        _writer.set_param(tree_statistics_file::PARAM_RIGHT, right);
+        _writer.set_param(tree_statistics_file::PARAM_NDIM, ndim);
+        _writer.begin_section(tree_statistics_file::SEC_RECORDS);
+      }
+
+      void add(const char* key, size_t keysize, const double* record) {
+        _writer.write(record, 1 + 2 * _ndim);
+        _keys.insert(_keys.end(), key, key + keysize);
+        _key_offsets.push_back(_keys.size());
+      }
+
+      void close() {
+        _writer.set_param(tree_statistics_file::PARAM_NENTRIES,
+                          _key_offsets.size() - 1);
+        _writer.begin_section(tree_statistics_file::SEC_KEY_OFFSETS);
+        _writer.write(_key_offsets.data(), _key_offsets.size());
+        _writer.begin_section(tree_statistics_file::SEC_KEYS);
+        _writer.write(_keys.data(), _keys.size());
+        _writer.close();
+      }
+    };
+
+    // bytewise order of the context strings
+    int compare_keys(const char* a, size_t asize, const char* b, size_t bsize) {
+      int c = std::memcmp(a, b, std::min(asize, bsize));
+      if (c != 0) return c;
+      return asize < bsize ? -1 : (asize > bsize ? 1 : 0);
+    }
+  }
+
+  tree_statistics_file::tree_statistics_file(const std::string& path)
+    : _file(path, tree_stats_magic) {
+    _nentries = _file.param(PARAM_NENTRIES);
+    _ndim = _file.param(PARAM_NDIM);
+    size_t noffsets, nkeys, nrecords;
+    _key_offsets = _file.section<uint64_t>(SEC_KEY_OFFSETS, &noffsets);
+    _keys = _file.section<char>(SEC_KEYS, &nkeys);
+    _records = _file.section<double>(SEC_RECORDS, &nrecords);
+    if (noffsets != _nentries + 1 || _key_offsets[0] != 0 ||
+        _key_offsets[_nentries] != nkeys ||
+        nrecords != _nentries * (1 + 2 * _ndim)) {
+      throw std::runtime_error("Broken tree statistics file " + path);
+    }
+    for (size_t i = 0; i < _nentries; ++ i) {
+      if (_key_offsets[i] > _key_offsets[i + 1]) {
+        throw std::runtime_error("Broken tree statistics file " + path);
+      }
+    }
+  }
+
+  bool tree_statistics::is_binary_file(const std::string& path) {
+    return stat_file::is_stat_file(path, tree_stats_magic);
+  }
+
+  void tree_statistics::write_binary(const std::string& path) const {
+    typedef std::pair<std::string, const tree_Gaussian_statistics*> entry;
+    std::vector<entry> entries;
+    for (size_t i = 0; i < _keys.size(); ++ i) {
+      entries.push_back(entry(context(i).to_string(), &_stats[i]));
+    }
+    std::sort(entries.begin(), entries.end(),
+              [](const entry& a, const entry& b) { return a.first < b.first; });
+
+    int D = entries.empty() ? 0 : entries[0].second->first.rows();
+    tree_statistics_writer writer(path, _left_context, _right_context, D);
+    std::vector<double> record(1 + 2 * D);
+    for (auto it = entries.cbegin(), last = entries.cend(); it != last; ++ it) {
+      const tree_Gaussian_statistics& st = *it->second;
+      if (st.first.rows() != D || st.second.rows() != D) {
+        throw std::runtime_error("Dimensionality mismatch in tree statistics");
+      }
+      record[0] = st.zero;
+      dvector::Map(&record[1], D) = st.first;
+      dvector::Map(&record[1 + D], D) = st.second;
+      writer.add(it->first.data(), it->first.size(), record.data());
+    }
+    writer.close();
+  }
+
+  void tree_statistics::load(const std::string& path) {
+    if (! is_binary_file(path)) {
+      variant_t src;
+      load_variant(&src, path);
+      read(src);
+      return;
+    }
+    tree_statistics_file file(path);
+    _left_context = file.left_context_length();
+    _right_context = file.right_context_length();
+    _keys.clear();
+    _stats.clear();
+    _index.assign(16, -1);
+    int D = file.ndim();
+    for (size_t i = 0; i < file.size(); ++ i) {
+      HMM_context ctx;
+      ctx.parse_string(std::string(file.key_data(i), file.key_size(i)));
+      const double* record = file.record(i);
+      tree_Gaussian_statistics d;
+      d.zero = record[0];
+      d.first = dvector::Map(record + 1, D);
+      d.second = dvector::Map(record + 1 + D, D);
+      accumulate(ctx.pack(), d);
+    }
+  }
+
+  void merge_tree_statistics_files(const std::vector<std::string>& inputs,
+                                   const std::string& output) {
+    std::vector<boost::shared_ptr<tree_statistics_file> > files;
+    int left = 0, right = 0, D = -1;
+    for (size_t k = 0; k < inputs.size(); ++ k) {
+      INFO("Mapping %s...", inputs[k].c_str());
+      files.push_back(boost::shared_ptr<tree_statistics_file>(
+          new tree_statistics_file(inputs[k])));
+      const tree_statistics_file& f = *files.back();
+      if (k == 0) {
+        left = f.left_context_length();
+        right = f.right_context_length();
+      } else if (f.left_context_length() != left ||
+                 f.right_context_length() != right) {
+        ERROR("Context size mismatch: Left: (%d vs %d), Right: (%d vs %d)",
+              f.left_context_length(), left, f.right_context_length(), right);
+        throw std::runtime_error("Context size mismatch");
+      }
+      if (f.size() == 0) continue;
+      if (D >= 0 && f.ndim() != D) {
+        throw std::runtime_error("Dimensionality mismatch in " + inputs[k]);
+      }
+      D = f.ndim();
+    }
+    D = std::max(D, 0);
+
+    // min-heap of the files by the key at their cursor
+    std::vector<size_t> cursors(files.size(), 0);
+    auto greater = [&](int a, int b) {
+      const tree_statistics_file& fa = *files[a];
+      const tree_statistics_file& fb = *files[b];
+      return compare_keys(fa.key_data(cursors[a]), fa.key_size(cursors[a]),
+                          fb.key_data(cursors[b]), fb.key_size(cursors[b])) > 0;
+    };
+    std::vector<int> heap;
+    for (size_t k = 0; k < files.size(); ++ k) {
+      if (files[k]->size() > 0) heap.push_back(k);
+    }
+    std::make_heap(heap.begin(), heap.end(), greater);
+
+    tree_statistics_writer writer(output, left, right, D);
+    std::vector<double> sum(1 + 2 * D);
+    size_t nentries = 0;
+    while (! heap.empty()) {
+      int k0 = heap.front();
+      const char* key = files[k0]->key_data(cursors[k0]);
+      size_t keysize = files[k0]->key_size(cursors[k0]);
+      std::fill(sum.begin(), sum.end(), 0.0);
+      // pop all the files at the same key
+      while (! heap.empty()) {
+        int k = heap.front();
+        tree_statistics_file& f = *files[k];
+        if (compare_keys(f.key_data(cursors[k]), f.key_size(cursors[k]),
+                         key, keysize) != 0) break;
+        std::pop_heap(heap.begin(), heap.end(), greater);
+        heap.pop_back();
+        const double* record = f.record(cursors[k]);
+        for (int i = 0; i < 1 + 2 * D; ++ i) sum[i] += record[i];
+        ++ cursors[k];
+        if (cursors[k] < f.size()) {
+          if (compare_keys(f.key_data(cursors[k] - 1), f.key_size(cursors[k] - 1),
+                           f.key_data(cursors[k]), f.key_size(cursors[k])) >= 0) {
+            throw std::runtime_error("Entries are not sorted in " + inputs[k]);
+          }
+          heap.push_back(k);
+          std::push_heap(heap.begin(), heap.end(), greater);
+        }
+      }
+      writer.add(key, keysize, sum.data());
+      ++ nentries;
+    }
+    writer.close();
+    INFO("Merged %d files into %d contexts",
+         static_cast<int>(files.size()), static_cast<int>(nentries));
+  }
+
   void tree_statistics::compute_membership(const context_decision_tree& tree,
                                            tree_membership* pmem) const {
-    for (auto it = data().cbegin(), last = data().cend();
-         it != last; ++ it) {
+    for (size_t i = 0; i < _keys.size(); ++ i) {
       const context_decision_tree_node* cur = tree.root();
 
       while (! cur->is_leaf) {
-        bool f = cur->question->question(it->first);
+        bool f = cur->question->question(_keys[i]);
         if (f) {
           cur = cur->is_true;
         }
@@ -104,7 +322,7 @@ namespace spin {
           throw std::runtime_error("Fallen into undefined state");
         }
       }
-      tree_context_stat sp(it->first, &(it->second));
+      tree_context_stat sp(_keys[i], &_stats[i]);
       //pmem->insert(std::make_pair(cur, sp));
       (*pmem)[cur].push_back(sp);
     }
@@ -0,0 +1,43 @@
+#include <spin/io/mmap.hpp>
+#include <gear/io/logging.hpp>
+
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace spin {
+  mapped_file::mapped_file(const std::string& path)
+    : _data(0), _size(0) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      ERROR("Cannot open %s", path.c_str());
+      throw std::runtime_error("Cannot open " + path);
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot stat " + path);
+    }
+    _size = st.st_size;
+    if (_size > 0) {
+      void* p = ::mmap(0, _size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p == MAP_FAILED) {
+        ::close(fd);
+        ERROR("Cannot map %s", path.c_str());
+        throw std::runtime_error("Cannot map " + path);
+      }
+      _data = static_cast<const char*>(p);
+    }
+    ::close(fd);
+  }
+
+  mapped_file::~mapped_file() {
+    if (_data) ::munmap(const_cast<char*>(_data), _size);
+  }
+
+  void mapped_file::advise_sequential() const {
+    if (_data) ::madvise(const_cast<char*>(_data), _size, MADV_SEQUENTIAL);
+  }
+}
@@ -0,0 +1,72 @@
+#include <spin/io/statfile.hpp>
+#include <gear/io/logging.hpp>
+
+#include <cstring>
+#include <stdexcept>
+
+namespace spin {
+  stat_file::stat_file(const std::string& path, const std::string& magic)
+    : _mapping(new mapped_file(path)) {
+    if (_mapping->size() < sizeof(file_header)) {
+      throw std::runtime_error("Broken statistics file " + path);
+    }
+    std::memcpy(&_header, _mapping->data(), sizeof(file_header));
+    if (std::string(_header.magic, 8) != magic) {
+      throw std::runtime_error(path + " is not a statistics file of " + magic);
+    }
+    if (_header.version != VERSION) {
+      throw std::runtime_error("Unsupported statistics file version " + path);
+    }
+    for (int sec = 0; sec < MAX_SECTIONS; ++ sec) {
+      uint64_t offset = _header.sections[sec][0];
+      uint64_t size = _header.sections[sec][1];
+      if (offset % 8 != 0 || offset + size > _mapping->size()) {
+        throw std::runtime_error("Broken statistics file " + path);
+      }
+    }
+  }
+
+  bool stat_file::is_stat_file(const std::string& path,
+                               const std::string& magic) {
+    std::ifstream ifs(path.c_str(), std::ios::binary);
+    char buf[8];
+    ifs.read(buf, 8);
+    return ifs && std::string(buf, 8) == magic;
+  }
+
+  stat_file_writer::stat_file_writer(const std::string& path,
+                                     const std::string& magic)
+    : _path(path), _ofs(path.c_str(), std::ios::binary), _current(-1) {
+    if (magic.size() != 8) {
+      throw std::runtime_error("Magic of statistics file must be 8 bytes");
+    }
+    std::memset(&_header, 0, sizeof(stat_file::file_header));
+    std::memcpy(_header.magic, magic.data(), 8);
+    _header.version = stat_file::VERSION;
+    // placeholder, rewritten by close()
+    _ofs.write(reinterpret_cast<const char*>(&_header),
+               sizeof(stat_file::file_header));
+    if (! _ofs) {
+      throw std::runtime_error("Cannot open " + path);
+    }
+  }
+
+  void stat_file_writer::begin_section(int sec) {
+    const char zeros[8] = { 0 };
+    uint64_t offset = _ofs.tellp();
+    _ofs.write(zeros, (8 - offset % 8) % 8);
+    _current = sec;
+    _header.sections[sec][0] = _ofs.tellp();
+    _header.sections[sec][1] = 0;
+  }
+
+  void stat_file_writer::close() {
+    _ofs.seekp(0);
+    _ofs.write(reinterpret_cast<const char*>(&_header),
+               sizeof(stat_file::file_header));
+    _ofs.close();
+    if (! _ofs) {
+      throw std::runtime_error("Failed to write statistics file " + _path);
+    }
+  }
+}
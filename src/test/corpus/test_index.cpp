@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/corpus/index.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+#include <fstream>
+
+namespace {
+  using namespace spin;
+
+  std::string make_key(int i) {
+    return "utt" + boost::lexical_cast<std::string>((i * 7) % 10);
+  }
+
+  void write_corpus(const std::string& path, bool is_binary) {
+    std::vector<std::string> keys;
+    for (int i = 0; i < 10; ++ i) keys.push_back(make_key(i));
+    write_keyed_corpus(path, is_binary, keys);
+  }
+
+  void check_index(bool is_binary) {
+    std::string path = ::testing::TempDir() + "test_corpus_index"
+      + (is_binary ? ".bin" : ".yaml");
+    write_corpus(path, is_binary);
+    ASSERT_TRUE(corpus_index::is_available(path));
+
+    corpus_index index(path);
+    ASSERT_EQ(10, index.size());
+    ASSERT_EQ(is_binary, index.is_binary());
+    for (size_t i = 1; i < index.size(); ++ i) {
+      ASSERT_LT(index.key(i - 1), index.key(i));
+    }
+    ASSERT_EQ(-1, index.find("utt"));
+    ASSERT_EQ(-1, index.find("utt99"));
+
+    // positions agree with the sequential reader
+    for (corpus_iterator_ptr it = make_corpus_iterator(path);
+         ! it->done(); it->next()) {
+      int i = index.find(it->get_key());
+      ASSERT_LE(0, i);
+      ASSERT_EQ(it->pos(), index.position(i));
+    }
+
+    std::vector<std::string> keys;
+    keys.push_back("utt4");
+    keys.push_back("utt0");
+    keys.push_back("utt9");
+    keys.push_back("utt4");
+    corpus_iterator_ptr it = make_corpus_iterator(path, keys);
+    size_t n = 0;
+    for ( ; ! it->done(); it->next(), ++ n) {
+      ASSERT_EQ(keys[n], it->get_key());
+      int v = boost::get<int>(it->value().find("value")->second);
+      ASSERT_EQ(keys[n], make_key(v));
+    }
+    ASSERT_EQ(keys.size(), n);
+
+    keys.push_back("missing");
+    ASSERT_THROW(make_corpus_iterator(path, keys), std::runtime_error);
+
+    // the index is ignored once the corpus is modified
+    {
+      std::ofstream ofs(path.c_str(), std::ios::app);
+      ofs << "\n";
+    }
+    ASSERT_FALSE(corpus_index::is_available(path));
+
+    std::remove(path.c_str());
+    std::remove(corpus_index::index_path(path).c_str());
+  }
+
+  TEST(corpus_index_test, msgpack) {
+    check_index(true);
+  }
+
+  TEST(corpus_index_test, yaml) {
+    check_index(false);
+  }
+}
@@ -0,0 +1,74 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/corpus/msgpack.hpp>
+#include <boost/lexical_cast.hpp>
+#include <cstdio>
+
+namespace {
+  using namespace spin;
+
+  corpus_entry make_entry(int i) {
+    std::srand(i);
+    corpus_entry ent;
+    // keys of varying lengths so that matrices are at various alignments
+    ent["+key"] = "utt" + std::string(i, 'x');
+    ent["feature"] = fmatrix(fmatrix::Random(3, 2 + i));
+    ent["dfeature"] = dmatrix(dmatrix::Random(2, i + 1));
+    ent["label"] = intmatrix(intmatrix::Constant(1, i + 1, i));
+    ent["n"] = i;
+    return ent;
+  }
+
+  TEST(corpus_msgpack_test, mapped_iterator) {
+    std::string path = ::testing::TempDir() + "test_corpus_msgpack.bin";
+    {
+      msgpack_corpus_writer writer(path);
+      for (int i = 0; i < 8; ++ i) writer.write(make_entry(i));
+    }
+
+    msgpack_corpus_iterator sit(path);
+    mapped_msgpack_corpus_iterator mit(path);
+    std::vector<corpus_pos_t> positions;
+    int n = 0;
+    for ( ; ! sit.done(); sit.next(), mit.next(), ++ n) {
+      ASSERT_FALSE(mit.done());
+      ASSERT_EQ(sit.pos(), mit.pos());
+      positions.push_back(mit.pos());
+      ASSERT_EQ(sit.get_key(), mit.get_key());
+
+      corpus_entry expected = make_entry(n);
+      const corpus_entry& ent = mit.value();
+      ASSERT_EQ(expected.size(), ent.size());
+      ASSERT_EQ(n, boost::get<int>(ent.find("n")->second));
+      const fmatrix& feat = boost::get<fmatrix>(expected["feature"]);
+      ASSERT_TRUE(feat == boost::get<fmatrix>(ent.find("feature")->second));
+      ASSERT_TRUE(boost::get<dmatrix>(expected["dfeature"]) ==
+                  boost::get<dmatrix>(ent.find("dfeature")->second));
+      ASSERT_TRUE(boost::get<intmatrix>(expected["label"]) ==
+                  boost::get<intmatrix>(ent.find("label")->second));
+      ASSERT_TRUE(feat == boost::get<fmatrix>(sit.value().find("feature")->second));
+
+      mapped_msgpack_corpus_iterator::fmatrix_view view
+        = mit.fmatrix_field("feature");
+      ASSERT_EQ(feat.rows(), view.rows());
+      ASSERT_EQ(feat.cols(), view.cols());
+      ASSERT_TRUE(feat == view);
+      ASSERT_THROW(mit.fmatrix_field("dfeature"), std::runtime_error);
+      ASSERT_THROW(mit.fmatrix_field("missing"), std::runtime_error);
+    }
+    ASSERT_EQ(8, n);
+    ASSERT_TRUE(mit.done());
+
+    mit.seek(positions[5]);
+    ASSERT_EQ("utt" + std::string(5, 'x'), mit.get_key());
+    mit.seek(positions[2]);
+    ASSERT_EQ(2, boost::get<int>(mit.value().find("n")->second));
+
+    std::remove(path.c_str());
+    std::remove((path + ".idx").c_str());
+  }
+}
@@ -0,0 +1,110 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/corpus/prefetch.hpp>
+#include <boost/lexical_cast.hpp>
+#include <vector>
+
+namespace {
+  using namespace spin;
+
+  const int NENTRIES = 20;
+
+  std::string make_key(int i) {
+    return "utt" + boost::lexical_cast<std::string>(100 + i);
+  }
+
+  std::string write_corpus(bool is_binary) {
+    std::string path = ::testing::TempDir() + "test_corpus_prefetch"
+      + (is_binary ? ".bin" : ".yaml");
+    std::vector<std::string> keys;
+    for (int i = 0; i < NENTRIES; ++ i) keys.push_back(make_key(i));
+    write_keyed_corpus(path, is_binary, keys);
+    return path;
+  }
+
+  // fails after nentries entries
+  class failing_corpus_iterator : public corpus_iterator {
+    corpus_entry _entry;
+    int _cur, _nentries;
+  public:
+    explicit failing_corpus_iterator(int nentries)
+      : _cur(0), _nentries(nentries) {
+      _entry["+key"] = make_key(0);
+    }
+    virtual bool done() { return false; }
+    virtual void next() {
+      if (++ _cur >= _nentries) throw std::runtime_error("read error");
+      _entry["+key"] = make_key(_cur);
+    }
+    virtual const corpus_entry& value() { return _entry; }
+    virtual corpus_pos_t pos() const { return _cur; }
+  };
+
+  TEST(corpus_prefetch_test, same_entries) {
+    for (int b = 0; b < 2; ++ b) {
+      std::string path = write_corpus(b != 0);
+      std::vector<std::string> keys;
+      std::vector<corpus_pos_t> positions;
+      for (corpus_iterator_ptr it = make_corpus_iterator(path);
+           ! it->done(); it->next()) {
+        keys.push_back(it->get_key());
+        positions.push_back(it->pos());
+      }
+      ASSERT_EQ(NENTRIES, keys.size());
+
+      for (size_t depth = 1; depth <= 8; depth *= 2) {
+        corpus_iterator_ptr it = make_corpus_iterator(path,
+                                                      boost::logic::indeterminate,
+                                                      depth);
+        for (int i = 0; i < NENTRIES; ++ i, it->next()) {
+          ASSERT_FALSE(it->done());
+          ASSERT_EQ(keys[i], it->get_key());
+          ASSERT_EQ(positions[i], it->pos());
+          ASSERT_EQ(i, boost::get<int>(it->value().find("value")->second));
+        }
+        ASSERT_TRUE(it->done());
+
+        it->seek(positions[5]);
+        ASSERT_FALSE(it->done());
+        ASSERT_EQ(keys[5], it->get_key());
+        it->next();
+        ASSERT_EQ(keys[6], it->get_key());
+      }
+
+      // destroyed while the reader waits on the full queue
+      corpus_iterator_ptr it = make_corpus_iterator(path,
+                                                    boost::logic::indeterminate,
+                                                    2);
+      it->next();
+    }
+  }
+
+  TEST(corpus_prefetch_test, error) {
+    prefetching_corpus_iterator
+      it(corpus_iterator_ptr(new failing_corpus_iterator(3)), 4);
+    ASSERT_EQ(make_key(0), it.get_key());
+    it.next();
+    ASSERT_EQ(make_key(1), it.get_key());
+    it.next();
+    ASSERT_EQ(make_key(2), it.get_key());
+    ASSERT_THROW(it.next(), std::runtime_error);
+    ASSERT_TRUE(it.done());
+  }
+
+  TEST(corpus_prefetch_test, zipped) {
+    std::string path = write_corpus(true);
+    zipped_corpus_iterator_ptr zit =
+      zip_corpus("a", make_corpus_iterator(path),
+                 "b", make_corpus_iterator(path, boost::logic::indeterminate, 3));
+    int n = 0;
+    for (; ! zit->done(); zit->next(), ++ n) {
+      ASSERT_EQ(make_key(n), zit->get_key());
+      ASSERT_EQ(n, boost::get<int>(zit->value(1).find("value")->second));
+    }
+    ASSERT_EQ(NENTRIES, n);
+  }
+}
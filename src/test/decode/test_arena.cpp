@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/decode/arena.hpp>
+
+namespace {
+  using namespace spin;
+
+  struct record {
+    int value;
+    const record* prev;
+  };
+
+  TEST(chunked_arena_test, pointers_are_stable) {
+    chunked_arena<record> arena(4);
+    std::vector<record*> ptrs;
+    const record* prev = 0;
+    for (int n = 0; n < 10; ++ n) {
+      record* r = arena.allocate();
+      r->value = n;
+      r->prev = prev;
+      prev = r;
+      ptrs.push_back(r);
+    }
+    ASSERT_EQ(10, arena.size());
+    ASSERT_EQ(12, arena.capacity());
+    for (int n = 9; n >= 0; -- n) {
+      ASSERT_EQ(ptrs[n], prev);
+      ASSERT_EQ(n, prev->value);
+      prev = prev->prev;
+    }
+  }
+
+  TEST(chunked_arena_test, clear_reuses_chunks) {
+    chunked_arena<int> arena(4);
+    int* first = arena.allocate(3);
+    arena.allocate(3); // does not fit, goes to the next chunk
+    ASSERT_EQ(8, arena.capacity());
+
+    arena.clear();
+    ASSERT_EQ(0, arena.size());
+    ASSERT_EQ(first, arena.allocate(3));
+    ASSERT_EQ(8, arena.capacity());
+    ASSERT_THROW(arena.allocate(5), std::length_error);
+  }
+
+  TEST(recycling_pool_test, released_records_are_reused) {
+    recycling_pool<record> pool(4);
+    record* a = pool.allocate();
+    record* b = pool.allocate();
+    ASSERT_EQ(2, pool.size());
+
+    pool.release(a);
+    ASSERT_EQ(1, pool.size());
+    ASSERT_EQ(a, pool.allocate());
+    ASSERT_NE(b, pool.allocate());
+    ASSERT_EQ(3, pool.size());
+    ASSERT_EQ(4, pool.capacity());
+
+    pool.clear();
+    ASSERT_EQ(0, pool.size());
+  }
+}
@@ -0,0 +1,234 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <fst/vector-fst.h>
+#include <spin/fscorer/frame_scorer.hpp>
+#include <spin/io/fst.hpp>
+#include <spin/decode/decoder.hpp>
+
+namespace {
+  using namespace spin;
+
+  // Scores are given as features, one row per HMM state
+  class feature_scorer : public frame_scorer {
+    fmatrix _frames;
+  public:
+    virtual void set_frames(const fmatrix& f) { _frames = f; }
+    virtual void append_frames(const fmatrix& f) {
+      int T = _frames.cols();
+      _frames.conservativeResize(f.rows(), T + f.cols());
+      _frames.rightCols(f.cols()) = f;
+    }
+    virtual float get_score(int t, int s) { return _frames(s, t); }
+    virtual size_t nstates() const { return 2; }
+  };
+
+  // loop of two one-state words, "a" on S0 and "b" on S1
+  void make_network(fst::StdVectorFst* pnet) {
+    fst::SymbolTable isyms, osyms;
+    isyms.AddSymbol("<eps>", 0);
+    isyms.AddSymbol("S0;a;0", 1);
+    isyms.AddSymbol("S1;b;0", 2);
+    osyms.AddSymbol("<eps>", 0);
+    osyms.AddSymbol("a", 1);
+    osyms.AddSymbol("b", 2);
+
+    fst::StdVectorFst& net = *pnet;
+    for (int n = 0; n < 3; ++ n) net.AddState();
+    net.SetStart(0);
+    net.AddArc(0, fst::StdArc(1, 1, 1.0, 1));
+    net.AddArc(0, fst::StdArc(2, 2, 1.0, 2));
+    net.AddArc(1, fst::StdArc(0, 0, 0.0, 0));
+    net.AddArc(2, fst::StdArc(0, 0, 0.0, 0));
+    net.SetFinal(0, 0.0);
+    net.SetInputSymbols(&isyms);
+    net.SetOutputSymbols(&osyms);
+  }
+
+  // "a" for 6 frames then "b" for 6 frames
+  fmatrix make_scores() {
+    fmatrix scores(2, 12);
+    for (int t = 0; t < 12; ++ t) {
+      scores(0, t) = (t < 6) ? -1.0 : -20.0;
+      scores(1, t) = (t < 6) ? -20.0 : -1.0;
+    }
+    return scores;
+  }
+
+  TEST(decode_decoder_test, streaming) {
+    fst::StdVectorFst net;
+    make_network(&net);
+    fmatrix scores = make_scores();
+
+    feature_scorer scorer;
+    decoder dec(net, &scorer);
+    dec.set_acoustic_scale(1.0);
+    dec.set_beam_width(100.0);
+
+    dec.push_init();
+    dec.push_input(scores);
+    std::vector<std::string> batch;
+    float batchweight = dec.best_partial(&batch);
+    ASSERT_EQ(2, batch.size());
+    ASSERT_EQ("a", batch[0]);
+    ASSERT_EQ("b", batch[1]);
+
+    dec.push_init();
+    std::vector<std::string> words, stable;
+    dec.push_chunk(scores.leftCols(4));
+    dec.best_partial(&words);
+    ASSERT_EQ(1, words.size());
+    ASSERT_EQ("a", words[0]);
+
+    dec.push_chunk(scores.middleCols(4, 5));
+    dec.stable_prefix(&stable);
+    dec.best_partial(&words);
+    ASSERT_LE(1, stable.size());
+    ASSERT_GE(words.size(), stable.size());
+    ASSERT_TRUE(std::equal(stable.begin(), stable.end(), words.begin()));
+
+    dec.push_chunk(scores.rightCols(3));
+    float weight = dec.best_partial(&words);
+    ASSERT_EQ(batch, words);
+    ASSERT_NEAR(batchweight, weight, 1e-4);
+    ASSERT_TRUE(dec.push_final());
+  }
+
+  TEST(decode_decoder_test, best_path_mode) {
+    fst::StdVectorFst net;
+    make_network(&net);
+    fmatrix scores = make_scores();
+
+    feature_scorer scorer;
+    decoder dec(net, &scorer), ref(net, &scorer);
+    dec.set_acoustic_scale(1.0);
+    dec.set_beam_width(100.0);
+    dec.set_best_path_mode(true);
+    ref.set_acoustic_scale(1.0);
+    ref.set_beam_width(100.0);
+
+    ref.push_init();
+    ref.push_input(scores);
+    ASSERT_TRUE(ref.push_final());
+    std::vector<std::string> refwords;
+    float refweight = ref.best_path(&refwords);
+
+    dec.push_init();
+    dec.push_chunk(scores.leftCols(9));
+    std::vector<std::string> words, stable;
+    dec.best_partial(&words);
+    dec.stable_prefix(&stable);
+    ASSERT_LE(1, stable.size());
+    ASSERT_TRUE(std::equal(stable.begin(), stable.end(), words.begin()));
+
+    dec.push_chunk(scores.rightCols(3));
+    ASSERT_TRUE(dec.push_final());
+    float weight = dec.best_path(&words);
+    ASSERT_EQ(refwords, words);
+    ASSERT_NEAR(refweight, weight, 1e-4);
+
+    Lattice lattice;
+    ASSERT_THROW(dec.extract_lattice(&lattice, 1), std::runtime_error);
+  }
+
+  TEST(decode_decoder_test, max_active) {
+    fst::StdVectorFst net;
+    make_network(&net);
+    fmatrix scores = make_scores();
+
+    feature_scorer scorer;
+    decoder dec(net, &scorer);
+    dec.set_acoustic_scale(1.0);
+    dec.set_beam_width(100.0);
+
+    dec.push_init();
+    dec.push_chunk(scores.leftCols(3));
+    ASSERT_EQ(2, dec.active_hypos().size());
+
+    dec.set_max_active(1);
+    dec.push_chunk(scores.middleCols(3, 9));
+    ASSERT_EQ(1, dec.active_hypos().size());
+    std::vector<std::string> words;
+    dec.best_partial(&words);
+    ASSERT_EQ("b", words.back());
+  }
+
+  TEST(decode_decoder_test, signature) {
+    // histories differing only in the first word must not collide
+    std::vector<fst::StdArc> arcs1, arcs2;
+    for (int n = 0; n < 6; ++ n) {
+      arcs1.push_back(fst::StdArc(0, n == 0 ? 1 : 3, 0.0, 0));
+      arcs2.push_back(fst::StdArc(0, n == 0 ? 2 : 3, 0.0, 0));
+    }
+    ASSERT_NE(decoder::update_signature(0, &arcs1[0], arcs1.size()),
+              decoder::update_signature(0, &arcs2[0], arcs2.size()));
+
+    // epsilons do not change the signature, and the order matters
+    fst::StdArc eps(0, 0, 0.0, 0);
+    uint64_t sign = decoder::update_signature(0, &arcs1[0], 1);
+    ASSERT_EQ(sign, decoder::update_signature(sign, &eps, 1));
+    fst::StdArc ab[] = {fst::StdArc(0, 1, 0.0, 0), fst::StdArc(0, 2, 0.0, 0)};
+    fst::StdArc ba[] = {ab[1], ab[0]};
+    ASSERT_NE(decoder::update_signature(0, ab, 2),
+              decoder::update_signature(0, ba, 2));
+  }
+
+  TEST(decode_decoder_test, lm_lookahead) {
+    fst::StdVectorFst net;
+    make_network(&net);
+    fmatrix scores = make_scores();
+
+    feature_scorer scorer;
+    decoder dec(net, &scorer);
+    dec.set_acoustic_scale(1.0);
+    dec.set_beam_width(100.0);
+    dec.set_lm_lookahead(true);
+    dec.set_word_end_beam(50.0);
+
+    dec.push_init();
+    dec.push_input(scores);
+    ASSERT_TRUE(dec.push_final());
+    std::vector<std::string> words;
+    dec.best_path(&words);
+    ASSERT_EQ(2, words.size());
+    ASSERT_EQ("a", words[0]);
+    ASSERT_EQ("b", words[1]);
+
+    // candidates entering a word are dropped by a zero word-end beam unless
+    // they are the best
+    dec.set_word_end_beam(0.0);
+    dec.push_init();
+    dec.push_chunk(scores.leftCols(1));
+    ASSERT_EQ(1, dec.active_hypos().size());
+  }
+
+  TEST(decode_decoder_test, adaptive_beam) {
+    fst::StdVectorFst net;
+    make_network(&net);
+    fmatrix scores = make_scores();
+
+    feature_scorer scorer;
+    decoder dec(net, &scorer);
+    dec.set_acoustic_scale(1.0);
+    dec.set_beam_width(100.0);
+    dec.set_adaptive_beam(1, 5.0, 100.0);
+
+    dec.push_init();
+    dec.push_input(scores);
+    ASSERT_EQ(12, dec.beam_trajectory().size());
+    ASSERT_EQ(12, dec.active_trajectory().size());
+    ASSERT_EQ(100.0, dec.beam_trajectory()[0]);
+    // the beam shrinks while more than one hypothesis survives
+    ASSERT_LT(dec.beam_trajectory().back(), 100.0);
+    ASSERT_LE(5.0, dec.beam_trajectory().back());
+    ASSERT_EQ(1, dec.active_trajectory().back());
+
+    // the configured beam is restored for the next utterance
+    dec.push_init();
+    dec.push_chunk(scores.leftCols(1));
+    ASSERT_EQ(100.0, dec.beam_trajectory()[0]);
+  }
+}
@@ -0,0 +1,31 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/decode/slot_map.hpp>
+
+namespace {
+  using namespace spin;
+
+  TEST(dense_slot_map_test, insert_and_clear) {
+    dense_slot_map map(8);
+    ASSERT_EQ(std::make_pair(0, true), map.insert(5));
+    ASSERT_EQ(std::make_pair(1, true), map.insert(2));
+    ASSERT_EQ(std::make_pair(0, false), map.insert(5));
+    ASSERT_EQ(2, map.size());
+    ASSERT_EQ(1, map.find(2));
+    ASSERT_EQ(-1, map.find(3));
+
+    map.clear();
+    ASSERT_EQ(0, map.size());
+    ASSERT_EQ(-1, map.find(5));
+    ASSERT_EQ(std::make_pair(0, true), map.insert(2));
+
+    map.reserve(16);
+    ASSERT_EQ(16, map.key_range());
+    ASSERT_EQ(0, map.find(2));
+    ASSERT_EQ(std::make_pair(1, true), map.insert(15));
+  }
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <fst/vector-fst.h>
+#include <spin/decode/transition_table.hpp>
+
+namespace {
+  using namespace spin;
+
+  void make_network(fst::StdVectorFst* pnet) {
+    fst::SymbolTable isyms, osyms;
+    isyms.AddSymbol("<eps>", 0);
+    isyms.AddSymbol("S0;a;0", 1);
+    isyms.AddSymbol("S1;b;0", 2);
+    osyms.AddSymbol("<eps>", 0);
+    osyms.AddSymbol("word", 1);
+
+    // 0 -eps-> 1 -S0-> 2 ; 0 -S1-> 3 ; 1 -eps-> 3 (final)
+    fst::StdVectorFst& net = *pnet;
+    for (int n = 0; n < 4; ++ n) net.AddState();
+    net.SetStart(0);
+    net.AddArc(0, fst::StdArc(0, 0, 0.5, 1));
+    net.AddArc(0, fst::StdArc(2, 1, 2.0, 3));
+    net.AddArc(1, fst::StdArc(1, 0, 1.0, 2));
+    net.AddArc(1, fst::StdArc(0, 0, 0.25, 3));
+    net.SetFinal(3, 3.0);
+    net.SetInputSymbols(&isyms);
+    net.SetOutputSymbols(&osyms);
+  }
+
+  TEST(decode_transition_table_test, epsilon_closure) {
+    fst::StdVectorFst net;
+    make_network(&net);
+
+    transition_table table(net);
+    ASSERT_EQ(0, table.start());
+    ASSERT_EQ(-1, table.hmm_state(0));
+    ASSERT_EQ(1, table.hmm_state(2));
+
+    auto range = table.emitting(0);
+    ASSERT_EQ(2, range.second - range.first);
+    const transition_table::entry& direct = range.first[0];
+    ASSERT_EQ(1, direct.narcs);
+    ASSERT_EQ(1, direct.next_hmm_state);
+    ASSERT_NEAR(2.0, direct.weight, 1e-6);
+    const transition_table::entry& eps = range.first[1];
+    ASSERT_EQ(2, eps.narcs);
+    ASSERT_EQ(0, eps.next_hmm_state);
+    ASSERT_NEAR(1.5, eps.weight, 1e-6);
+    ASSERT_EQ(0, table.arcs(eps)[0].ilabel);
+    ASSERT_EQ(2, table.arcs(eps)[1].nextstate);
+
+    range = table.emitting(3);
+    ASSERT_EQ(0, range.second - range.first);
+
+    // final transitions end with a dummy arc holding the final weight
+    range = table.final(0);
+    ASSERT_EQ(2, range.second - range.first);
+    for (auto it = range.first; it != range.second; ++ it) {
+      const auto& last = table.arcs(*it)[it->narcs - 1];
+      ASSERT_EQ(-1, last.nextstate);
+      ASSERT_NEAR(3.0, last.weight.Value(), 1e-6);
+    }
+    ASSERT_NEAR(5.0, range.first[0].weight, 1e-6);
+    ASSERT_NEAR(3.75, range.first[1].weight, 1e-6);
+  }
+
+  TEST(decode_transition_table_test, lookahead) {
+    fst::StdVectorFst net;
+    make_network(&net);
+    transition_table table(net);
+
+    ASSERT_NEAR(2.0, table.lookahead(0), 1e-6); // word arc
+    ASSERT_NEAR(3.25, table.lookahead(1), 1e-6); // epsilon to final
+    ASSERT_EQ(HUGE_VALF, table.lookahead(2)); // dead end
+    ASSERT_NEAR(3.0, table.lookahead(3), 1e-6);
+  }
+
+  TEST(decode_transition_table_test, graph_file) {
+    fst::StdVectorFst net;
+    make_network(&net);
+    transition_table table(net);
+    std::string path = ::testing::TempDir() + "test_graph.bin";
+    table.write(path);
+
+    transition_table_ptr loaded = transition_table::load(path);
+    ASSERT_EQ(table.start(), loaded->start());
+    ASSERT_EQ(table.num_states(), loaded->num_states());
+    ASSERT_EQ("S1;b;0", loaded->input_symbol(2));
+    ASSERT_EQ("word", loaded->output_symbol(1));
+    ASSERT_EQ("", loaded->output_symbol(5));
+    ASSERT_EQ(1, loaded->hmm_state(2));
+    ASSERT_NEAR(3.0, loaded->final_weight(3), 1e-6);
+    ASSERT_EQ(2, loaded->network_arcs(1).second - loaded->network_arcs(1).first);
+
+    for (int s = 0; s < table.num_states(); ++ s) {
+      auto r1 = table.emitting(s), r2 = loaded->emitting(s);
+      ASSERT_EQ(r1.second - r1.first, r2.second - r2.first);
+      for (; r1.first != r1.second; ++ r1.first, ++ r2.first) {
+        ASSERT_EQ(r1.first->narcs, r2.first->narcs);
+        ASSERT_EQ(r1.first->next_hmm_state, r2.first->next_hmm_state);
+        ASSERT_EQ(r1.first->weight, r2.first->weight);
+        for (int n = 0; n < r1.first->narcs; ++ n) {
+          ASSERT_EQ(table.arcs(*r1.first)[n].nextstate,
+                    loaded->arcs(*r2.first)[n].nextstate);
+        }
+      }
+      ASSERT_EQ(table.lookahead(s), loaded->lookahead(s));
+      auto f1 = table.final(s), f2 = loaded->final(s);
+      ASSERT_EQ(f1.second - f1.first, f2.second - f2.first);
+    }
+    std::remove(path.c_str());
+  }
+}
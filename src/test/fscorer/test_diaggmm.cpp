@@ -6,6 +6,7 @@
 #include "../testutil.hpp"
 #include <spin/fscorer/diaggmm.hpp>
 #include <spin/io/yaml.hpp>
+#include <cstdio>
 
 namespace {
   const char test_gmm[] = 
@@ -53,6 +54,264 @@ namespace {
     ASSERT_NEAR(-2.27795, scorer.get_score(0, 0), 0.0001);
     
   }
-  
+
+  TEST(fscorer_diaggmm_test, batch_scores) {
+    diagonal_GMM_parameter_ptr pparam(new diagonal_GMM_parameter(convert_to_variant(YAML::Load(test_gmm))));
+    diagonal_GMM_scorer scorer(pparam), ref(pparam);
+    fmatrix inp = fmatrix::Random(2, 20);
+    scorer.set_frames(inp);
+    ref.set_frames(inp);
+
+    std::vector<int> states;
+    states.push_back(1);
+    states.push_back(0);
+    states.push_back(1);
+    float out[3];
+    scorer.get_scores(3, states, out);
+    for (int n = 0; n < states.size(); ++ n) {
+      ASSERT_NEAR(ref.get_score(3, states[n]), out[n], 0.0001);
+    }
+
+    float outs[3 * 20];
+    scorer.get_scores(0, 20, states, outs);
+    for (int t = 0; t < 20; ++ t) {
+      for (int n = 0; n < states.size(); ++ n) {
+        ASSERT_NEAR(ref.get_score(t, states[n]), outs[t * 3 + n], 0.0001);
+      }
+    }
+  }
+
+  TEST(fscorer_diaggmm_test, append_frames) {
+    diagonal_GMM_parameter_ptr pparam(new diagonal_GMM_parameter(convert_to_variant(YAML::Load(test_gmm))));
+    diagonal_GMM_scorer scorer(pparam), ref(pparam);
+    fmatrix inp = fmatrix::Random(2, 20);
+    ref.set_frames(inp);
+
+    scorer.set_frames(inp.leftCols(5));
+    ASSERT_NEAR(ref.get_score(4, 1), scorer.get_score(4, 1), 0.0001);
+    scorer.append_frames(inp.middleCols(5, 10));
+    scorer.append_frames(inp.rightCols(5));
+    for (int t = 0; t < 20; ++ t) {
+      for (int s = 0; s < 2; ++ s) {
+        ASSERT_NEAR(ref.get_score(t, s), scorer.get_score(t, s), 0.0001);
+      }
+    }
+  }
+
+  TEST(fscorer_diaggmm_test, long_stream) {
+    // frames behind the cache window are discarded while streaming
+    diagonal_GMM_parameter_ptr pparam(new diagonal_GMM_parameter(convert_to_variant(YAML::Load(test_gmm))));
+    diagonal_GMM_scorer scorer(pparam), ref(pparam);
+    fmatrix inp = fmatrix::Random(2, 3);
+    scorer.set_frames(inp);
+    int maxcapacity = 0;
+    for (int t = 0; t < 3000; ++ t) {
+      if (t % 3 == 0 && t > 0) {
+        inp = fmatrix::Random(2, 3);
+        scorer.append_frames(inp);
+        maxcapacity = std::max(maxcapacity, scorer.buffer_capacity());
+      }
+      ref.set_frames(inp.middleCols(t % 3, 1));
+      ASSERT_NEAR(ref.get_score(0, 1), scorer.get_score(t, 1), 0.0001);
+    }
+    ASSERT_GT(scorer.begin_frame(), 2000);
+    ASSERT_LE(maxcapacity, 4 * (32 + 3));
+    ASSERT_THROW(scorer.get_score(0, 0), std::runtime_error);
+  }
+
+  TEST(fscorer_diaggmm_test, long_utterance) {
+    // frames beyond the cache window are scored again on request
+    diagonal_GMM_parameter_ptr pparam(new diagonal_GMM_parameter(convert_to_variant(YAML::Load(test_gmm))));
+    diagonal_GMM_scorer scorer(pparam), ref(pparam);
+    fmatrix inp = fmatrix::Random(2, 200);
+
+    std::vector<int> states;
+    states.push_back(1);
+    states.push_back(0);
+    std::vector<float> outs(2 * 200);
+    scorer.set_frames(inp);
+    scorer.get_scores(0, 200, states, &outs[0]);
+    for (int t = 199; t >= 0; t -= 7) {
+      ref.set_frames(inp.middleCols(t, 1));
+      ASSERT_NEAR(ref.get_score(0, 0), scorer.get_score(t, 0), 0.0001);
+      ASSERT_NEAR(ref.get_score(0, 0), outs[t * 2 + 1], 0.0001);
+      ASSERT_NEAR(ref.get_score(0, 1), outs[t * 2], 0.0001);
+    }
+
+    // scores of the previous utterance are not reused
+    fmatrix inp2 = fmatrix::Random(2, 5);
+    scorer.set_frames(inp2);
+    ref.set_frames(inp2);
+    ASSERT_NEAR(ref.get_score(3, 1), scorer.get_score(3, 1), 0.0001);
+  }
+
+  TEST(fscorer_diaggmm_test, multithreaded) {
+    // states sharing the Gaussians of test_gmm in various combinations
+    std::string yaml = "states:\n";
+    for (int s = 0; s < 40; ++ s) {
+      yaml += "  - means: [" + std::to_string(s % 4) + ", " +
+        std::to_string((s / 4) % 4) + "]\n";
+      yaml += "    vars:  [" + std::to_string((s + 1) % 4) + ", " +
+        std::to_string((s / 2) % 4) + "]\n";
+      yaml += "    weights: [0.5, 0.5]\n";
+    }
+    yaml += std::string(test_gmm).substr(std::string(test_gmm).find("means:\n"));
+    diagonal_GMM_parameter_ptr pparam(new diagonal_GMM_parameter(convert_to_variant(YAML::Load(yaml))));
+    diagonal_GMM_scorer scorer(pparam), ref(pparam);
+    scorer.set_num_threads(4);
+    fmatrix inp = fmatrix::Random(2, 50);
+    scorer.set_frames(inp);
+    ref.set_frames(inp);
+
+    std::vector<int> states;
+    for (int s = 39; s >= 0; -- s) states.push_back(s);
+    std::vector<float> out(states.size()), refout(states.size());
+    for (int t = 0; t < 50; ++ t) {
+      scorer.get_scores(t, states, &out[0]);
+      ref.get_scores(t, states, &refout[0]);
+      for (int n = 0; n < states.size(); ++ n) {
+        ASSERT_NEAR(refout[n], out[n], 0.0001);
+      }
+    }
+    std::shared_ptr<frame_scorer> forked = scorer.fork();
+    forked->set_frames(inp);
+    ASSERT_NEAR(ref.get_score(7, 13), forked->get_score(7, 13), 0.0001);
+  }
+
+  TEST(fscorer_diaggmm_test, compiled_kernel) {
+    diagonal_GMM_parameter_ptr pparam(new diagonal_GMM_parameter(convert_to_variant(YAML::Load(test_gmm))));
+    // widen the model so that the padded tail is exercised
+    int D = 37;
+    pparam->means() = fmatrix::Random(D, 4);
+    pparam->sqrtprecs() = (fmatrix::Random(D, 4).array() * 0.5 + 1.0).matrix();
+    pparam->logzs() = (- pparam->sqrtprecs().array().log().matrix().colwise().sum().array() + D * (0.5 * std::log(2.0 * M_PI))).matrix().transpose();
+    compiled_diagonal_GMM compiled(*pparam);
+
+    fmatrix feats = fmatrix::Random(D, 5);
+    std::vector<int> states;
+    states.push_back(0);
+    states.push_back(1);
+    fmatrix scores;
+    compiled.get_scores(feats, states, &scores);
+    ASSERT_EQ(2, scores.rows());
+    ASSERT_EQ(5, scores.cols());
+
+    for (int n = 0; n < states.size(); ++ n) {
+      int s = states[n];
+      fmatrix glogll;
+      pparam->get_gaussian_scores<float>(feats, pparam->means(s),
+                                         pparam->sqrtprecs(s),
+                                         pparam->logzs(s), &glogll);
+      glogll.colwise() += pparam->logweights(s);
+      fmatrix ref = log_sum_exp(glogll);
+      for (int t = 0; t < feats.cols(); ++ t) {
+        ASSERT_NEAR(ref(0, t), scores(n, t), 0.001);
+      }
+    }
+  }
+
+  TEST(fscorer_diaggmm_test, gaussian_selection) {
+    diagonal_GMM_parameter_ptr pparam(new diagonal_GMM_parameter(convert_to_variant(YAML::Load(test_gmm))));
+    fmatrix feats = fmatrix::Random(2, 8);
+    std::vector<int> states;
+    states.push_back(0);
+    states.push_back(1);
+    compiled_diagonal_GMM compiled(*pparam);
+    fmatrix full, selected;
+    compiled.get_scores(feats, states, &full);
+
+    // shortlists holding every mixture give the exact scores
+    gaussian_selection all;
+    all.build(*pparam, 2, 2, 5);
+    compiled.get_scores(feats, states, &selected, &all);
+    ASSERT_MATRIX_NEAR(full, selected, 0.0001);
+
+    gaussian_selection_ptr one(new gaussian_selection());
+    one->build(*pparam, 2, 1, 5);
+    compiled.get_scores(feats, states, &selected, one.get());
+    ASSERT_TRUE((selected.array() <= full.array() + 0.0001).all());
+
+    // table is saved with the model
+    pparam->set_gselect(one);
+    variant_t dest;
+    pparam->write(&dest);
+    diagonal_GMM_parameter loaded(dest);
+    ASSERT_TRUE(loaded.gselect());
+    ASSERT_EQ(one->ncodewords(), loaded.gselect()->ncodewords());
+    fmatrix reloaded;
+    compiled.get_scores(feats, states, &reloaded, loaded.gselect().get());
+    ASSERT_MATRIX_NEAR(selected, reloaded, 0.0001);
+  }
+  TEST(fscorer_diaggmm_test, statistics) {
+    diagonal_GMM_parameter param(convert_to_variant(YAML::Load(test_gmm)));
+    fmatrix feats = fmatrix::Random(2, 30);
+    diagonal_GMM_statistics stats(param), fstats(param), ref(param);
+    fstats.set_float_accumulation(true);
+    stats.accumulate(1, feats.block(0, 0, 2, 20), param);
+    fstats.accumulate(1, feats.block(0, 0, 2, 20), param);
+    stats.accumulate(0, feats.block(0, 20, 2, 10), param);
+    fstats.accumulate(0, feats.block(0, 20, 2, 10), param);
+
+    // per-frame reference
+    for (int t = 0; t < feats.cols(); ++ t) {
+      int s = t < 20 ? 1 : 0;
+      const diagonal_GMM_statedef& def = param.statedefs()[s];
+      dmatrix gll;
+      param.get_gaussian_scores<double>(feats.col(t), param.means(s),
+                                        param.sqrtprecs(s), param.logzs(s),
+                                        &gll);
+      dvector logjoint = gll.col(0) + def.logweights.cast<double>();
+      double framell = log_sum_exp(logjoint);
+      ref.get_loglikelihood() += framell;
+      dvector post = (logjoint.array() - framell).exp().matrix();
+      ref.get_zero().col(s) += post;
+      dvector x = feats.col(t).cast<double>();
+      for (int m = 0; m < post.size(); ++ m) {
+        ref.get_first().col(def.mean_ids[m]) += post(m) * x;
+        ref.get_second().col(def.var_ids[m]) += post(m) * x.cwiseAbs2();
+      }
+    }
+
+    ASSERT_NEAR(ref.get_loglikelihood(), stats.get_loglikelihood(), 1e-6);
+    ASSERT_NEAR(ref.get_loglikelihood(), fstats.get_loglikelihood(), 1e-6);
+    for (int i = 0; i < ref.get_zero().size(); ++ i) {
+      ASSERT_NEAR(ref.get_zero()(i), stats.get_zero()(i), 1e-6);
+      ASSERT_NEAR(ref.get_zero()(i), fstats.get_zero()(i), 1e-6);
+    }
+    for (int i = 0; i < ref.get_first().size(); ++ i) {
+      ASSERT_NEAR(ref.get_first()(i), stats.get_first()(i), 1e-6);
+      ASSERT_NEAR(ref.get_first()(i), fstats.get_first()(i), 1e-4);
+      ASSERT_NEAR(ref.get_second()(i), stats.get_second()(i), 1e-6);
+      ASSERT_NEAR(ref.get_second()(i), fstats.get_second()(i), 1e-4);
+    }
+
+    // merging keeps the log-likelihood
+    diagonal_GMM_statistics total(param);
+    total.accumulate(stats);
+    ASSERT_NEAR(stats.get_loglikelihood(), total.get_loglikelihood(), 1e-6);
+  }
+
+  TEST(fscorer_diaggmm_test, binary_statistics) {
+    diagonal_GMM_parameter param(convert_to_variant(YAML::Load(test_gmm)));
+    diagonal_GMM_statistics stats(param);
+    stats.accumulate(0, fmatrix::Random(2, 10), param);
+    stats.accumulate(1, fmatrix::Random(2, 5), param);
+    std::string path = ::testing::TempDir() + "test_gmmstat.bin";
+    stats.write_binary(path);
+    ASSERT_TRUE(diagonal_GMM_statistics::is_binary_file(path));
+
+    diagonal_GMM_statistics loaded;
+    loaded.load(path);
+    loaded.accumulate_binary(path);
+    ASSERT_DOUBLE_EQ(2 * stats.get_loglikelihood(),
+                     loaded.get_loglikelihood());
+    ASSERT_TRUE(loaded.get_zero().isApprox(2 * stats.get_zero()));
+    ASSERT_TRUE(loaded.get_first().isApprox(2 * stats.get_first()));
+    ASSERT_TRUE(loaded.get_second().isApprox(2 * stats.get_second()));
+
+    diagonal_GMM_statistics other(3, 1, 1, 1, 1);
+    ASSERT_THROW(other.accumulate_binary(path), std::runtime_error);
+    std::remove(path.c_str());
+  }
 
 }
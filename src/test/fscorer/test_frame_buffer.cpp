@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/fscorer/frame_buffer.hpp>
+
+namespace {
+  using namespace spin;
+
+  fmatrix make_frames(int t, int n) {
+    fmatrix ret(2, n);
+    for (int f = 0; f < n; ++ f) {
+      ret(0, f) = t + f;
+      ret(1, f) = - (t + f);
+    }
+    return ret;
+  }
+
+  TEST(sliding_frame_buffer_test, sliding) {
+    sliding_frame_buffer buffer;
+    buffer.reset(make_frames(0, 5));
+    ASSERT_EQ(0, buffer.begin_frame());
+    ASSERT_EQ(5, buffer.end_frame());
+
+    // keep 8 frames of a long stream appended in small chunks
+    int maxcapacity = 0;
+    for (int t = 5; t < 10000; t += 3) {
+      buffer.discard_before(t - 8);
+      buffer.append(make_frames(t, 3));
+      maxcapacity = std::max(maxcapacity, buffer.capacity());
+      ASSERT_EQ(t + 3, buffer.end_frame());
+      for (int f = buffer.begin_frame(); f < buffer.end_frame(); ++ f) {
+        ASSERT_EQ(f, buffer(0, f));
+        ASSERT_EQ(- f, buffer(1, f));
+      }
+    }
+    ASSERT_FALSE(buffer.contains(0));
+    ASSERT_LE(maxcapacity, 4 * (8 + 3));
+
+    fmatrix tail = buffer.frames(buffer.end_frame() - 4, 4);
+    ASSERT_MATRIX_NEAR(make_frames(buffer.end_frame() - 4, 4), tail, 0.0);
+
+    buffer.discard_before(buffer.end_frame());
+    ASSERT_EQ(0, buffer.size());
+    int t = buffer.end_frame();
+    buffer.append(make_frames(t, 2));
+    ASSERT_EQ(t, buffer.begin_frame());
+    ASSERT_EQ(t + 1, buffer(0, t + 1));
+
+    // the dimension may change only while empty
+    buffer.clear();
+    ASSERT_EQ(0, buffer.end_frame());
+    buffer.append(fmatrix::Zero(3, 1));
+    ASSERT_EQ(3, buffer.rows());
+    ASSERT_THROW(buffer.append(fmatrix::Zero(2, 1)), std::runtime_error);
+  }
+}
@@ -0,0 +1,33 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/fscorer/score_cache.hpp>
+
+namespace {
+  using namespace spin;
+
+  TEST(windowed_score_cache_test, window_and_reset) {
+    windowed_score_cache cache(3, 4);
+    ASSERT_FALSE(cache.contains(0, 1));
+    cache.set(0, 1, -1.5);
+    cache.set(3, 1, -2.5);
+    ASSERT_TRUE(cache.contains(0, 1));
+    ASSERT_EQ(-1.5, cache.get(0, 1));
+    ASSERT_FALSE(cache.contains(0, 2));
+
+    cache.set(4, 1, -3.5); // evicts frame 0
+    ASSERT_FALSE(cache.contains(0, 1));
+    ASSERT_TRUE(cache.contains(4, 1));
+    ASSERT_TRUE(cache.contains(3, 1));
+
+    cache.reset();
+    ASSERT_FALSE(cache.contains(3, 1));
+    ASSERT_FALSE(cache.contains(4, 1));
+    cache.set(3, 1, -4.5);
+    ASSERT_TRUE(cache.contains(3, 1));
+    ASSERT_EQ(-4.5, cache.get(3, 1));
+  }
+}
@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/hmm/compiled_tree.hpp>
+#include <spin/io/yaml.hpp>
+#include <spin/parallel.hpp>
+
+namespace {
+  const char test_YAML[] = "categories:\n"
+    "  \"sil\": [\"sil\"]\n"
+    "  \"vowel\": [\"a\", \"i\", \"u\"]\n"
+    "  \"front\": [\"i\", \"e\"]\n"
+    "  \"k\": [\"k\"]\n"
+    "contextLengths: [1, 1]\n"
+    "root:\n"
+    "  - question: {qtype: \"context\", category: \"sil\", context: 0}\n"
+    "    isTrue: {leaf: 0, nosplit: false}\n"
+    "  - question: {qtype: \"context\", category: \"vowel\", context: -1}\n"
+    "    isTrue:\n"
+    "      question: {qtype: \"location\", value: 0}\n"
+    "      isTrue: {leaf: 1, nosplit: false}\n"
+    "      isFalse:\n"
+    "        question: {qtype: \"context\", category: \"front\", context: 1}\n"
+    "        isTrue: {leaf: 2, nosplit: false}\n"
+    "        isFalse: {leaf: 3, nosplit: false}\n"
+    "  - question: {qtype: \"context\", category: \"front\", context: 0}\n"
+    "    isTrue:\n"
+    "      question: {qtype: \"location\", value: 2}\n"
+    "      isTrue: {leaf: 4, nosplit: false}\n"
+    "      isFalse: {leaf: 5, nosplit: false}\n"
+    "  - question: {qtype: \"context\", category: \"k\", context: 1}\n"
+    "    isTrue: {leaf: 6, nosplit: false}\n"
+    "\n";
+
+  using namespace spin;
+
+  TEST(hmm_compiled_tree_test, resolve) {
+    context_decision_tree tree(convert_to_variant(YAML::Load(test_YAML)));
+    compiled_decision_tree compiled(tree);
+    ASSERT_EQ(3, compiled.npositions());
+    ASSERT_EQ(compiled_decision_tree::CONTEXT, compiled.get_node(0).type);
+
+    // phones out of any category, including one interned after compilation
+    const char* phones[] = { "sil", "a", "i", "u", "e", "k", "", "o" };
+    std::vector<packed_context> ctxs;
+    std::vector<int> expected;
+    for (int l = 0; l < 8; ++ l) {
+      for (int c = 0; c < 8; ++ c) {
+        for (int r = 0; r < 8; ++ r) {
+          for (int loc = 0; loc < 3; ++ loc) {
+            HMM_context ctx;
+            ctx.label.push_back(phones[l]);
+            ctx.label.push_back(phones[c]);
+            ctx.label.push_back(phones[r]);
+            ctx.loc = loc;
+            int st;
+            try {
+              st = tree.resolve(ctx);
+            } catch (const std::runtime_error&) {
+              ASSERT_THROW(compiled.resolve(ctx.pack()), std::runtime_error);
+              continue;
+            }
+            ASSERT_EQ(st, compiled.resolve(ctx.pack()));
+            ctxs.push_back(ctx.pack());
+            expected.push_back(st);
+          }
+        }
+      }
+    }
+    ASSERT_LT(1000, expected.size());
+
+    std::vector<int> leaves;
+    compiled.resolve_many(ctxs, &leaves);
+    ASSERT_EQ(expected, leaves);
+
+    worker_pool pool(3);
+    std::vector<int> pleaves;
+    compiled.resolve_many(ctxs, &pleaves, &pool);
+    ASSERT_EQ(expected, pleaves);
+
+    // context shorter than the tree
+    HMM_context shortctx;
+    shortctx.label.push_back("a");
+    shortctx.loc = 0;
+    ASSERT_THROW(compiled.resolve(shortctx.pack()), std::runtime_error);
+  }
+}
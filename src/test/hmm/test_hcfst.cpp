@@ -0,0 +1,223 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/hmm/hcfst.hpp>
+#include <spin/io/yaml.hpp>
+#include <boost/lexical_cast.hpp>
+#include <set>
+
+namespace {
+  const char test_YAML[] = "categories:\n"
+    "  \"sil\": [\"sil\"]\n"
+    "  \"vowel\": [\"a\", \"i\"]\n"
+    "  \"k\": [\"k\"]\n"
+    "  \"t\": [\"t\"]\n"
+    "contextLengths: [1, 1]\n"
+    "root:\n"
+    "  - question: {qtype: \"context\", category: \"sil\", context: 0}\n"
+    "    isTrue: {leaf: 0, nosplit: false}\n"
+    "  - question: {qtype: \"context\", category: \"vowel\", context: 0}\n"
+    "    isTrue:\n"
+    "      - question: {qtype: \"context\", category: \"k\", context: -1}\n"
+    "        isTrue: {leaf: 1, nosplit: false}\n"
+    "        isFalse: {leaf: 2, nosplit: false}\n"
+    "  - question: {qtype: \"location\", value: 2}\n"
+    "    isTrue:\n"
+    "      - question: {qtype: \"context\", category: \"vowel\", context: 1}\n"
+    "        isTrue: {leaf: 3, nosplit: false}\n"
+    "        isFalse: {leaf: 4, nosplit: false}\n"
+    "  - question: {qtype: \"context\", category: \"k\", context: 0}\n"
+    "    isTrue: {leaf: 5, nosplit: false}\n"
+    "    isFalse: {leaf: 6, nosplit: false}\n"
+    "\n";
+
+  using namespace spin;
+
+  const int NSTATE = 3;
+
+  std::vector<std::string> split_phones(const std::string& s) {
+    std::vector<std::string> ret;
+    boost::algorithm::split(ret, s, boost::is_any_of(" "));
+    return ret;
+  }
+
+  // input symbols expected for the phones
+  std::vector<std::string> hmm_input(const context_decision_tree& tree,
+                                     const std::vector<std::string>& phones) {
+    std::vector<std::string> padded(1, "");
+    padded.insert(padded.end(), phones.begin(), phones.end());
+    padded.push_back("");
+    std::vector<std::string> ret;
+    for (size_t i = 1; i + 1 < padded.size(); ++ i) {
+      HMM_context ctx;
+      ctx.label.assign(padded.begin() + i - 1, padded.begin() + i + 2);
+      for (ctx.loc = 0; ctx.loc < NSTATE; ++ ctx.loc) {
+        ret.push_back("S" + boost::lexical_cast<std::string>(tree.resolve(ctx))
+                      + ";" + padded[i] + ";"
+                      + boost::lexical_cast<std::string>(ctx.loc));
+      }
+      ret.push_back("#]" + padded[i]);
+    }
+    return ret;
+  }
+
+  void search(const fst::StdVectorFst& fst, int s,
+              const std::vector<int>& input, size_t pos,
+              std::vector<std::string>* output,
+              std::set<std::vector<std::string> >* results) {
+    if (pos == input.size() && fst.Final(s) != fst::TropicalWeight::Zero()) {
+      results->insert(*output);
+    }
+    for (fst::ArcIterator<fst::StdVectorFst> aiter(fst, s);
+         ! aiter.Done(); aiter.Next()) {
+      const fst::StdArc& arc = aiter.Value();
+      if (arc.ilabel != 0 && (pos == input.size() || arc.ilabel != input[pos])) {
+        continue;
+      }
+      if (arc.olabel != 0) {
+        output->push_back(fst.OutputSymbols()->Find(arc.olabel));
+      }
+      search(fst, arc.nextstate, input, arc.ilabel == 0 ? pos : pos + 1,
+             output, results);
+      if (arc.olabel != 0) output->pop_back();
+    }
+  }
+
+  // check if the FST transduces the HMM states of the phones to the phones
+  bool transduces(const fst::StdVectorFst& fst,
+                  const context_decision_tree& tree,
+                  const std::vector<std::string>& phones) {
+    std::vector<std::string> symbols = hmm_input(tree, phones);
+    std::vector<int> input;
+    for (size_t i = 0; i < symbols.size(); ++ i) {
+      int label = fst.InputSymbols()->Find(symbols[i]);
+      if (label < 0) return false;
+      input.push_back(label);
+    }
+    std::set<std::vector<std::string> > results;
+    std::vector<std::string> output;
+    search(fst, fst.Start(), input, 0, &output, &results);
+    return results.size() == 1 && *results.begin() == phones;
+  }
+
+  bool transduces(const fst::StdVectorFst& fst,
+                  const context_decision_tree& tree, const std::string& s) {
+    return transduces(fst, tree, split_phones(s));
+  }
+
+  class license_all : public context_license {
+  public:
+    bool licensed(const std::vector<int>& window) const { return true; }
+  };
+
+  TEST(hmm_hcfst_test, phone_pairs) {
+    context_decision_tree tree(convert_to_variant(YAML::Load(test_YAML)));
+    phone_pair_license license;
+    license.add_pronunciation(split_phones("sil"));
+    license.add_pronunciation(split_phones("k a"));
+    license.add_pronunciation(split_phones("t a"));
+    license.add_pronunciation(split_phones("a k i"));
+
+    fst::StdVectorFst fst;
+    std::vector<std::string> disamb(1, "#1");
+    build_HC_FST(tree, NSTATE, disamb, license, &fst);
+
+    ASSERT_TRUE(transduces(fst, tree, "sil k a t a sil"));
+    ASSERT_TRUE(transduces(fst, tree, "a k i k a"));
+    ASSERT_TRUE(transduces(fst, tree, "k a"));
+    ASSERT_FALSE(transduces(fst, tree, "t i")); // not within or across words
+    ASSERT_FALSE(transduces(fst, tree, "k")); // k never ends a word
+
+    // chains are shared while the leaves agree, so there are fewer HMM
+    // states than NSTATE per window
+    int nwindows = 0, nhmmstates = 0;
+    for (fst::StateIterator<fst::StdVectorFst> siter(fst);
+         ! siter.Done(); siter.Next()) {
+      for (fst::ArcIterator<fst::StdVectorFst> aiter(fst, siter.Value());
+           ! aiter.Done(); aiter.Next()) {
+        std::string isym = fst.InputSymbols()->Find(aiter.Value().ilabel);
+        if (isym[0] == 'S') ++ nhmmstates;
+        if (isym[0] == '#' && isym[1] == ']') ++ nwindows;
+      }
+    }
+    ASSERT_LT(nhmmstates, nwindows * NSTATE);
+  }
+
+  TEST(hmm_hcfst_test, whitelist) {
+    context_decision_tree tree(convert_to_variant(YAML::Load(test_YAML)));
+    context_whitelist license;
+    const char* observed[] = { "sil k a sil", "sil t a k i sil" };
+    for (int n = 0; n < 2; ++ n) {
+      std::vector<std::string> padded(1, "");
+      std::vector<std::string> phones = split_phones(observed[n]);
+      padded.insert(padded.end(), phones.begin(), phones.end());
+      padded.push_back("");
+      for (size_t i = 1; i + 1 < padded.size(); ++ i) {
+        HMM_context ctx;
+        ctx.label.assign(padded.begin() + i - 1, padded.begin() + i + 2);
+        ctx.loc = i % NSTATE;
+        license.add(ctx.pack());
+      }
+    }
+    ASSERT_EQ(10, license.size());
+
+    fst::StdVectorFst fst;
+    build_HC_FST(tree, NSTATE, std::vector<std::string>(), license, &fst);
+    ASSERT_TRUE(transduces(fst, tree, "sil k a sil"));
+    ASSERT_TRUE(transduces(fst, tree, "sil t a k i sil"));
+    ASSERT_FALSE(transduces(fst, tree, "sil t a sil")); // (t a sil) unseen
+    ASSERT_FALSE(transduces(fst, tree, "sil k a k i sil"));
+    ASSERT_FALSE(transduces(fst, tree, "k a"));
+  }
+
+  TEST(hmm_hcfst_test, same_as_full_expansion) {
+    context_decision_tree tree(convert_to_variant(YAML::Load(test_YAML)));
+    std::vector<std::string> disamb(1, "#1");
+    fst::StdVectorFst fst;
+    build_HC_FST(tree, NSTATE, disamb, license_all(), &fst);
+    fst::script::VectorFstClass full = tree.create_HC_FST(NSTATE, disamb);
+    const fst::StdVectorFst& ref =
+      *static_cast<const fst::StdVectorFst*>(full.GetFst<fst::StdArc>());
+
+    // all the phone sequences up to 3 phones
+    std::set<std::string> labset;
+    tree.obtain_label_set(&labset);
+    std::vector<std::string> labs(labset.begin(), labset.end());
+    std::vector<std::vector<std::string> > seqs(1);
+    for (size_t begin = 0, len = 0; len < 3; ++ len) {
+      size_t end = seqs.size();
+      for (size_t i = begin; i < end; ++ i) {
+        for (size_t x = 0; x < labs.size(); ++ x) {
+          seqs.push_back(seqs[i]);
+          seqs.back().push_back(labs[x]);
+        }
+      }
+      begin = end;
+    }
+    ASSERT_EQ(1 + 5 + 25 + 125, seqs.size());
+    ASSERT_FALSE(transduces(ref, tree, seqs[0])); // no empty path in either
+    ASSERT_FALSE(transduces(fst, tree, seqs[0]));
+    for (size_t i = 1; i < seqs.size(); ++ i) {
+      ASSERT_TRUE(transduces(ref, tree, seqs[i]));
+      ASSERT_TRUE(transduces(fst, tree, seqs[i]));
+    }
+    // input of an unrelated window is rejected by both
+    std::vector<std::string> phones = split_phones("k a");
+    std::vector<std::string> symbols = hmm_input(tree, phones);
+    std::swap(symbols[0], symbols[NSTATE + 1]);
+    for (int n = 0; n < 2; ++ n) {
+      const fst::StdVectorFst& f = (n == 0) ? ref : fst;
+      std::vector<int> input;
+      for (size_t i = 0; i < symbols.size(); ++ i) {
+        input.push_back(f.InputSymbols()->Find(symbols[i]));
+      }
+      std::set<std::vector<std::string> > results;
+      std::vector<std::string> output;
+      search(f, f.Start(), input, 0, &output, &results);
+      ASSERT_TRUE(results.empty());
+    }
+  }
+}
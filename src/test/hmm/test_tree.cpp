@@ -59,6 +59,11 @@ namespace {
     ASSERT_EQ(4, ptree->resolve(ctx));
     ctx.loc = 2;
     ASSERT_EQ(5, ptree->resolve(ctx));
+    ASSERT_EQ(5, ptree->resolve(ctx.pack()));
+    ctx.label[0] = "aa";
+    ctx.loc = 0;
+    ASSERT_EQ(6, ptree->resolve(ctx));
+    ASSERT_EQ(6, ptree->resolve(ctx.pack()));
 
 
     delete ptree;
@@ -0,0 +1,137 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/hmm/tree_split.hpp>
+#include <spin/io/yaml.hpp>
+#include <spin/parallel.hpp>
+
+namespace {
+  const char test_YAML[] = "categories:\n"
+    "  \"sil\": [\"sil\"]\n"
+    "  \"vowel\": [\"a\", \"i\", \"u\"]\n"
+    "  \"front\": [\"i\", \"e\"]\n"
+    "  \"a\": [\"a\"]\n"
+    "  \"k\": [\"k\"]\n"
+    "  \"unseen\": [\"zz\"]\n"
+    "contextLengths: [1, 1]\n"
+    "root: {leaf: 0, nosplit: false}\n"
+    "\n";
+
+  using namespace spin;
+
+  tree_statistics make_stats(int ncontexts) {
+    std::srand(3);
+    tree_statistics stats;
+    stats.set_left_context_length(1);
+    stats.set_right_context_length(1);
+    const char* phones[] = { "sil", "a", "i", "u", "e", "k" };
+    for (int n = 0; n < ncontexts; ++ n) {
+      HMM_context ctx;
+      for (int p = 0; p < 3; ++ p) ctx.label.push_back(phones[std::rand() % 6]);
+      ctx.loc = std::rand() % 3;
+      // shift the mean by the phones so that questions make a difference
+      fmatrix feats = fmatrix::Random(2, 5 + std::rand() % 20);
+      feats.row(0).array() += ctx.label[0] == "a" ? 1.0 : 0.0;
+      feats.row(1).array() += ctx.label[2][0] == 'i' ? 0.5 : 0.0;
+      feats.row(1).array() += ctx.loc * 0.3;
+      stats.accumulate(ctx, feats);
+    }
+    return stats;
+  }
+
+  // serial search with the questions of the tree
+  double reference_search(const context_decision_tree& tree,
+                          const tree_statistics& stats,
+                          const std::vector<int>& entries,
+                          const tree_split_engine& engine, int minocc,
+                          tree_question_ptr* pbest) {
+    std::vector<tree_question_ptr> questions;
+    for (int ctx = - tree.left_context_length();
+         ctx <= tree.right_context_length(); ++ ctx) {
+      for (auto cit = tree.categories().begin(), clast = tree.categories().end();
+           cit != clast; ++ cit) {
+        questions.push_back(tree_question_ptr(new context_question(tree,
+                                                                   cit->first,
+                                                                   ctx)));
+      }
+    }
+    for (int loc = 0; loc < 3; ++ loc) {
+      questions.push_back(tree_question_ptr(new location_question(tree, loc)));
+    }
+
+    double maxgain = 0.0;
+    for (size_t q = 0; q < questions.size(); ++ q) {
+      tree_Gaussian_statistics all, is_true, is_false;
+      for (size_t n = 0; n < entries.size(); ++ n) {
+        const tree_Gaussian_statistics& st = engine.statistics(entries[n]);
+        all.accumulate(st);
+        if (questions[q]->question(engine.context(entries[n]))) {
+          is_true.accumulate(st);
+        } else {
+          is_false.accumulate(st);
+        }
+      }
+      if (is_true.zero < minocc || is_false.zero < minocc) continue;
+      double gain = is_true.data_loglikelihood()
+        + is_false.data_loglikelihood() - all.data_loglikelihood();
+      if (gain > maxgain) {
+        maxgain = gain;
+        *pbest = questions[q];
+      }
+    }
+    return maxgain;
+  }
+
+  TEST(hmm_tree_split_test, best_question) {
+    context_decision_tree tree(convert_to_variant(YAML::Load(test_YAML)));
+    tree_statistics stats = make_stats(300);
+    tree_split_engine engine(tree, stats);
+    ASSERT_EQ(stats.size(), engine.size());
+
+    std::map<const context_decision_tree_node*, std::vector<int> > membership;
+    engine.compute_membership(&membership);
+    ASSERT_EQ(1, membership.size());
+    const std::vector<int>& all = membership[tree.root()];
+    ASSERT_EQ(engine.size(), all.size());
+
+    // a leaf and its subsets
+    std::vector<std::vector<int> > leaves(1, all);
+    leaves.push_back(std::vector<int>(all.begin(), all.begin() + 40));
+    leaves.push_back(std::vector<int>(all.begin() + 100, all.end()));
+
+    worker_pool pool(3);
+    for (size_t l = 0; l < leaves.size(); ++ l) {
+      tree_question_ptr refq;
+      double refgain = reference_search(tree, stats, leaves[l], engine, 50,
+                                        &refq);
+      double gain, pgain;
+      split_question q = engine.find_best_question(leaves[l], 50, &gain);
+      split_question pq = engine.find_best_question(leaves[l], 50, &pgain,
+                                                    &pool);
+      ASSERT_NEAR(refgain, gain, 1e-6 * std::max(1.0, refgain));
+      ASSERT_NEAR(refgain, pgain, 1e-6 * std::max(1.0, refgain));
+      ASSERT_EQ(q.type, pq.type);
+      ASSERT_EQ(q.position, pq.position);
+      ASSERT_EQ(q.category, pq.category);
+      ASSERT_EQ(q.location, pq.location);
+      ASSERT_GT(gain, 0.0);
+
+      tree_question_ptr made = engine.make_question(q);
+      for (size_t n = 0; n < leaves[l].size(); ++ n) {
+        int e = leaves[l][n];
+        ASSERT_EQ(refq->question(engine.context(e)), engine.answer(q, e));
+        ASSERT_EQ(made->question(engine.context(e)), engine.answer(q, e));
+      }
+    }
+
+    // nothing to split if minocc can't be satisfied
+    double gain;
+    split_question q = engine.find_best_question(leaves[1], 1000000, &gain);
+    ASSERT_EQ(split_question::NONE, q.type);
+    ASSERT_EQ(0.0, gain);
+    ASSERT_FALSE(engine.make_question(q));
+  }
+}
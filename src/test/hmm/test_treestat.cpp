@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/hmm/treestat.hpp>
+#include <cstdio>
+#include <set>
+
+namespace {
+  using namespace spin;
+
+  HMM_context make_context(const std::string& l, const std::string& c,
+                           const std::string& r, int loc) {
+    HMM_context ctx;
+    ctx.label.push_back(l);
+    ctx.label.push_back(c);
+    ctx.label.push_back(r);
+    ctx.loc = loc;
+    return ctx;
+  }
+
+  tree_statistics make_stats(int seed, int ncontexts) {
+    std::srand(seed);
+    tree_statistics stats;
+    stats.set_left_context_length(1);
+    stats.set_right_context_length(1);
+    const char* phones[] = { "a", "i", "u", "e", "o", "" };
+    for (int n = 0; n < ncontexts; ++ n) {
+      HMM_context ctx = make_context(phones[std::rand() % 6],
+                                     phones[std::rand() % 5],
+                                     phones[std::rand() % 6],
+                                     std::rand() % 3);
+      stats.accumulate(ctx, fmatrix::Random(3, 1 + std::rand() % 4));
+    }
+    return stats;
+  }
+
+  void expect_same(const tree_statistics& a, const tree_statistics& b) {
+    ASSERT_EQ(a.left_context_length(), b.left_context_length());
+    ASSERT_EQ(a.right_context_length(), b.right_context_length());
+    ASSERT_EQ(a.size(), b.size());
+    for (size_t i = 0; i < a.size(); ++ i) {
+      int j = b.find(a.key(i));
+      ASSERT_LE(0, j);
+      ASSERT_TRUE(a.context(i) == b.context(j));
+      const tree_Gaussian_statistics& sa = a.statistics(i);
+      const tree_Gaussian_statistics& sb = b.statistics(j);
+      ASSERT_NEAR(sa.zero, sb.zero, 1e-9);
+      for (int d = 0; d < sa.first.rows(); ++ d) {
+        ASSERT_NEAR(sa.first(d), sb.first(d), 1e-9);
+        ASSERT_NEAR(sa.second(d), sb.second(d), 1e-9);
+      }
+    }
+  }
+
+  TEST(treestat_test, packed_context) {
+    HMM_context ctx = make_context("", "a", "k", 2);
+    packed_context key = ctx.pack();
+    ASSERT_EQ(3, key.npositions());
+    ASSERT_EQ(2, key.location());
+    ASSERT_EQ(phone_table::find("a"), key.phone(1));
+    ASSERT_TRUE(HMM_context::unpack(key) == ctx);
+    ASSERT_TRUE(key == ctx.pack());
+
+    HMM_context other = make_context("", "a", "k", -1);
+    ASSERT_TRUE(key != other.pack());
+    ASSERT_EQ(-1, other.pack().location());
+    ASSERT_EQ(-1, phone_table::find("never-interned"));
+  }
+
+  TEST(treestat_test, accumulate) {
+    tree_statistics stats = make_stats(2, 500);
+    std::set<HMM_context> contexts;
+    for (size_t i = 0; i < stats.size(); ++ i) {
+      contexts.insert(stats.context(i));
+      ASSERT_EQ(static_cast<int>(i), stats.find(stats.key(i)));
+    }
+    ASSERT_EQ(contexts.size(), stats.size());
+
+    HMM_context ctx = stats.context(0);
+    double zero = stats.statistics(0).zero;
+    stats.accumulate(ctx, fmatrix::Random(3, 7));
+    ASSERT_EQ(contexts.size(), stats.size());
+    ASSERT_EQ(zero + 7, stats.statistics(0).zero);
+    ASSERT_EQ(-1, stats.find(make_context("x", "y", "z", 0).pack()));
+
+    tree_statistics doubled = stats;
+    doubled.accumulate(stats);
+    ASSERT_EQ(stats.size(), doubled.size());
+    for (size_t i = 0; i < stats.size(); ++ i) {
+      ASSERT_EQ(2 * stats.statistics(i).zero, doubled.statistics(i).zero);
+    }
+  }
+
+  TEST(treestat_test, binary_roundtrip) {
+    tree_statistics stats = make_stats(1, 50);
+    std::string path = ::testing::TempDir() + "test_treestat.bin";
+    stats.write_binary(path);
+    ASSERT_TRUE(tree_statistics::is_binary_file(path));
+
+    tree_statistics_file file(path);
+    ASSERT_EQ(stats.size(), file.size());
+    ASSERT_EQ(3, file.ndim());
+    for (size_t i = 1; i < file.size(); ++ i) {
+      ASSERT_LT(std::string(file.key_data(i - 1), file.key_size(i - 1)),
+                std::string(file.key_data(i), file.key_size(i)));
+    }
+
+    tree_statistics loaded;
+    loaded.load(path);
+    expect_same(stats, loaded);
+    std::remove(path.c_str());
+  }
+
+  TEST(treestat_test, merge_files) {
+    std::vector<std::string> paths;
+    tree_statistics expected;
+    for (int k = 0; k < 4; ++ k) {
+      tree_statistics stats = make_stats(10 + k, k == 2 ? 0 : 30);
+      paths.push_back(::testing::TempDir() + "test_treestat_" +
+                      std::to_string(k) + ".bin");
+      stats.write_binary(paths.back());
+      if (k == 0) {
+        expected = stats;
+      } else {
+        expected.accumulate(stats);
+      }
+    }
+    std::string output = ::testing::TempDir() + "test_treestat_merged.bin";
+    merge_tree_statistics_files(paths, output);
+
+    tree_statistics merged;
+    merged.load(output);
+    expect_same(expected, merged);
+
+    for (size_t k = 0; k < paths.size(); ++ k) std::remove(paths[k].c_str());
+    std::remove(output.c_str());
+  }
+}
@@ -3,6 +3,9 @@
 
 #include <boost/format.hpp>
 #include <viennacl/matrix.hpp>
+#include <spin/corpus/corpus.hpp>
+#include <string>
+#include <vector>
 
 #define ASSERT_MATRIX_NEAR(val_exp, val_act, abserr) \
   ::assert_matrix_near_impl((val_exp), (val_act), abserr, #val_exp, #val_act)
@@ -90,6 +93,19 @@ namespace {
     }
   }
 
+  /// Writes a corpus with the entries {+key: keys[i], value: i}
+  inline void write_keyed_corpus(const std::string& path, bool is_binary,
+                                 const std::vector<std::string>& keys) {
+    spin::corpus_writer_ptr writer = spin::make_corpus_writer(path, is_binary);
+    for (size_t i = 0; i < keys.size(); ++ i) {
+      spin::corpus_entry ent;
+      ent["+key"] = keys[i];
+      ent["value"] = static_cast<int>(i);
+      writer->write(ent);
+    }
+    writer->close();
+  }
+
 }
 
 #endif
@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+
+#include <spin/types.hpp>
+#include <spin/utils.hpp>
+
+#include "../testutil.hpp"
+#include <spin/parallel.hpp>
+#include <chrono>
+#include <algorithm>
+
+namespace {
+  using namespace spin;
+
+  TEST(parallel_test, bounded_queue) {
+    bounded_queue<int> queue(2);
+    std::thread producer([&] {
+        for (int n = 0; n < 100; ++ n) queue.push(n);
+        queue.close();
+      });
+    int expected = 0, v;
+    while (queue.pop(&v)) {
+      ASSERT_EQ(expected, v);
+      ++ expected;
+    }
+    producer.join();
+    ASSERT_EQ(100, expected);
+  }
+
+  TEST(parallel_test, ordered_pipeline_keeps_order) {
+    ordered_pipeline<int, int> pipeline(4, 3);
+    int next = 0;
+    std::vector<int> results;
+    pipeline.run([&](int* p) {
+        if (next == 50) return false;
+        *p = next ++;
+        return true;
+      },
+      [](int worker, int& in, int* out) {
+        // later items finish earlier
+        std::this_thread::sleep_for(std::chrono::microseconds((50 - in) * 20));
+        *out = in * in;
+      },
+      [&](int& out) { results.push_back(out); });
+
+    ASSERT_EQ(50, results.size());
+    for (int n = 0; n < 50; ++ n) {
+      ASSERT_EQ(n * n, results[n]);
+    }
+  }
+
+  TEST(parallel_test, ordered_pipeline_rethrows) {
+    ordered_pipeline<int, int> pipeline(2);
+    int next = 0;
+    ASSERT_THROW(pipeline.run([&](int* p) {
+          if (next == 10) return false;
+          *p = next ++;
+          return true;
+        },
+        [](int worker, int& in, int* out) {
+          if (in == 5) throw std::runtime_error("error");
+          *out = in;
+        },
+        [](int& out) { }), std::runtime_error);
+  }
+
+  TEST(parallel_test, worker_pool) {
+    worker_pool pool(4);
+    ASSERT_EQ(4, pool.size());
+    for (int round = 0; round < 50; ++ round) {
+      std::vector<int> hits(100, 0);
+      pool.run(100, [&](int n) { hits[n] += round; });
+      for (int n = 0; n < 100; ++ n) ASSERT_EQ(round, hits[n]);
+    }
+    pool.run(0, [](int n) { });
+
+    ASSERT_THROW(pool.run(10, [](int n) {
+          if (n == 7) throw std::runtime_error("failed");
+        }), std::runtime_error);
+    int count = 0;
+    pool.run(1, [&](int n) { ++ count; });
+    ASSERT_EQ(1, count);
+  }
+
+  TEST(parallel_test, tree_reduce) {
+    worker_pool pool(3);
+    for (int n = 1; n <= 17; ++ n) {
+      std::vector<std::vector<int> > items(n);
+      for (int i = 0; i < n; ++ i) items[i].push_back(i);
+      auto merge = [](std::vector<int>& a, const std::vector<int>& b) {
+        a.insert(a.end(), b.begin(), b.end());
+      };
+      std::vector<std::vector<int> > serial = items;
+      tree_reduce<std::vector<int> >(items, merge, &pool);
+      tree_reduce<std::vector<int> >(serial, merge);
+      ASSERT_EQ(serial[0], items[0]);
+      std::sort(items[0].begin(), items[0].end());
+      ASSERT_EQ(static_cast<size_t>(n), items[0].size());
+      for (int i = 0; i < n; ++ i) ASSERT_EQ(i, items[0][i]);
+    }
+    std::vector<int> empty;
+    tree_reduce<int>(empty, [](int& a, const int& b) { a += b; });
+  }
+}
@@ -25,9 +25,8 @@ namespace spin {
                   );
   
   int tool_main(Arg& arg, int argc, char* argv[]) {
-    variant_t stats_src;
-    load_variant(&stats_src, arg.stats.getValue());
-    diagonal_GMM_statistics stats(stats_src);
+    diagonal_GMM_statistics stats;
+    stats.load(arg.stats.getValue());
 
     diagonal_GMM_statistics::statscalar zeroth = stats.get_zero().sum();
     diagonal_GMM_statistics::statvector
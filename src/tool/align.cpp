@@ -17,6 +17,7 @@
 #include <spin/fscorer/diaggmm.hpp>
 #include <spin/decode/decoder.hpp>
 #include <spin/utils.hpp>
+#include <spin/parallel.hpp>
 #include <spin/flow/flowutils.hpp>
 #ifdef SPIN_WITH_NNET
 #  include <spin/fscorer/nnet_scorer.hpp>
@@ -43,6 +44,17 @@ namespace spin {
                    ("", "beam", "", false, 8000.0, "BEAM")),
                   (TCLAP::ValueArg<int>, maxactive,
                    ("", "maxactive", "", false, 30000, "N")),
+                  (TCLAP::ValueArg<int>, threads,
+                   ("", "threads", "Number of utterances aligned in parallel",
+                    false, 1, "N")),
+                  (TCLAP::ValueArg<int>, scorer_threads,
+                   ("", "scorer-threads",
+                    "Number of threads scoring GMM states of an utterance",
+                    false, 1, "N")),
+                  (TCLAP::ValueArg<int>, frames_ahead,
+                   ("", "frames-ahead",
+                    "Number of frames scored at once by the scorer threads",
+                    false, 32, "N")),
                   (TCLAP::SwitchArg, write_text,
                    ("", "write-text", ""))
                   );
@@ -59,7 +71,10 @@ namespace spin {
     load_variant(&scorer_src, &scorer_type, arg.scorer.getValue());
     if (scorer_type == "StacDGMM" || scorer_type == "SpinDGMM") {
       diagonal_GMM_parameter_ptr param(new diagonal_GMM_parameter(scorer_src));
-      pscorer.reset(new diagonal_GMM_scorer(param));
+      diagonal_GMM_scorer* pgmm = new diagonal_GMM_scorer(param);
+      pscorer.reset(pgmm);
+      pgmm->set_num_threads(arg.scorer_threads.getValue(),
+                            arg.frames_ahead.getValue());
     }
 #ifdef SPIN_WITH_NNET
     else if (scorer_type == "SpinNnet") {
@@ -77,22 +92,46 @@ namespace spin {
     corpus_writer_ptr writer = make_corpus_writer(arg.output.getValue(),
                                                   ! arg.write_text.getValue());
 
-    for (int n = 0 ; ! zit->done() ; zit->next(), ++ n) {
-      corpus_entry input_sg = zit->value(0), input_feat = zit->value(1);
-      INFO("Processing %s...", zit->get_key().c_str());
-      corpus_entry output;
-      copy_sticky_tags(&output, input_sg);
+    int nthreads = std::max(1, arg.threads.getValue());
+    std::vector<std::shared_ptr<frame_scorer> > scorers;
+    for (int w = 0; w < nthreads; ++ w) {
+      scorers.push_back(w == 0 ? pscorer : pscorer->fork());
+    }
 
-      apply_matrix_flow_inplace<float>(&input_feat["feature"], flow);
-      fmatrix feats = boost::get<fmatrix>(input_feat["feature"]);
+    struct job {
+      std::string key;
+      corpus_entry input_sg;
+      corpus_entry input_feat;
+      corpus_entry output;
+      bool decoded;
+    };
+
+    auto produce = [&](job* pjob) {
+      if (zit->done()) return false;
+      pjob->key = zit->get_key();
+      pjob->input_sg = zit->value(0);
+      pjob->input_feat = zit->value(1);
+      apply_matrix_flow_inplace<float>(&pjob->input_feat["feature"], flow);
+      zit->next();
+      return true;
+    };
+
+    auto work = [&](int w, job& j, job* presult) {
+      INFO("Processing %s...", j.key.c_str());
+      presult->key = j.key;
+      presult->decoded = false;
+      corpus_entry& output = presult->output;
+      copy_sticky_tags(&output, j.input_sg);
+
+      const fmatrix& feats = boost::get<fmatrix>(j.input_feat["feature"]);
 
       fst::MutableFst<fst::StdArc>* pnet =
-        boost::get<vector_fst>(input_sg["stategraph"])
+        boost::get<vector_fst>(j.input_sg["stategraph"])
         .GetMutableFst<fst::StdArc>();
 
       double timer_start = get_wall_time();
 
-      decoder decoder(*pnet, pscorer.get());
+      decoder decoder(*pnet, scorers[w].get());
       decoder.set_max_active(arg.maxactive.getValue());
       decoder.set_beam_width(arg.beam.getValue());
       decoder.set_acoustic_scale(arg.acscale.getValue());
@@ -117,13 +156,23 @@ namespace spin {
         float finalw = decoder.extract_lattice(&lattice, 1);
         double timer_end = get_wall_time();
         double dur_sec = (timer_end - timer_start);
-        INFO("Final weight = %f, FPS = %f", finalw, feats.cols() / dur_sec);
+        INFO("%s: Final weight = %f, FPS = %f",
+             j.key.c_str(), finalw, feats.cols() / dur_sec);
 
         
         output["alignment"] = fst::script::VectorFstClass(lattice);
-        writer->write(output);
+        presult->decoded = true;
       }
-    }
+    };
+
+    auto consume = [&](job& result) {
+      if (result.decoded) {
+        writer->write(result.output);
+      }
+    };
+
+    ordered_pipeline<job, job> pipeline(nthreads);
+    pipeline.run(produce, work, consume);
     INFO("DONE");
     return 0;
   }
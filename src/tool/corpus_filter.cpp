@@ -11,6 +11,7 @@
 #include <spin/corpus/corpus.hpp>
 #include <spin/corpus/yaml.hpp>
 #include <spin/corpus/msgpack.hpp>
+#include <spin/corpus/index.hpp>
 
 namespace spin {
   DEFINE_ARGCLASS(arg_type, (gear::common_args),
@@ -25,16 +26,10 @@ namespace spin {
                   );
 
   int tool_main(arg_type& arg, int argc, char* argv[]) {
-    corpus_iterator_ptr cit = make_corpus_iterator(arg.source.getValue());
-    std::map<std::string, corpus_pos_t> pos;
-    for ( ; ! cit->done() ; cit->next()) {
-      pos[cit->get_key()] = cit->pos();
-      std::cout << cit->get_key() << " => " << cit->pos() << std::endl;
-    }
-
-    corpus_writer_ptr writer = make_corpus_writer(arg.output.getValue(),
-                                                  ! arg.write_text.getValue());
+    const std::string& source = arg.source.getValue();
 
+    // pairs of the new key and the key in the source
+    std::vector<std::pair<std::string, std::string> > requests;
     std::ifstream ifs(arg.filter.getValue().c_str());
     std::string line;
     while(std::getline(ifs, line)) {
@@ -45,20 +40,53 @@ namespace spin {
       if (fields.size() == 1) {
         fields.push_back(fields[0]);
       }
+      requests.push_back(std::make_pair(fields[0], fields[1]));
+    }
 
-      auto posit = pos.find(fields[1]);
-      if (posit == pos.end()) {
-        WARN("%s is not found in the source", fields[1].c_str());
-        continue;
+    std::vector<std::string> newkeys;
+    corpus_iterator_ptr cit;
+    if (corpus_index::is_available(source)) {
+      corpus_index index(source);
+      std::vector<std::string> keys;
+      for (auto it = requests.cbegin(), last = requests.cend();
+           it != last; ++ it) {
+        if (index.find(it->second) < 0) {
+          WARN("%s is not found in the source", it->second.c_str());
+          continue;
+        }
+        newkeys.push_back(it->first);
+        keys.push_back(it->second);
       }
+      cit = make_corpus_iterator(source, keys);
+    } else {
+      INFO("%s has no index, scanning", source.c_str());
+      std::map<std::string, corpus_pos_t> pos;
+      for (corpus_iterator_ptr scanit = make_corpus_iterator(source);
+           ! scanit->done() ; scanit->next()) {
+        pos[scanit->get_key()] = scanit->pos();
+      }
+      std::vector<corpus_pos_t> positions;
+      for (auto it = requests.cbegin(), last = requests.cend();
+           it != last; ++ it) {
+        auto posit = pos.find(it->second);
+        if (posit == pos.end()) {
+          WARN("%s is not found in the source", it->second.c_str());
+          continue;
+        }
+        newkeys.push_back(it->first);
+        positions.push_back(posit->second);
+      }
+      cit.reset(new positioned_corpus_iterator(source, positions));
+    }
 
-      corpus_iterator_ptr seekit = make_corpus_iterator(arg.source.getValue(),
-                                                        posit->second);
-      corpus_entry ent = seekit->value();
-      ent["+key"] = fields[0];
+    corpus_writer_ptr writer = make_corpus_writer(arg.output.getValue(),
+                                                  ! arg.write_text.getValue());
+    for (size_t i = 0; ! cit->done(); cit->next(), ++ i) {
+      corpus_entry ent = cit->value();
+      ent["+key"] = newkeys[i];
       writer->write(ent);
-      
     }
+    writer->close();
     INFO("DONE");
     return 0;
   }
@@ -21,6 +21,7 @@
 #endif
 #include <spin/decode/decoder.hpp>
 #include <spin/utils.hpp>
+#include <spin/parallel.hpp>
 #include <spin/flow/flowutils.hpp>
 
 
@@ -46,11 +47,64 @@ namespace spin {
                    ("", "maxactive", "", false, 8000, "N")),
                   (TCLAP::ValueArg<int>, maxbranch,
                    ("", "maxbranch", "", false, 1, "M")),
+                  (TCLAP::SwitchArg, gselect,
+                   ("", "gselect", "Use Gaussian selection table of the GMM")),
+                  (TCLAP::ValueArg<int>, threads,
+                   ("", "threads", "Number of utterances decoded in parallel",
+                    false, 1, "N")),
+                  (TCLAP::ValueArg<int>, prefetch,
+                   ("", "prefetch",
+                    "Number of utterances read ahead in background (0: off)",
+                    false, 4, "N")),
+                  (TCLAP::SwitchArg, lm_lookahead,
+                   ("", "lm-lookahead",
+                    "Prune with the LM weight to the next word added")),
+                  (TCLAP::ValueArg<float>, word_end_beam,
+                   ("", "word-end-beam",
+                    "Beam for hypotheses that have just entered a word",
+                    false, HUGE_VALF, "BEAM")),
+                  (TCLAP::ValueArg<int>, target_active,
+                   ("", "target-active",
+                    "Adapt the beam toward N active hypotheses (0: fixed)",
+                    false, 0, "N")),
+                  (TCLAP::ValueArg<float>, min_beam,
+                   ("", "min-beam", "Lower bound of the adaptive beam",
+                    false, 1.0, "BEAM")),
+                  (TCLAP::ValueArg<float>, max_beam,
+                   ("", "max-beam", "Upper bound of the adaptive beam",
+                    false, HUGE_VALF, "BEAM")),
+                  (TCLAP::ValueArg<float>, target_rtf,
+                   ("", "target-rtf",
+                    "Lower the adaptive target while slower than RTF",
+                    false, 0.0, "RTF")),
+                  (TCLAP::ValueArg<float>, frame_rate,
+                   ("", "frame-rate", "Frames per second, used for RTF",
+                    false, 100.0, "FPS")),
+                  (TCLAP::SwitchArg, best_path,
+                   ("", "best-path",
+                    "Write the best word sequence instead of the lattice")),
+                  (TCLAP::ValueArg<int>, chunk,
+                   ("", "chunk",
+                    "Push frames in chunks of N and log partial results",
+                    false, 0, "N")),
+                  (TCLAP::ValueArg<float>, gselect_floor,
+                   ("", "gselect-floor",
+                    "Log-likelihood of Gaussians not in the shortlist",
+                    false, -HUGE_VALF, "LOGLIKE")),
                   (TCLAP::SwitchArg, write_text,
                    ("", "write-text", ""))
                   );
 
   
+  std::string join_words(const std::vector<std::string>& words) {
+    std::string ret;
+    for (auto& w : words) {
+      if (! ret.empty()) ret += " ";
+      ret += w;
+    }
+    return ret;
+  }
+
   int tool_main(arg_type& arg, int argc, char* argv[]) {
     char* gpuid = ::getenv("SPIN_GPUID");
     std::vector<viennacl::ocl::device> devices = viennacl::ocl::platform().devices();
@@ -70,7 +124,10 @@ namespace spin {
     viennacl::ocl::current_context().build_options("-cl-mad-enable -cl-unsafe-math-optimizations -cl-fast-relaxed-math -cl-no-signed-zeros -cl-single-precision-constant");
 
     
-    corpus_iterator_ptr cit = make_corpus_iterator(arg.features.getValue());
+    corpus_iterator_ptr cit =
+      make_corpus_iterator(arg.features.getValue(),
+                           boost::logic::indeterminate,
+                           std::max(0, arg.prefetch.getValue()));
 
     variant_t scorer_src;
     std::string scorer_type;
@@ -78,7 +135,11 @@ namespace spin {
     load_variant(&scorer_src, &scorer_type, arg.scorer.getValue());
     if (scorer_type == "StacDGMM" || scorer_type == "SpinDGMM") {
       diagonal_GMM_parameter_ptr param(new diagonal_GMM_parameter(scorer_src));
-      pscorer.reset(new diagonal_GMM_scorer(param));
+      diagonal_GMM_scorer* pgmm = new diagonal_GMM_scorer(param);
+      pscorer.reset(pgmm);
+      if (arg.gselect.getValue()) {
+        pgmm->enable_gaussian_selection(arg.gselect_floor.getValue());
+      }
     }
 #ifdef SPIN_WITH_NNET
     else if (scorer_type == "SpinNnet") {
@@ -96,34 +157,80 @@ namespace spin {
     corpus_writer_ptr writer = make_corpus_writer(arg.output.getValue(),
                                                   ! arg.write_text.getValue());
 
-    vector_fst_ptr decodegraph = read_fst_file(arg.graph.getValue());
+    // graph, its transition table and scorer parameters are shared
+    int nthreads = std::max(1, arg.threads.getValue());
+    transition_table_ptr table;
+    if (transition_table::is_graph_file(arg.graph.getValue())) {
+      table = transition_table::load(arg.graph.getValue());
+    } else {
+      vector_fst_ptr decodegraph = read_fst_file(arg.graph.getValue());
+      table.reset(new transition_table(*decodegraph->GetFst<fst::StdArc>()));
+    }
+    std::vector<std::shared_ptr<frame_scorer> > scorers;
+    std::vector<std::shared_ptr<decoder> > decoders;
+    for (int w = 0; w < nthreads; ++ w) {
+      scorers.push_back(w == 0 ? pscorer : pscorer->fork());
+      std::shared_ptr<decoder> dec(new decoder(table, scorers.back().get()));
+      dec->set_max_active(arg.maxactive.getValue());
+      dec->set_beam_width(arg.beam.getValue());
+      dec->set_acoustic_scale(arg.acscale.getValue());
+      dec->set_max_branch(arg.maxbranch.getValue());
+      dec->set_best_path_mode(arg.best_path.getValue());
+      dec->set_lm_lookahead(arg.lm_lookahead.getValue());
+      dec->set_word_end_beam(arg.word_end_beam.getValue());
+      dec->set_adaptive_beam(arg.target_active.getValue(),
+                             arg.min_beam.getValue(), arg.max_beam.getValue());
+      dec->set_target_rtf(arg.target_rtf.getValue(),
+                          arg.frame_rate.getValue());
+      decoders.push_back(dec);
+    }
 
-    fst::MutableFst<fst::StdArc>* pnet = decodegraph->GetMutableFst<fst::StdArc>();
-    //parse_state_symbols(pnet, scorer.nstates());
+    struct job {
+      std::string key;
+      corpus_entry input;
+      corpus_entry output;
+      bool decoded;
+    };
 
-    decoder decoder(*pnet, pscorer.get());
-    decoder.set_max_active(arg.maxactive.getValue());
-    decoder.set_beam_width(arg.beam.getValue());
-    decoder.set_acoustic_scale(arg.acscale.getValue());
-    decoder.set_max_branch(arg.maxbranch.getValue());
-    
-    for (int n = 0 ; ! cit->done() ; cit->next(), ++ n) {
-      corpus_entry input = cit->value();
-      INFO("Processing %s...", cit->get_key().c_str());
+    auto produce = [&](job* pjob) {
+      if (cit->done()) return false;
+      pjob->key = cit->get_key();
+      pjob->input = cit->value();
+      apply_matrix_flow_inplace<float>(&pjob->input["feature"], flow);
+      cit->next();
+      return true;
+    };
 
-     
-      corpus_entry output;
-      copy_sticky_tags(&output, input);
+    auto work = [&](int w, job& j, job* presult) {
+      decoder& decoder = *decoders[w];
+      INFO("Processing %s...", j.key.c_str());
+      presult->key = j.key;
+      presult->decoded = false;
+      corpus_entry& output = presult->output;
+      copy_sticky_tags(&output, j.input);
 
-      apply_matrix_flow_inplace<float>(&input["feature"], flow);
-      fmatrix feats = boost::get<fmatrix>(input["feature"]);
+      const fmatrix& feats = boost::get<fmatrix>(j.input["feature"]);
 
       double timer_start = get_wall_time();
       
       decoder.push_init();
       bool decoded = true;
       try {
-        decoder.push_input(feats);
+        int chunk = arg.chunk.getValue();
+        if (chunk > 0) {
+          std::vector<std::string> best, stable;
+          for (int t = 0; t < feats.cols(); t += chunk) {
+            int n = std::min(chunk, static_cast<int>(feats.cols()) - t);
+            decoder.push_chunk(feats.middleCols(t, n));
+            decoder.best_partial(&best);
+            decoder.stable_prefix(&stable);
+            INFO("%s: t = %d, partial = \"%s\", stable = \"%s\"",
+                 j.key.c_str(), t + n, join_words(best).c_str(),
+                 join_words(stable).c_str());
+          }
+        } else {
+          decoder.push_input(feats);
+        }
         if (! decoder.push_final()) {
           INFO("Cannot reach to a final state");
           decoded = false;
@@ -136,22 +243,49 @@ namespace spin {
 
       if (decoded) {
         Lattice lattice;
-        float finalw = decoder.extract_lattice(&lattice, arg.maxbranch.getValue());
+        std::vector<std::string> words;
+        float finalw;
+        if (arg.best_path.getValue()) {
+          finalw = decoder.best_path(&words);
+        } else {
+          finalw = decoder.extract_lattice(&lattice, arg.maxbranch.getValue());
+        }
         double timer_end = get_wall_time();
         double dur_sec = (timer_end - timer_start);
-        INFO("Final weight = %f, FPS = %f", finalw, feats.cols() / dur_sec);
-
-        fst::VectorFst<fst::StdArc> stdlattice;
-        ArcMap(lattice, &stdlattice,
-               fst::WeightConvertMapper<LatticeArc, fst::StdArc>());
-        stdlattice.Write("testfst.bin");
+        INFO("%s: Final weight = %f, FPS = %f",
+             j.key.c_str(), finalw, feats.cols() / dur_sec);
 
         output["+num_frames"] = static_cast<int>(feats.cols());
         output["+decode_msec"] = static_cast<int>(dur_sec * 1000.0);
-        output[arg.outputtag.getValue()] = fst::script::VectorFstClass(lattice);
-        writer->write(output);
+        if (arg.target_active.getValue() > 0) {
+          // beam and # of active hypotheses of each frame
+          const std::vector<float>& beams = decoder.beam_trajectory();
+          const std::vector<int>& actives = decoder.active_trajectory();
+          fmatrix trajectory(2, beams.size());
+          for (int t = 0; t < beams.size(); ++ t) {
+            trajectory(0, t) = beams[t];
+            trajectory(1, t) = actives[t];
+          }
+          output["+beam_trajectory"] = trajectory;
+        }
+        if (arg.best_path.getValue()) {
+          output[arg.outputtag.getValue()] = join_words(words);
+        } else {
+          output[arg.outputtag.getValue()] =
+            fst::script::VectorFstClass(lattice);
+        }
+        presult->decoded = true;
       }
-    }
+    };
+
+    auto consume = [&](job& result) {
+      if (result.decoded) {
+        writer->write(result.output);
+      }
+    };
+
+    ordered_pipeline<job, job> pipeline(nthreads);
+    pipeline.run(produce, work, consume);
     return 0;
   }
   
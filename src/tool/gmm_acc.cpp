@@ -12,6 +12,7 @@
 #include <spin/io/variant.hpp>
 #include <spin/fst/linear.hpp>
 #include <spin/fscorer/diaggmm.hpp>
+#include <spin/parallel.hpp>
 
 namespace spin {
   DEFINE_ARGCLASS(Arg, (gear::common_args),
@@ -23,10 +24,57 @@ namespace spin {
                    ("o", "output", "", true, "", "FILE")),
                   (TCLAP::SwitchArg, write_text,
                    ("", "write-text", "")),
+                  (TCLAP::SwitchArg, write_binary,
+                   ("", "write-binary",
+                    "Write a raw statistics file that can be mapped")),
                   (TCLAP::ValueArg<std::string>, gmmdef,
-                   ("g", "gmmdef", "GMM definition", true, "", "FILE"))
+                   ("g", "gmmdef", "GMM definition", true, "", "FILE")),
+                  (TCLAP::SwitchArg, float_accumulation,
+                   ("", "float-accumulation",
+                    "Compute the products of each segment in single "
+                    "precision")),
+                  (TCLAP::ValueArg<int>, threads,
+                   ("", "threads", "Number of utterances accumulated in parallel",
+                    false, 1, "N"))
                   );
 
+  void accumulate_utterance(diagonal_GMM_statistics* pstat,
+                            const vector_fst& alignment, const fmatrix& feats,
+                            const diagonal_GMM_parameter& param) {
+    const fst::Fst<LatticeArc>* palign = alignment.GetFst<LatticeArc>();
+
+    for (fst::StateIterator<fst::Fst<LatticeArc> > stit(*palign);
+         ! stit.Done(); stit.Next()) {
+      for (fst::ArcIterator<fst::Fst<LatticeArc> > ait(*palign, stit.Value());
+           ! ait.Done(); ait.Next()) {
+        LatticeArc arc = ait.Value();
+        int stt = arc.weight.Time().Start(), ent = arc.weight.Time().End();
+        stt = std::max(stt, 0);
+        ent = std::min(ent, (int) feats.cols());
+
+        if (arc.ilabel == 0) continue;
+        std::vector<std::string> stids;
+        std::string isym = palign->InputSymbols()->Find(arc.ilabel);
+        boost::split(stids, isym, boost::is_any_of(";"));
+
+        if (stids.size() == 0 || stids[0].size() == 0 || stids[0][0] != 'S') {
+          if (stt < ent) {
+            throw std::runtime_error("Invalid lattice input label " + stids[0]);
+          } else {
+            continue;
+          }
+        }
+
+        int s = boost::lexical_cast<int>(stids[0].substr(1));
+        //std::cout << "Acc to " << s << std::endl;
+        if (ent > stt) {
+          pstat->accumulate(s, feats.block(0, stt, feats.rows(), ent - stt),
+                            param);
+        }
+      }
+    }
+  }
+
   int tool_main(Arg& arg, int argc, char* argv[]) {
     corpus_iterator_ptr ait = make_corpus_iterator(arg.alignment.getValue());
     corpus_iterator_ptr fit = make_corpus_iterator(arg.features.getValue());
@@ -36,61 +84,65 @@ namespace spin {
     load_variant(&param_src, arg.gmmdef.getValue());
    
     diagonal_GMM_parameter param(param_src);
-    diagonal_GMM_statistics stat(param);
-    
-    for (int n = 0 ; ! zit->done() ; zit->next(), ++ n) {
-      corpus_entry input_al = zit->value(0);
-      corpus_entry input_feat = zit->value(1);
-      INFO("Processing %s...", zit->get_key().c_str());
-      
-      vector_fst alignment = 
-        boost::get<vector_fst>(input_al["alignment"]);
+
+    // each worker accumulates into its own statistics
+    int nthreads = std::max(1, arg.threads.getValue());
+    std::vector<diagonal_GMM_statistics> stats(nthreads,
+                                               diagonal_GMM_statistics(param));
+    for (int w = 0; w < nthreads; ++ w) {
+      stats[w].set_float_accumulation(arg.float_accumulation.isSet());
+    }
+
+    struct job {
+      std::string key;
+      corpus_entry input_al;
+      corpus_entry input_feat;
+    };
+
+    auto produce = [&](job* pjob) {
+      if (zit->done()) return false;
+      pjob->key = zit->get_key();
+      pjob->input_al = zit->value(0);
+      pjob->input_feat = zit->value(1);
+      zit->next();
+      return true;
+    };
+
+    auto work = [&](int w, job& j, int* presult) {
+      INFO("Processing %s...", j.key.c_str());
+      *presult = 0;
+      const vector_fst& alignment =
+        boost::get<vector_fst>(j.input_al["alignment"]);
 
       if (! CheckLinearity(alignment)) {
-        WARN("%s is not linear, skip.", zit->get_key().c_str());
-        continue;
+        WARN("%s is not linear, skip.", j.key.c_str());
+        return;
       }
 
-      fmatrix feats = boost::get<fmatrix>(input_feat["feature"]);
-      const fst::Fst<LatticeArc>* palign = alignment.GetFst<LatticeArc>();
-
-      for (fst::StateIterator<fst::Fst<LatticeArc> > stit(*palign);
-           ! stit.Done(); stit.Next()) {
-        for (fst::ArcIterator<fst::Fst<LatticeArc> > ait(*palign, stit.Value());
-             ! ait.Done(); ait.Next()) {
-          LatticeArc arc = ait.Value();
-          int stt = arc.weight.Time().Start(), ent = arc.weight.Time().End();
-          stt = std::max(stt, 0);
-          ent = std::min(ent, (int) feats.cols());
-
-          if (arc.ilabel == 0) continue;
-          std::vector<std::string> stids;
-          std::string isym = palign->InputSymbols()->Find(arc.ilabel);
-          boost::split(stids, isym, boost::is_any_of(";"));
-
-          if (stids.size() == 0 || stids[0].size() == 0 || stids[0][0] != 'S') {
-            if (stt < ent) {
-              throw std::runtime_error("Invalid lattice input label " + stids[0]);
-            } else {
-              continue;
-            }
-          }
+      const fmatrix& feats = boost::get<fmatrix>(j.input_feat["feature"]);
+      accumulate_utterance(&stats[w], alignment, feats, param);
+    };
 
-          int s = boost::lexical_cast<int>(stids[0].substr(1));
-          //std::cout << "Acc to " << s << std::endl;
-          if (ent > stt) {
-            stat.accumulate(s, feats.block(0, stt, feats.rows(), ent - stt),
-                            param);
-          }
-        }
-      }
-      
-    }
+    ordered_pipeline<job, int> pipeline(nthreads);
+    pipeline.run(produce, work, [](int&) { });
+
+    worker_pool pool(nthreads);
+    tree_reduce<diagonal_GMM_statistics>(
+        stats,
+        [](diagonal_GMM_statistics& dest, const diagonal_GMM_statistics& src) {
+          dest.accumulate(src);
+        },
+        &pool);
+    diagonal_GMM_statistics& stat = stats[0];
 
-    variant_t stat_src;
-    stat.write(&stat_src);
-    write_variant(stat_src, arg.output.getValue(),
-                  arg.write_text.isSet(), "StacDGST");
+    if (arg.write_binary.isSet()) {
+      stat.write_binary(arg.output.getValue());
+    } else {
+      variant_t stat_src;
+      stat.write(&stat_src);
+      write_variant(stat_src, arg.output.getValue(),
+                    arg.write_text.isSet(), "StacDGST");
+    }
 
     return 0;
   }
@@ -19,27 +19,37 @@ namespace spin {
                    ("o", "output", "", true, "", "FILE")),
                   (TCLAP::SwitchArg, write_text,
                    ("", "write-text", "")),
+                  (TCLAP::SwitchArg, write_binary,
+                   ("", "write-binary",
+                    "Write a raw statistics file that can be mapped")),
                   (TCLAP::UnlabeledMultiArg<std::string>, stats,
                    ("stats", "Statistics.", true, "stats.."))
                   );
   int tool_main(Arg& arg, int argc, char* argv[]) {
-    INFO("Loading %s...", arg.stats.getValue()[0].c_str());
-    variant_t stats_src;
-    load_variant(&stats_src, arg.stats.getValue()[0]);
-    diagonal_GMM_statistics stats(stats_src);
-
-    for (int n = 1; n < arg.stats.getValue().size(); ++ n) {
-      INFO("Loading %s...", arg.stats.getValue()[n].c_str());
-      variant_t stats_src;
-      load_variant(&stats_src, arg.stats.getValue()[n]);
-      diagonal_GMM_statistics otherstats(stats_src);
-
-      stats.accumulate(otherstats);
+    const std::vector<std::string>& paths = arg.stats.getValue();
+    INFO("Loading %s...", paths[0].c_str());
+    diagonal_GMM_statistics stats;
+    stats.load(paths[0]);
+
+    for (int n = 1; n < paths.size(); ++ n) {
+      INFO("Loading %s...", paths[n].c_str());
+      if (diagonal_GMM_statistics::is_binary_file(paths[n])) {
+        // summed directly from the mapping
+        stats.accumulate_binary(paths[n]);
+      } else {
+        diagonal_GMM_statistics otherstats;
+        otherstats.load(paths[n]);
+        stats.accumulate(otherstats);
+      }
+    }
+    if (arg.write_binary.isSet()) {
+      stats.write_binary(arg.output.getValue());
+    } else {
+      variant_t stat_src;
+      stats.write(&stat_src);
+      write_variant(stat_src, arg.output.getValue(),
+                    arg.write_text.isSet(), "StacDGST");
     }
-    variant_t stat_src;
-    stats.write(&stat_src);
-    write_variant(stat_src, arg.output.getValue(),
-                  arg.write_text.isSet(), "StacDGST");
 
     return 0;
   }
@@ -38,9 +38,8 @@ namespace spin {
     load_variant(&param_src, arg.input.getValue());
     diagonal_GMM_parameter param(param_src);
 
-    variant_t stats_src;
-    load_variant(&stats_src, arg.stats.getValue());
-    diagonal_GMM_statistics stats(stats_src);
+    diagonal_GMM_statistics stats;
+    stats.load(arg.stats.getValue());
 
     param.reestimation(stats,
                        arg.var_minocc.getValue(), arg.var_floor.getValue());
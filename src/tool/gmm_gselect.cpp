@@ -0,0 +1,56 @@
+#include <gear/io/logging.hpp>
+#include <gear/tool/args.hpp>
+#include <gear/tool/main.hpp>
+#include <gear/io/matrix.hpp>
+
+#include <tclap/CmdLine.h>
+#include <iostream>
+#include <streambuf>
+#include <fstream>
+
+#include <spin/io/variant.hpp>
+#include <spin/fscorer/diaggmm.hpp>
+#include <spin/fscorer/gselect.hpp>
+
+namespace spin {
+  DEFINE_ARGCLASS(Arg, (gear::common_args),
+                  (TCLAP::ValueArg<std::string>, output,
+                   ("o", "output", "", true, "", "FILE")),
+                  (TCLAP::ValueArg<std::string>, gmm,
+                   ("", "gmm", "GMMs to be equipped with the selection table",
+                    true, "", "FILE")),
+                  (TCLAP::ValueArg<int>, codewords,
+                   ("", "codewords", "Number of VQ codewords",
+                    false, 256, "N")),
+                  (TCLAP::ValueArg<int>, shortlist,
+                   ("", "shortlist", "Max number of Gaussians per state",
+                    false, 4, "N")),
+                  (TCLAP::ValueArg<int>, iterations,
+                   ("", "iterations", "Number of k-means iterations",
+                    false, 10, "N")),
+                  (TCLAP::SwitchArg, write_text,
+                   ("", "write-text", ""))
+                  );
+
+  int tool_main(Arg& arg, int argc, char* argv[]) {
+    variant_t param_src;
+    load_variant(&param_src, arg.gmm.getValue());
+    diagonal_GMM_parameter gmm(param_src);
+
+    gaussian_selection_ptr gselect(new gaussian_selection());
+    gselect->build(gmm, arg.codewords.getValue(), arg.shortlist.getValue(),
+                   arg.iterations.getValue());
+    gmm.set_gselect(gselect);
+
+    variant_t output_src;
+    gmm.write(&output_src);
+    write_variant(output_src, arg.output.getValue(),
+                  arg.write_text.isSet(), "StacDGMM");
+    return 0;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  return gear::wrap_main("Gaussian selection table builder",
+                          argc, argv, spin::tool_main);
+}
@@ -53,9 +53,8 @@ namespace spin {
 
     boost::optional<tree_statistics> treestat;
     if (arg.treestat.isSet()) {
-      variant_t treestat_src;
-      load_variant(&treestat_src, arg.treestat.getValue());
-      treestat = tree_statistics(treestat_src);
+      treestat = tree_statistics();
+      treestat->load(arg.treestat.getValue());
     }
 
 
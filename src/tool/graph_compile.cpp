@@ -0,0 +1,33 @@
+#include <gear/io/logging.hpp>
+#include <gear/tool/args.hpp>
+#include <gear/tool/main.hpp>
+
+#include <tclap/CmdLine.h>
+#include <iostream>
+
+#include <spin/types.hpp>
+#include <spin/io/fst.hpp>
+#include <spin/decode/transition_table.hpp>
+
+namespace spin {
+  DEFINE_ARGCLASS(Arg, (gear::common_args),
+                  (TCLAP::ValueArg<std::string>, graph,
+                   ("g", "graph", "Decoding graph in FST format",
+                    true, "", "FILE")),
+                  (TCLAP::ValueArg<std::string>, output,
+                   ("o", "output", "Graph file to be mapped by spn_decode",
+                    true, "", "FILE"))
+                  );
+
+  int tool_main(Arg& arg, int argc, char* argv[]) {
+    vector_fst_ptr decodegraph = read_fst_file(arg.graph.getValue());
+    transition_table table(*decodegraph->GetFst<fst::StdArc>());
+    table.write(arg.output.getValue());
+    return 0;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  return gear::wrap_main("Decoding graph compiler",
+                          argc, argv, spin::tool_main);
+}
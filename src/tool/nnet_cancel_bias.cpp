@@ -8,6 +8,7 @@
 #include <spin/nnet/stream.hpp>
 #include <spin/nnet/affine.hpp>
 #include <spin/hmm/tree.hpp>
+#include <spin/hmm/compiled_tree.hpp>
 #include <spin/hmm/treestat.hpp>
 
 #include <tclap/CmdLine.h>
@@ -46,9 +47,8 @@ namespace spin {
     load_variant(&input_src, arg.input.getValue());
     nnet nnet(input_src);
 
-    variant_t treestat_src;
-    load_variant(&treestat_src, arg.stats.getValue());
-    tree_statistics treestat(treestat_src);
+    tree_statistics treestat;
+    treestat.load(arg.stats.getValue());
     
     std::vector<double> counts(tree.nstates(), 0.0);
     double denom = 0.0;
@@ -56,11 +56,12 @@ namespace spin {
     // it's required only for computing posterior,
     // and it's cheap enough to compute.
 
-    for (auto it = treestat.data().cbegin(), last = treestat.data().cend();
-         it != last; ++ it) {
-      int st = tree.resolve(it->first);
-      counts[st] += it->second.zero;
-      denom += it->second.zero;
+    std::vector<int> leaves;
+    compiled_decision_tree(tree).resolve_many(treestat.keys(), &leaves);
+    for (size_t i = 0; i < treestat.size(); ++ i) {
+      int st = leaves[i];
+      counts[st] += treestat.statistics(i).zero;
+      denom += treestat.statistics(i).zero;
     }
     double logdenom = std::log(denom);
 
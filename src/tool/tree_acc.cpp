@@ -25,6 +25,9 @@ namespace spin {
                    ("o", "output", "", true, "", "FILE")),
                   (TCLAP::SwitchArg, write_text,
                    ("", "write-text", "")),
+                  (TCLAP::SwitchArg, write_binary,
+                   ("", "write-binary",
+                    "Write a raw statistics file that can be mapped")),
                   (TCLAP::ValueArg<int>, left,
                    ("l", "left", "Left-context size", true, 1, "N")),
                   (TCLAP::ValueArg<int>, right,
@@ -82,10 +85,14 @@ namespace spin {
     }
     INFO("Writing statistics...");
 
-    variant_t stat_src;
-    treestat.write(&stat_src);
-    write_variant(stat_src, arg.output.getValue(),
-                  arg.write_text.isSet(), "StacTRST");
+    if (arg.write_binary.isSet()) {
+      treestat.write_binary(arg.output.getValue());
+    } else {
+      variant_t stat_src;
+      treestat.write(&stat_src);
+      write_variant(stat_src, arg.output.getValue(),
+                    arg.write_text.isSet(), "StacTRST");
+    }
 
     return 0;
   }
@@ -21,30 +21,45 @@ namespace spin {
                    ("o", "output", "", true, "", "FILE")),
                   (TCLAP::SwitchArg, write_text,
                    ("", "write-text", "")),
+                  (TCLAP::SwitchArg, write_binary,
+                   ("", "write-binary",
+                    "Write a raw statistics file that can be mapped")),
                   (TCLAP::UnlabeledMultiArg<std::string>, stats,
                    ("stats", "Statistics.", true, "stats.."))
                   );
 
   int tool_main(Arg& arg, int argc, char* argv[]) {
-    INFO("Loading %s...", arg.stats.getValue()[0].c_str());
-    variant_t treestat_src;
-    load_variant(&treestat_src, arg.stats.getValue()[0]);
-    tree_statistics treestat(treestat_src);
-
-    for (int n = 1; n < arg.stats.getValue().size(); ++ n) {
-      INFO("Loading %s...", arg.stats.getValue()[n].c_str());
-      variant_t treestat_src;
-      load_variant(&treestat_src, arg.stats.getValue()[n]);
-      
-      tree_statistics otherstat(treestat_src);
+    const std::vector<std::string>& paths = arg.stats.getValue();
+    bool all_binary = true;
+    for (int n = 0; n < paths.size(); ++ n) {
+      all_binary = all_binary && tree_statistics::is_binary_file(paths[n]);
+    }
+    if (all_binary && arg.write_binary.isSet()) {
+      // streaming merge of the sorted entries
+      merge_tree_statistics_files(paths, arg.output.getValue());
+      return 0;
+    }
+
+    INFO("Loading %s...", paths[0].c_str());
+    tree_statistics treestat;
+    treestat.load(paths[0]);
+
+    for (int n = 1; n < paths.size(); ++ n) {
+      INFO("Loading %s...", paths[n].c_str());
+      tree_statistics otherstat;
+      otherstat.load(paths[n]);
 
       treestat.accumulate(otherstat);
     }
 
-    variant_t stat_src;
-    treestat.write(&stat_src);
-    write_variant(stat_src, arg.output.getValue(),
-                  arg.write_text.isSet(), "StacTRST");
+    if (arg.write_binary.isSet()) {
+      treestat.write_binary(arg.output.getValue());
+    } else {
+      variant_t stat_src;
+      treestat.write(&stat_src);
+      write_variant(stat_src, arg.output.getValue(),
+                    arg.write_text.isSet(), "StacTRST");
+    }
     return 0;
   }
 }
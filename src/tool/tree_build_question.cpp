@@ -50,18 +50,17 @@ namespace spin {
     load_variant(&tree_src, arg.input.getValue());
     context_decision_tree tree(tree_src);
 
-    variant_t stats_src;
-    load_variant(&stats_src, arg.stats.getValue());
-    tree_statistics treestat(stats_src);
+    tree_statistics treestat;
+    treestat.load(arg.stats.getValue());
 
     size_t dim = 0;
     std::map<std::string, node*> leaves;
-    for (auto it = treestat.data().cbegin(), last = treestat.data().cend();
-         it != last; ++ it) {
-      std::string p = it->first.label[treestat.left_context_length()];
+    for (size_t i = 0; i < treestat.size(); ++ i) {
+      std::string p = phone_table::name(
+          treestat.key(i).phone(treestat.left_context_length()));
       auto lit = leaves.find(p);
       if (dim == 0) {
-        dim = it->second.first.rows();
+        dim = treestat.statistics(i).first.rows();
         INFO("Feature dimension = %d", dim);
       }
 
@@ -70,7 +69,7 @@ namespace spin {
         nnode->labels.push_back(p);
         lit = leaves.insert(std::make_pair(p, nnode)).first;
       }
-      lit->second->stats.accumulate(it->second);
+      lit->second->stats.accumulate(treestat.statistics(i));
     }
 
     std::set<node*> roots;
@@ -12,11 +12,10 @@
 #include <spin/io/variant.hpp>
 #include <spin/hmm/tree.hpp>
 #include <spin/hmm/treestat.hpp>
+#include <spin/hmm/tree_split.hpp>
+#include <spin/parallel.hpp>
 #include <queue>
 
-#include <boost/tuple/tuple.hpp>
-#include <boost/tuple/tuple_comparison.hpp>
-
 namespace spin {
   DEFINE_ARGCLASS(Arg, (gear::common_args),
                   (TCLAP::ValueArg<std::string>, stats,
@@ -31,79 +30,26 @@ namespace spin {
                    ("", "minocc", "", false, 50, "N")),
                   (TCLAP::ValueArg<float>, delta,
                    ("", "delta", "", false, 1.0, "delta")),
+                  (TCLAP::ValueArg<int>, threads,
+                   ("", "threads", "Number of threads examining questions",
+                    false, 1, "N")),
                   (TCLAP::SwitchArg, write_text,
                    ("", "write-text", ""))
                   );
 
-  
-  typedef
-  std::priority_queue<boost::tuple<double, const context_decision_tree_node*,
-                                   tree_question_ptr> > tree_split_queue;
-
-
-  double examine_question(tree_question_ptr pq,
-                          const tree_context_stat_list& statlist, int minocc) {
-    tree_Gaussian_statistics all, is_true, is_false;
-    //int tc = 0, fc = 0;
-    for (auto it = statlist.cbegin(), last = statlist.cend();
-         it != last; ++ it) {
-      all.accumulate(*(it->get<1>()));
-      if (pq->question(it->get<0>())) {
-        is_true.accumulate(*(it->get<1>()));
-      } else {
-        is_false.accumulate(*(it->get<1>()));
-      }
-    }
-    if (is_true.zero < minocc || is_false.zero < minocc)
-      return 0;
-    double gain = is_true.data_loglikelihood() + is_false.data_loglikelihood()
-      - all.data_loglikelihood();
-    
-    //std::cout << is_true.data_loglikelihood() << " + " << is_false.data_loglikelihood() << " - " << all.data_loglikelihood() << " = " << gain << std::endl;
-    //std::cout << tc << " " << is_true.zero << " : " << fc << std::endl;
-    
-    return gain;
-  }
-  
-  
-  tree_question_ptr
-  find_best_question(const context_decision_tree_node* pnode,
-                     const tree_context_stat_list& statlist,
-                     int minocc,
-                     double* pgain) {
-    double maxgain = 0.0;
-    tree_question_ptr maxq;
-    
-    const context_decision_tree& tree = pnode->tree;
-
-    // context_categorical_question
-    for (int ctx = - tree.left_context_length();
-         ctx <= tree.right_context_length(); ++ ctx) {
-      for (auto cit = tree.categories().begin(), clast = tree.categories().end();
-           cit != clast; ++ cit) {
-        tree_question_ptr q =
-          tree_question_ptr(new context_question(pnode->tree, cit->first, ctx));
-        double gain = examine_question(q, statlist, minocc);
-        if (gain > maxgain) {
-          maxgain = gain;
-          maxq = q;
-        }
-      }
-    }
 
-    for (int loc = 0; loc < 3; ++ loc) {
-      tree_question_ptr q =
-        tree_question_ptr(new location_question(pnode->tree, loc));
-      double gain = examine_question(q, statlist, minocc);
-      if (gain > maxgain) {
-        maxgain = gain;
-        maxq = q;
-      }
+  struct split_candidate {
+    double gain;
+    context_decision_tree_node* node;
+    split_question question;
+
+    bool operator < (const split_candidate& oth) const {
+      if (gain != oth.gain) return gain < oth.gain;
+      return node < oth.node;
     }
+  };
 
-    *pgain = maxgain;
-    return maxq;
-  }
+  typedef std::priority_queue<split_candidate> tree_split_queue;
 
   void reassign_state_numbers(context_decision_tree* ptree) {
     std::queue<context_decision_tree_node*> que;
@@ -147,50 +93,61 @@ namespace spin {
     load_variant(&tree_src, arg.input.getValue());
     context_decision_tree tree(tree_src);
 
-    variant_t stats_src;
-    load_variant(&stats_src, arg.stats.getValue());
-    tree_statistics treestat(stats_src);
+    tree_statistics treestat;
+    treestat.load(arg.stats.getValue());
 
     tree.set_left_context_length(treestat.left_context_length());
     tree.set_right_context_length(treestat.right_context_length());
-    
-    tree_membership membership;
-    treestat.compute_membership(tree, &membership);
+
+    tree_split_engine engine(tree, treestat);
+    std::map<const context_decision_tree_node*, std::vector<int> > membership;
+    engine.compute_membership(&membership);
 
     int id = 0;
     for (auto it = membership.begin(), last = membership.end();
          it != last; ++ it){
       std::cout << "Node " << id++ << " has " << it->second.size() << " stats" << std::endl;
     }
-    
-    tree_split_queue que;
+
+    int nthreads = std::max(1, arg.threads.getValue());
+    worker_pool pool(nthreads);
+    int minocc = arg.minocc.getValue();
+
+    // initial leaves are examined in parallel, one leaf per job
+    std::vector<context_decision_tree_node*> leaves;
     int nnosplit = 0;
-    
     for (auto it = membership.begin(), last = membership.end();
          it != last; ++ it){
-      double gain;
       if (! it->first->nosplit) {
-        tree_question_ptr q = find_best_question(it->first, it->second, arg.minocc.getValue(), &gain);
-
-        if (gain > arg.delta.getValue()) {
-          que.push(boost::make_tuple(gain, it->first, q));
-        }
+        leaves.push_back(const_cast<context_decision_tree_node*>(it->first));
+        // ^ want to avoid const_cast, need to refactor
       } else {
         ++ nnosplit;
       }
     }
+    std::vector<split_candidate> initial(leaves.size());
+    pool.run(leaves.size(), [&](int n) {
+        initial[n].node = leaves[n];
+        initial[n].question =
+          engine.find_best_question(membership.find(leaves[n])->second,
+                                    minocc, &initial[n].gain);
+      });
+
+    tree_split_queue que;
+    for (size_t n = 0; n < initial.size(); ++ n) {
+      if (initial[n].gain > arg.delta.getValue()) {
+        que.push(initial[n]);
+      }
+    }
 
     while (membership.size() < (arg.maxstate.getValue() - nnosplit) &&
            que.size() > 0) {
-      boost::tuple<double, const context_decision_tree_node*,
-                   tree_question_ptr> front = que.top();
-      context_decision_tree_node* node =
-        const_cast<context_decision_tree_node*>(front.get<1>());
-      // ^ want to avoid const_cast, need to refactor
-      double gain = front.get<0>();
-      tree_question_ptr pq = front.get<2>();
+      split_candidate front = que.top();
+      context_decision_tree_node* node = front.node;
+      double gain = front.gain;
       que.pop();
-      if (gain < arg.delta.getValue()) continue;
+      if (gain < arg.delta.getValue() ||
+          front.question.type == split_question::NONE) continue;
 
       INFO("Split and gain %f", gain);
       
@@ -199,33 +156,39 @@ namespace spin {
       context_decision_tree_node* falsenode = new context_decision_tree_node(-1, tree);
       node->is_leaf = false;
       node->nosplit = false;
-      node->question = pq;
+      node->question = engine.make_question(front.question);
       node->is_true = truenode;
       node->is_false = falsenode;
 
       int nframes_true = 0, nframes_false = 0;
-      for (auto it = membership[node].cbegin(), last = membership[node].cend();
+      std::vector<int>& trueentries = membership[truenode];
+      std::vector<int>& falseentries = membership[falsenode];
+      const std::vector<int>& entries = membership[node];
+      for (auto it = entries.cbegin(), last = entries.cend();
            it != last; ++ it) {
-        if (pq->question(it->get<0>())) {
-          nframes_true += static_cast<int>(it->get<1>()->zero);
-          membership[truenode].push_back(*it);
+        int zero = static_cast<int>(engine.statistics(*it).zero);
+        if (engine.answer(front.question, *it)) {
+          nframes_true += zero;
+          trueentries.push_back(*it);
         } else {
-          nframes_false += static_cast<int>(it->get<1>()->zero);
-          membership[falsenode].push_back(*it);
+          nframes_false += zero;
+          falseentries.push_back(*it);
         }
       }
       INFO("# frames = (%d, %d)", nframes_true, nframes_false);      
       membership.erase(node);      
 
       // find best_q for these
-      double truegain, falsegain;
-      tree_question_ptr trueq =
-        find_best_question(truenode, membership[truenode], arg.minocc.getValue(), &truegain);
-      tree_question_ptr falseq =
-        find_best_question(falsenode, membership[falsenode], arg.minocc.getValue(), &falsegain);
-
-      que.push(boost::make_tuple(truegain, truenode, trueq));
-      que.push(boost::make_tuple(falsegain, falsenode, falseq));
+      split_candidate truecand, falsecand;
+      truecand.node = truenode;
+      truecand.question = engine.find_best_question(trueentries, minocc,
+                                                    &truecand.gain, &pool);
+      falsecand.node = falsenode;
+      falsecand.question = engine.find_best_question(falseentries, minocc,
+                                                     &falsecand.gain, &pool);
+
+      que.push(truecand);
+      que.push(falsecand);
     }
     INFO("Final # of leaves = %d", membership.size());
 
@@ -11,6 +11,8 @@
 #include <spin/io/variant.hpp>
 #include <spin/io/fst.hpp>
 #include <spin/hmm/tree.hpp>
+#include <spin/hmm/hcfst.hpp>
+#include <spin/hmm/treestat.hpp>
 
 #include <boost/algorithm/string.hpp>
 namespace spin {
@@ -24,7 +26,15 @@ namespace spin {
                   (TCLAP::ValueArg<int>, nstates,
                    ("", "nstates", "", false, 3, "N")),
                   (TCLAP::ValueArg<std::string>, disamb,
-                   ("", "disamb", "", false, "", "S1,S2,..."))
+                   ("", "disamb", "", false, "", "S1,S2,...")),
+                  (TCLAP::ValueArg<std::string>, lexicon,
+                   ("", "lexicon", "Only use contexts of phone pairs appearing "
+                    "within or across words of the lexicon "
+                    "(\"WORD PHONE1 PHONE2 ...\" per line)",
+                    false, "", "FILE")),
+                  (TCLAP::ValueArg<std::string>, contexts,
+                   ("", "contexts", "Only use contexts observed in "
+                    "the tree statistics", false, "", "FILE"))
                   );
   // as a first attempt, 
   // I will use zero transp and fixed num of states
@@ -44,8 +54,45 @@ namespace spin {
       }
     }
     
-    fst::script::VectorFstClass hcfst = tree.create_HC_FST(arg.nstates.getValue(),
-                                                           disamb);
+    boost::shared_ptr<context_license> license;
+    if (arg.lexicon.getValue().size() > 0 &&
+        arg.contexts.getValue().size() > 0) {
+      ERROR("--lexicon and --contexts cannot be used together");
+      return -1;
+    } else if (arg.lexicon.getValue().size() > 0) {
+      INFO("Loading lexicon");
+      std::ifstream ifs(arg.lexicon.getValue());
+      if (! ifs) {
+        ERROR("Cannot open %s", arg.lexicon.getValue().c_str());
+        return -1;
+      }
+      phone_pair_license* pairs = new phone_pair_license();
+      license.reset(pairs);
+      std::string line;
+      while (std::getline(ifs, line)) {
+        boost::trim(line);
+        if (line.empty()) continue;
+        std::vector<std::string> fields;
+        boost::split(fields, line, boost::is_any_of(" \t"),
+                     boost::token_compress_on);
+        pairs->add_pronunciation(std::vector<std::string>(fields.begin() + 1,
+                                                          fields.end()));
+      }
+    } else if (arg.contexts.getValue().size() > 0) {
+      INFO("Loading tree statistics");
+      tree_statistics treestat;
+      treestat.load(arg.contexts.getValue());
+      context_whitelist* whitelist = new context_whitelist();
+      license.reset(whitelist);
+      for (size_t i = 0; i < treestat.size(); ++ i) {
+        whitelist->add(treestat.key(i));
+      }
+      INFO("%d contexts are observed", static_cast<int>(whitelist->size()));
+    }
+
+    fst::script::VectorFstClass hcfst = license ?
+      create_HC_FST(tree, arg.nstates.getValue(), disamb, *license) :
+      tree.create_HC_FST(arg.nstates.getValue(), disamb);
     std::ofstream ofs(arg.output.getValue());
     if (arg.write_text.getValue()) {
       print_fst(std::cout, hcfst);